@@ -0,0 +1,311 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <complex>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+
+#include "fft.hpp"
+#include "batchfft.hpp"
+#include "filter.hpp"
+#include "batch.hpp"
+#include "wav.hpp"
+#include "parallel.hpp"
+#include "session.hpp"
+
+// Benchmarks of the transforms, band filtering and the whole file filtering path.
+// Prints a table and optionally writes the results as JSON for comparing versions.
+
+struct Result {
+    std::string name;
+    std::size_t size, bands;
+    double seconds;  // Best time of one repetition
+    double flops;    // Floating point operation equivalents of one repetition, 0 when not meaningful
+    std::size_t samples = 0;  // Samples one repetition transforms or filters, 0 when it is 'size'
+
+    double ns_per_sample() const {
+        return seconds * 1e9 / (samples ? samples : size);
+    }
+};
+
+struct Settings {
+    int min_log2 = 10, max_log2 = 26;
+    int naive_max_log2 = 12;
+    double min_time = 0.2;  // Seconds each benchmark is repeated for at least
+    std::string json_name;
+    std::vector<ctf::FftAlgorithm> algorithms {ctf::FftAlgorithm::radix4};
+};
+
+// Runs 'setup' untimed and 'run' timed until 'min_time' has passed (at least 3 times), returns the best time
+double measure(double min_time, const std::function<void()>& setup, const std::function<void()>& run) {
+    double best = INFINITY, total = 0;
+    for (int rep = 0; rep < 3 || total < min_time; rep++) {
+        setup();
+        const auto start = std::chrono::steady_clock::now();
+        run();
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = std::min(best, seconds);
+        total += seconds;
+    }
+    return best;
+}
+
+// Conventional operation count of a complex FFT, used for GFLOP equivalents
+double fft_flops(std::size_t size) {
+    return 5.0 * size * std::log2((double)size);
+}
+
+std::vector<double> random_samples(std::size_t size) {
+    std::uniform_real_distribution<double> unif(-1, 1);
+    std::default_random_engine re;
+    std::vector<double> samples(size);
+    for (auto& s : samples) {
+        s = unif(re);
+    }
+    return samples;
+}
+
+// 'count' bands spread evenly below the Nyquist frequency
+std::vector<ctf::Band> spread_bands(std::size_t count, uint32_t sample_rate) {
+    std::vector<ctf::Band> bands;
+    const uint32_t width = sample_rate / 2 / (count + 1);
+    for (std::size_t i = 0; i < count; i++) {
+        const uint32_t low = width * i + width / 2;
+        bands.push_back({low, low + width / 2, 0.1, 0.5});
+    }
+    return bands;
+}
+
+void bench_fft(const Settings& settings, std::vector<Result>& results) {
+    for (int log2 = settings.min_log2; log2 <= settings.max_log2; log2++) {
+        const std::size_t size = std::size_t(1) << log2;
+        auto samples = random_samples(size);
+        std::vector<std::complex<double>> series;
+
+        std::vector<std::complex<double>> input;
+
+        for (auto algorithm : settings.algorithms) {
+            // The default algorithm keeps the plain names to compare with earlier results
+            const std::string suffix = algorithm == ctf::FftAlgorithm::radix4
+                                     ? "" : std::string(":") + ctf::algorithm_name(algorithm);
+
+            const double forward = measure(settings.min_time, [] {},
+                                           [&] { series = ctf::radix2fft(samples, algorithm); });
+            results.push_back({"radix2fft" + suffix, size, 0, forward, fft_flops(size)});
+
+            const double inverse = measure(settings.min_time, [&] { input = series; },
+                                           [&] { ctf::radix2fft_inverse(input, algorithm); });
+            results.push_back({"radix2fft_inverse" + suffix, size, 0, inverse, fft_flops(size)});
+        }
+
+        if (log2 <= settings.naive_max_log2) {
+            const double naive = measure(settings.min_time, [&] { input.assign(samples.begin(), samples.end()); },
+                                         [&] { ctf::details::dft_naive(input); });
+            results.push_back({"dft_naive", size, 0, naive, 8.0 * size * size});
+        }
+    }
+}
+
+// Real transforms of 8 signals, one at a time & as one batch interleaved by signal
+void bench_batch(const Settings& settings, std::vector<Result>& results) {
+    constexpr std::size_t batch = 8;
+    for (int log2 = settings.min_log2; log2 <= std::min(settings.max_log2, 16); log2 += 2) {
+        const std::size_t size = std::size_t(1) << log2;
+        const auto samples = random_samples(size * batch);
+        const std::size_t bins = size / 2 + 1;
+
+        const auto plan = ctf::get_real_plan(size);
+        std::vector<std::complex<double>> spectra(bins * batch);
+        const double single = measure(settings.min_time, [] {}, [&] {
+            for (std::size_t b = 0; b < batch; b++) {
+                plan->forward(samples.data() + b * size, spectra.data() + b * bins);
+            }
+        });
+        results.push_back({"rfft x8", size, 0, single, batch * fft_flops(size / 2), size * batch});
+
+        const auto batch_plan = ctf::get_batch_real_plan(size);
+        std::vector<double> re(bins * batch), im(bins * batch);
+        const double batched = measure(settings.min_time, [] {},
+                                       [&] { batch_plan->forward(samples.data(), re.data(), im.data(), batch); });
+        results.push_back({"BatchRealFftPlan::forward x8", size, 0, batched, batch * fft_flops(size / 2),
+                           size * batch});
+    }
+}
+
+// Whole clips through one long-lived session, as libctf's ctf_filter_clip runs them
+void bench_session(const Settings& settings, std::vector<Result>& results) {
+    constexpr uint32_t sample_rate = 44100;
+    ctf::BasicFilterSession<float> session(sample_rate, 1, {{49, 51, 0, 0}, {0, 100, 0, 0}}, 50);
+    for (int log2 = std::max(settings.min_log2, 12); log2 <= std::min(settings.max_log2, 18); log2 += 2) {
+        const std::size_t size = std::size_t(1) << log2;
+        const auto samples = random_samples(size);
+        const std::vector<float> clip(samples.begin(), samples.end());
+        std::vector<float> out(size);
+        const double seconds = measure(settings.min_time, [] {}, [&] {
+            session.reset();
+            session.push(clip.data(), size);
+            session.finish();
+            session.pull(out.data(), size);
+        });
+        results.push_back({"FilterSession clip", size, 2, seconds, 0});
+    }
+}
+
+void bench_filter(const Settings& settings, std::vector<Result>& results) {
+    constexpr uint32_t sample_rate = 44100;
+    for (int log2 = settings.min_log2; log2 <= std::min(settings.max_log2, 22); log2 += 4) {
+        const std::size_t size = std::size_t(1) << log2;
+        const std::vector<std::complex<double>> spectrum(size / 2 + 1, comp(1, 1));
+
+        for (std::size_t count : {1, 4, 16, 64}) {
+            const auto bands = spread_bands(count, sample_rate);
+            std::vector<std::complex<double>> series;
+
+            const double band_cut = measure(settings.min_time, [&] { series = spectrum; }, [&] {
+                for (const auto& band : bands) ctf::band_cut(series, sample_rate, band, 50);
+            });
+            results.push_back({"band_cut", size, count, band_cut, 0});
+
+            const double rm_freqs = measure(settings.min_time, [&] { series = spectrum; }, [&] {
+                for (const auto& band : bands) ctf::rm_freqs(series, sample_rate, band);
+            });
+            results.push_back({"rm_freqs", size, count, rm_freqs, 0});
+
+            const auto response = ctf::get_filter_response(size, sample_rate, bands, 50);
+            const double apply = measure(settings.min_time, [&] { series = spectrum; },
+                                         [&] { response->apply(series); });
+            results.push_back({"FilterResponse::apply", size, count, apply, 0});
+        }
+    }
+}
+
+// Load, filter & save of a mono 16-bit file
+void bench_file(const Settings& settings, std::vector<Result>& results) {
+    constexpr uint32_t sample_rate = 44100;
+    const auto dir = std::filesystem::temp_directory_path();
+    const auto in_name = (dir / "ctf_bench_in.wav").string();
+    const auto out_name = (dir / "ctf_bench_out.wav").string();
+    ctf::ThreadPool pool(1);
+
+    for (int log2 = settings.min_log2; log2 <= settings.max_log2; log2 += 2) {
+        const std::size_t size = std::size_t(1) << log2;
+        {
+            const auto samples = random_samples(size);
+            ctf::WavWriter writer(in_name, {1, sample_rate, ctf::WavEncoding::pcm16}, size);
+            writer.write(0, 0, size, samples.data());
+            writer.finish();
+        }
+
+        for (std::size_t count : {1, 16}) {
+            const auto bands = spread_bands(count, sample_rate);
+            const double seconds = measure(settings.min_time, [] {}, [&] {
+                const ctf::WavReader reader(in_name);
+                ctf::WavWriter writer(out_name, reader.wav_format(), reader.frames());
+                ctf::filter_wav<double>(reader, writer, bands, 50, 0, pool);
+                writer.finish();
+            });
+            results.push_back({"filter_file", size, count, seconds, 2 * fft_flops(size / 2)});
+        }
+    }
+    std::filesystem::remove(in_name);
+    std::filesystem::remove(out_name);
+}
+
+void print_table(const std::vector<Result>& results) {
+    std::cout << std::left << std::setw(32) << "benchmark" << std::right << std::setw(11) << "size"
+              << std::setw(7) << "bands" << std::setw(14) << "time (ms)" << std::setw(12) << "ns/sample"
+              << std::setw(10) << "GFLOP/s" << "\n";
+    for (const auto& r : results) {
+        std::cout << std::left << std::setw(32) << r.name << std::right << std::setw(11) << r.size
+                  << std::setw(7) << r.bands << std::fixed << std::setprecision(4)
+                  << std::setw(14) << r.seconds * 1e3 << std::setw(12) << r.ns_per_sample()
+                  << std::setw(10) << std::setprecision(2) << (r.flops ? r.flops / r.seconds * 1e-9 : 0) << "\n";
+    }
+}
+
+void write_json(const std::vector<Result>& results, const std::string& name) {
+    std::ofstream out(name);
+    out << "{\n  \"isa\": \"" << ctf::simd::isa_name(ctf::simd::active_isa()) << "\",\n  \"results\": [\n";
+    for (std::size_t i = 0; i < results.size(); i++) {
+        const auto& r = results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"size\": " << r.size << ", \"bands\": " << r.bands
+            << std::setprecision(6) << ", \"seconds\": " << r.seconds
+            << ", \"ns_per_sample\": " << r.ns_per_sample()
+            << ", \"gflops\": " << (r.flops ? r.flops / r.seconds * 1e-9 : 0) << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+}
+
+void print_usage() {
+    std::cout << "Usage: bench [options]\n"
+        "\nOptions:\n"
+        "\t--sizes <min log2> <max log2> to set the range of 2^n sizes (defaults to 10 26)\n"
+        "\t--time <seconds> to set the minimum time of each benchmark (defaults to 0.2)\n"
+        "\t--only <fft|batch|session|filter|file> to run one group of benchmarks\n"
+        "\t--algorithm <radix4|radix2|split_radix|four_step|all> to set the transform algorithms (defaults to radix4)\n"
+        "\t--json <filename.json> to write the results as JSON\n"
+        "\t-h print this help message" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    Settings settings;
+    std::string only;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "-h") {
+            print_usage();
+            return 0;
+        } else if (arg == "--sizes" && i + 2 < argc) {
+            settings.min_log2 = std::stoi(argv[++i]);
+            settings.max_log2 = std::stoi(argv[++i]);
+        } else if (arg == "--time" && i + 1 < argc) {
+            settings.min_time = std::stod(argv[++i]);
+        } else if (arg == "--only" && i + 1 < argc) {
+            only = argv[++i];
+        } else if (arg == "--algorithm" && i + 1 < argc) {
+            const std::string name = argv[++i];
+            settings.algorithms.clear();
+            for (auto algorithm : {ctf::FftAlgorithm::radix4, ctf::FftAlgorithm::radix2, ctf::FftAlgorithm::split_radix,
+                                   ctf::FftAlgorithm::four_step}) {
+                if (name == "all" || name == ctf::algorithm_name(algorithm)) settings.algorithms.push_back(algorithm);
+            }
+            if (settings.algorithms.empty()) {
+                print_usage();
+                return 1;
+            }
+        } else if (arg == "--json" && i + 1 < argc) {
+            settings.json_name = argv[++i];
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    if (settings.min_log2 < 1 || settings.max_log2 < settings.min_log2) {
+        std::cerr << "Size range should be 1 <= min <= max" << std::endl;
+        return 1;
+    }
+
+    std::vector<Result> results;
+    if (only.empty() || only == "fft") bench_fft(settings, results);
+    if (only.empty() || only == "batch") bench_batch(settings, results);
+    if (only.empty() || only == "session") bench_session(settings, results);
+    if (only.empty() || only == "filter") bench_filter(settings, results);
+    if (only.empty() || only == "file") bench_file(settings, results);
+
+    print_table(results);
+    if (!settings.json_name.empty()) {
+        write_json(results, settings.json_name);
+    }
+
+    return 0;
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <vector>
+#include <complex>
+#include <string>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "fft.hpp"
+#include "parallel.hpp"
+#include "wav.hpp"
+#include "stats.hpp"
+
+namespace ctf {
+
+// Window functions of short-time transforms
+enum class Window { hann, hamming, blackman, rectangular };
+
+inline const char* window_name(Window window) {
+    switch (window) {
+        case Window::hamming: return "hamming";
+        case Window::blackman: return "blackman";
+        case Window::rectangular: return "rectangular";
+        default: return "hann";
+    }
+}
+
+// Short-time Fourier transform settings. Frame f covers samples [f * hop, f * hop + window_size),
+// windowed and zero padded to fft_size. Decimation keeps the largest magnitude of each group
+// of 'bin_decimation' bins & 'frame_decimation' frames, so peaks survive.
+struct StftSettings {
+    std::size_t fft_size = 2048;
+    std::size_t window_size = 0;  // 0 for fft_size
+    std::size_t hop = 0;          // 0 for a quarter of the window
+    Window window = Window::hann;
+    std::size_t bin_decimation = 1, frame_decimation = 1;
+};
+
+namespace details {
+
+// Periodic window of 'size' samples, scaled so the window sums to 1 and a bin's magnitude is its amplitude
+// in the windowed frame (a sine of amplitude a shows as about a/2)
+template <typename T>
+std::vector<T> window_table(Window window, std::size_t size) {
+    std::vector<double> values(size);
+    for (std::size_t i = 0; i < size; i++) {
+        const double x = 2 * M_PI * (double)i / (double)size;
+        switch (window) {
+            case Window::hann: values[i] = 0.5 - 0.5 * std::cos(x); break;
+            case Window::hamming: values[i] = 0.54 - 0.46 * std::cos(x); break;
+            case Window::blackman: values[i] = 0.42 - 0.5 * std::cos(x) + 0.08 * std::cos(2 * x); break;
+            default: values[i] = 1;
+        }
+    }
+    double sum = 0;
+    for (double value : values) sum += value;
+
+    std::vector<T> table(size);
+    for (std::size_t i = 0; i < size; i++) {
+        table[i] = (T)(values[i] / sum);
+    }
+    return table;
+}
+
+// Layout of spectrogram files (see docs/user-manual.md): a header of 'spectrogram_header_size' bytes,
+// then float32 magnitudes of every channel, frame by frame, bin by bin
+constexpr char spectrogram_magic[8] = {'C', 'T', 'F', 'S', 'G', 'R', 'M', '1'};
+constexpr std::size_t spectrogram_header_size = 64;
+
+// Number of frames 'hop' apart covering 'frames' samples, the last one is zero padded past the end of the input.
+// Every frame starts inside the input, so hops longer than the window skip the samples between frames.
+inline std::size_t stft_frames(std::size_t frames, std::size_t window_size, std::size_t hop) {
+    if (frames <= window_size) return 1;
+    return std::min(1 + (frames - window_size + hop - 1) / hop, 1 + (frames - 1) / hop);
+}
+} // Namespace details
+
+// Shape of a spectrogram, as stored in the header of spectrogram files
+struct SpectrogramShape {
+    uint32_t channels = 0, sample_rate = 0;
+    uint32_t fft_size = 0, window_size = 0, hop = 0;
+    Window window = Window::hann;
+    uint32_t bin_decimation = 1, frame_decimation = 1;
+    uint32_t bins = 0;    // Stored bins per frame, after decimation
+    uint64_t frames = 0;  // Stored frames per channel, after decimation
+};
+
+// Reads the magnitudes of a spectrogram file straight from a memory mapping of it
+class SpectrogramReader {
+public:
+    explicit SpectrogramReader(const std::string& path) : file(path) {
+        const uint8_t* h = file.data();
+        if (file.size() < details::spectrogram_header_size
+            || std::memcmp(h, details::spectrogram_magic, sizeof(details::spectrogram_magic))) {
+            throw std::invalid_argument(path + " is not a spectrogram file");
+        }
+        spectrogram_shape.channels = details::read_le<uint32_t>(h + 8);
+        spectrogram_shape.sample_rate = details::read_le<uint32_t>(h + 12);
+        spectrogram_shape.fft_size = details::read_le<uint32_t>(h + 16);
+        spectrogram_shape.window_size = details::read_le<uint32_t>(h + 20);
+        spectrogram_shape.hop = details::read_le<uint32_t>(h + 24);
+        spectrogram_shape.window = (Window)details::read_le<uint32_t>(h + 28);
+        spectrogram_shape.bin_decimation = details::read_le<uint32_t>(h + 32);
+        spectrogram_shape.frame_decimation = details::read_le<uint32_t>(h + 36);
+        spectrogram_shape.bins = details::read_le<uint32_t>(h + 40);
+        spectrogram_shape.frames = details::read_le<uint64_t>(h + 48);
+
+        const auto& s = spectrogram_shape;
+        if (file.size() != details::spectrogram_header_size + s.channels * s.frames * s.bins * sizeof(float)) {
+            throw std::invalid_argument(path + " is truncated");
+        }
+    }
+
+    const SpectrogramShape& shape() const { return spectrogram_shape; }
+
+    // The magnitudes of one frame of a channel, shape().bins values
+    const float* frame(std::size_t channel, std::size_t frame) const {
+        if (channel >= spectrogram_shape.channels || frame >= spectrogram_shape.frames) {
+            throw std::invalid_argument("Frame outside of the spectrogram");
+        }
+        const auto* magnitudes = reinterpret_cast<const float*>(file.data() + details::spectrogram_header_size);
+        return magnitudes + (channel * spectrogram_shape.frames + frame) * spectrogram_shape.bins;
+    }
+
+private:
+    details::MappedFile file;
+    SpectrogramShape spectrogram_shape;
+};
+
+// Shape of the spectrogram of 'frames' samples per channel with 'settings', checks the settings
+inline SpectrogramShape spectrogram_shape(const WavFormat& format, std::size_t frames, const StftSettings& settings) {
+    SpectrogramShape shape;
+    shape.channels = format.channels;
+    shape.sample_rate = format.sample_rate;
+    shape.fft_size = settings.fft_size;
+    shape.window_size = settings.window_size ? settings.window_size : settings.fft_size;
+    shape.hop = settings.hop ? settings.hop : std::max<std::size_t>(1, shape.window_size / 4);
+    shape.window = settings.window;
+    shape.bin_decimation = settings.bin_decimation;
+    shape.frame_decimation = settings.frame_decimation;
+    if (shape.fft_size < 2 || shape.fft_size % 2 || shape.window_size > shape.fft_size) {
+        throw std::invalid_argument("STFT size must be even and at least the window size");
+    }
+    if (shape.bin_decimation == 0 || shape.frame_decimation == 0) {
+        throw std::invalid_argument("Decimation factors must be positive");
+    }
+
+    shape.bins = (shape.fft_size / 2 + 1 + shape.bin_decimation - 1) / shape.bin_decimation;
+    shape.frames = (details::stft_frames(frames, shape.window_size, shape.hop) + shape.frame_decimation - 1)
+                 / shape.frame_decimation;
+    return shape;
+}
+
+// Writes the magnitude spectrogram of every channel of 'reader' to a spectrogram file at 'path'.
+// Frames are spread across 'pool', every thread transforms its frames one at a time with the shared plan
+// & window table into its own buffers. The file is written through a memory mapping & renamed into place.
+template <typename T>
+SpectrogramShape write_spectrogram(const WavReader& reader, const std::string& path, const StftSettings& settings,
+                                   ThreadPool& pool, Stats* stats=nullptr) {
+    using C = std::complex<T>;
+    const auto shape = spectrogram_shape(reader.wav_format(), reader.frames(), settings);
+    const std::size_t spectrum_bins = shape.fft_size / 2 + 1;
+    const std::size_t stft_frames = details::stft_frames(reader.frames(), shape.window_size, shape.hop);
+
+    const auto [plan, window] = [&] {
+        Stats::Scope scope(stats, "plan");
+        return std::pair(get_real_plan<T>(shape.fft_size), details::window_table<T>(shape.window, shape.window_size));
+    }();
+
+    const std::string temp_path = path + ".part";
+    details::MappedFile file(temp_path, details::spectrogram_header_size
+                                        + shape.channels * shape.frames * shape.bins * sizeof(float));
+    try {
+        uint8_t* h = file.data();
+        std::memset(h, 0, details::spectrogram_header_size);
+        std::memcpy(h, details::spectrogram_magic, sizeof(details::spectrogram_magic));
+        details::write_le<uint32_t>(h + 8, shape.channels);
+        details::write_le<uint32_t>(h + 12, shape.sample_rate);
+        details::write_le<uint32_t>(h + 16, shape.fft_size);
+        details::write_le<uint32_t>(h + 20, shape.window_size);
+        details::write_le<uint32_t>(h + 24, shape.hop);
+        details::write_le<uint32_t>(h + 28, (uint32_t)shape.window);
+        details::write_le<uint32_t>(h + 32, shape.bin_decimation);
+        details::write_le<uint32_t>(h + 36, shape.frame_decimation);
+        details::write_le<uint32_t>(h + 40, shape.bins);
+        details::write_le<uint64_t>(h + 48, shape.frames);
+        auto* magnitudes = reinterpret_cast<float*>(h + details::spectrogram_header_size);
+
+        Stats::Scope scope(stats, "stft");
+        pool.parallel_for(shape.channels * shape.frames, [&](std::size_t begin, std::size_t end) {
+            thread_local std::vector<T> samples;
+            thread_local std::vector<C> spectrum;
+            samples.resize(shape.fft_size);
+            spectrum.resize(spectrum_bins);
+
+            for (std::size_t row = begin; row < end; row++) {
+                const std::size_t channel = row / shape.frames;
+                float* out = magnitudes + row * shape.bins;
+                std::fill(out, out + shape.bins, 0.0f);
+
+                // Largest magnitude of every group of decimated frames & bins
+                const std::size_t first = (row % shape.frames) * shape.frame_decimation;
+                const std::size_t last = std::min(first + shape.frame_decimation, stft_frames);
+                for (std::size_t f = first; f < last; f++) {
+                    const std::size_t start = f * shape.hop;
+                    const std::size_t count = start < reader.frames()
+                                            ? std::min<std::size_t>(shape.window_size, reader.frames() - start) : 0;
+                    reader.read(channel, start, count, samples.data());
+                    for (std::size_t i = 0; i < count; i++) {
+                        samples[i] *= window[i];
+                    }
+                    std::fill(samples.begin() + count, samples.end(), 0);
+                    plan->forward(samples.data(), spectrum.data());
+
+                    for (std::size_t bin = 0; bin < spectrum_bins; bin++) {
+                        float& value = out[bin / shape.bin_decimation];
+                        value = std::max(value, (float)std::sqrt(std::norm(spectrum[bin])));
+                    }
+                }
+            }
+        });
+    } catch (...) {
+        ::unlink(temp_path.c_str());
+        throw;
+    }
+
+    Stats::Scope scope(stats, "save");
+    if (::rename(temp_path.c_str(), path.c_str()) != 0) {
+        ::unlink(temp_path.c_str());
+        throw std::runtime_error("Failed to write " + path);
+    }
+    return shape;
+}
+} // Namespace ctf
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <vector>
+#include <complex>
+#include <string>
+#include <sstream>
+#include <istream>
+#include <span>
+#include <algorithm>
+#include <stdexcept>
+#include <glob.h>
+
+#include "fft.hpp"
+#include "planner.hpp"
+#include "filter.hpp"
+#include "parallel.hpp"
+#include "pipeline.hpp"
+#include "wav.hpp"
+#include "stats.hpp"
+#include "workspace.hpp"
+
+namespace ctf {
+
+// One input file of a batch and the filter applied to it
+struct BatchJob {
+    std::string in_name, out_name;
+    std::vector<Band> bands;
+    int roll = 50;
+};
+
+// Filters a signal zero padded to a transform length (see ctf::fft_size) in place.
+// Transform plans and filter responses are cached, so filtering many signals
+// of the same length and sample rate only computes them once. Plans are chosen by ctf::planner().
+// Stages are recorded to 'stats' if given.
+// The spectrum is kept in 'workspace', so once plans, responses & workspace exist for a length
+// filtering doesn't allocate, except for splitting the transforms across 'pool'.
+template <typename T>
+void filter_padded(std::span<T> padded, uint32_t sample_rate, const std::vector<Band>& bands, int roll,
+                   Workspace& workspace, ThreadPool* pool=nullptr, Stats* stats=nullptr) {
+    const auto [plan, response, choice] = [&] {
+        Stats::Scope scope(stats, "plan");
+        const auto choice = planner().choose<T>(padded.size(), pool);
+        return std::tuple(get_real_plan<T>(padded.size(), choice.algorithm),
+                          get_filter_response(padded.size(), sample_rate, bands, roll), choice);
+    }();
+    if (choice.threads == 1) pool = nullptr;
+    const auto fourier_series = workspace.get<std::complex<T>>(plan->spectrum_size(), Workspace::spectrum_slot);
+    {
+        Stats::Scope scope(stats, "forward_fft");
+        plan->forward(padded.data(), fourier_series.data(), pool);
+    }
+    {
+        Stats::Scope scope(stats, "band_application");
+        response->apply(fourier_series.data());
+    }
+    Stats::Scope scope(stats, "inverse_fft");
+    plan->inverse(fourier_series.data(), padded.data(), pool);
+}
+
+// Same with a workspace per thread
+template <typename T>
+void filter_padded(std::vector<T>& padded, uint32_t sample_rate, const std::vector<Band>& bands, int roll,
+                   ThreadPool* pool=nullptr, Stats* stats=nullptr) {
+    thread_local Workspace workspace;
+    filter_padded(std::span<T>(padded), sample_rate, bands, roll, workspace, pool, stats);
+}
+
+// Filters samples in place
+template <typename T>
+void filter_samples(std::vector<T>& samples, uint32_t sample_rate, const std::vector<Band>& bands, int roll,
+                    ThreadPool* pool=nullptr, Stats* stats=nullptr) {
+    const std::size_t size = samples.size();
+    samples.resize(fft_size(size), 0);
+    filter_padded(samples, sample_rate, bands, roll, pool, stats);
+    samples.resize(size);
+}
+
+// Filters every channel of a WAVE file into an output file of the same format.
+// Samples are converted straight from the mapped input into the transform buffers and back.
+// With 'block_fft_size' the channels are filtered in blocks, keeping memory use constant:
+// decoding, transforms on every thread of 'pool' & encoding run as a pipeline (see ctf::filter_wav_pipelined).
+template <typename T>
+void filter_wav(const WavReader& reader, WavWriter& writer, const std::vector<Band>& bands,
+                int roll_amount, int block_fft_size, ThreadPool& pool, Stats* stats=nullptr) {
+    if (block_fft_size) {
+        filter_wav_pipelined<T>(reader, writer, bands, roll_amount, block_fft_size, pool.size(), 0, stats);
+        return;
+    }
+    const std::size_t frames = reader.frames();
+    {
+        // Chosen before the channels keep the threads busy (see Planner::choose)
+        Stats::Scope scope(stats, "plan");
+        planner().choose<T>(fft_size(frames), &pool);
+    }
+
+    // Channels are filtered concurrently, and each transform is split across the rest of the threads
+    pool.parallel_for(reader.channels(), [&](std::size_t first, std::size_t last) {
+        for (std::size_t channel = first; channel < last; channel++) {
+            std::vector<T> buffer(fft_size(frames), 0);
+            {
+                Stats::Scope scope(stats, "load");
+                reader.read(channel, 0, frames, buffer.data());
+            }
+            filter_padded(buffer, reader.sample_rate(), bands, roll_amount, &pool, stats);
+            Stats::Scope scope(stats, "save");
+            writer.write(channel, 0, frames, buffer.data());
+        }
+    }, reader.channels());
+}
+
+// Reads batch jobs, one per line: <infile.wav> <outfile.wav> [band f1 g1 f2 g2]... [-r amount]
+// Empty lines and lines starting with '#' are skipped. Throws std::invalid_argument on bad lines.
+inline std::vector<BatchJob> parse_manifest(std::istream& manifest) {
+    std::vector<BatchJob> jobs;
+    std::string line;
+    for (std::size_t line_number = 1; std::getline(manifest, line); line_number++) {
+        std::istringstream tokens(line);
+        BatchJob job;
+        if (!(tokens >> job.in_name) || job.in_name.starts_with("#")) continue;
+
+        const auto fail = [&](const std::string& msg) {
+            throw std::invalid_argument("Manifest line " + std::to_string(line_number) + ": " + msg);
+        };
+        if (!(tokens >> job.out_name)) fail("output file missing");
+
+        std::string token;
+        while (tokens >> token) {
+            if (token == "band") {
+                Band band;
+                if (!(tokens >> band.freq1 >> band.gain1 >> band.freq2 >> band.gain2)) fail("bad band");
+                job.bands.push_back(band);
+            } else if (token == "-r") {
+                if (!(tokens >> job.roll) || job.roll < 0) fail("bad roll off amount");
+            } else {
+                fail("unknown argument '" + token + "'");
+            }
+        }
+        if (job.bands.empty()) fail("no frequency bands");
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+// Returns a job for every file matching 'pattern', written with the same name to 'out_dir'
+inline std::vector<BatchJob> glob_jobs(const std::string& pattern, const std::string& out_dir,
+                                       const std::vector<Band>& bands, int roll) {
+    glob_t matches;
+    const int status = glob(pattern.c_str(), 0, nullptr, &matches);
+    if (status != 0 && status != GLOB_NOMATCH) {
+        throw std::invalid_argument("Failed to expand " + pattern);
+    }
+
+    std::vector<BatchJob> jobs;
+    for (std::size_t i = 0; status == 0 && i < matches.gl_pathc; i++) {
+        const std::string in_name = matches.gl_pathv[i];
+        const auto slash = in_name.find_last_of('/');
+        const auto file_name = slash == std::string::npos ? in_name : in_name.substr(slash + 1);
+        jobs.push_back({in_name, out_dir + "/" + file_name, bands, roll});
+    }
+    globfree(&matches);
+    return jobs;
+}
+} // Namespace ctf
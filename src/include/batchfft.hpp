@@ -0,0 +1,246 @@
+#pragma once
+
+#include <complex>
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include "fft.hpp"
+#include "simd.hpp"
+#include "parallel.hpp"
+
+namespace ctf {
+
+// Transforms of many complex signals of the same size n at once, with one plan for the whole batch.
+// Signals are interleaved by batch: sample i of signal b is at [i * batch + b], in separate arrays of
+// real & imaginary parts. Every butterfly then runs across all signals of the batch with one SIMD lane
+// per signal and the twiddles of one position shared by all lanes, so short transforms keep the lanes
+// busy where a transform at a time would spend its time on loop overhead & partial vectors.
+// Sizes with factors other than 2, 3 & 5 transform the signals one at a time (see BasicFftPlan).
+template <typename T>
+class BasicBatchFftPlan {
+public:
+    explicit BasicBatchFftPlan(std::size_t size) : n(size) {
+        if (n == 0) {
+            throw std::invalid_argument("FFT plan size must be positive");
+        }
+        const auto radices = details::mixed_radices(n, false);
+        if (!radices) {
+            signal_plan = get_plan<T>(n);
+            return;
+        }
+
+        std::size_t span = 1;
+        for (auto radix : *radices) {
+            stages.push_back({radix, span, twiddles_re.size()});
+            for (std::size_t j = 1; j < radix; j++) {
+                for (std::size_t k = 0; k < span; k++) {
+                    const auto w = std::polar(1.0, -2.0 * M_PI * (double)(j * k) / (double)(span * radix));
+                    twiddles_re.push_back((T)w.real());
+                    twiddles_im.push_back((T)w.imag());
+                }
+            }
+            span *= radix;
+        }
+        input_order = details::digit_reversed_order(*radices);
+    }
+
+    std::size_t size() const { return n; }
+
+    // Bytes held by the plan's tables, a plan for other sizes is cached on its own
+    std::size_t bytes() const {
+        return sizeof(*this) + details::vector_bytes(stages) + details::vector_bytes(twiddles_re)
+               + details::vector_bytes(twiddles_im) + details::vector_bytes(input_order);
+    }
+
+    // Transforms below take 'batch' signals in & out, which may not overlap.
+    // Batches are split across the pool by signals, the result is the same for any number of threads.
+
+    void forward(const T* in_re, const T* in_im, T* out_re, T* out_im, std::size_t batch,
+                 ThreadPool* pool=nullptr) const {
+        executor(batch, pool).run(lane_groups(batch), [&](std::size_t begin, std::size_t end) {
+            transform<false>(in_re, in_im, batch, out_re, out_im, batch, lanes(begin, batch), lanes(end, batch));
+        });
+    }
+
+    // Scaled by 1/n
+    void inverse(const T* in_re, const T* in_im, T* out_re, T* out_im, std::size_t batch,
+                 ThreadPool* pool=nullptr) const {
+        executor(batch, pool).run(lane_groups(batch), [&](std::size_t begin, std::size_t end) {
+            const std::size_t first = lanes(begin, batch), last = lanes(end, batch);
+            transform<true>(in_re, in_im, batch, out_re, out_im, batch, first, last);
+            scale(out_re, out_im, batch, first, last);
+        });
+    }
+
+private:
+    template <typename> friend class BasicBatchRealFftPlan;
+
+    struct Stage {
+        std::size_t radix, span, twiddle_offset;
+    };
+
+    // Lanes handed to a thread at a time, smaller batches run on the calling thread
+    static constexpr std::size_t lane_group = 8;
+
+    // Batches of fewer values are not worth splitting across threads
+    static constexpr std::size_t parallel_size = 1 << 15;
+
+    std::size_t n;
+    std::vector<Stage> stages;
+    std::vector<T> twiddles_re, twiddles_im;  // Grouped by input of each stage as for split complex transforms
+    std::vector<uint32_t> input_order;
+    std::shared_ptr<const BasicFftPlan<T>> signal_plan;  // Other sizes
+
+    static std::size_t lane_groups(std::size_t batch) { return (batch + lane_group - 1) / lane_group; }
+    static std::size_t lanes(std::size_t groups, std::size_t batch) { return std::min(groups * lane_group, batch); }
+
+    details::Executor executor(std::size_t batch, ThreadPool* pool) const {
+        return details::Executor(n * batch >= parallel_size ? pool : nullptr);
+    }
+
+    // Transforms lanes [first, last) of the batch. Input rows (the values of one position) are 'in_stride'
+    // values apart, which lets real transforms read their even & odd samples straight from the signal.
+    template <bool inverse>
+    void transform(const T* in_re, const T* in_im, std::size_t in_stride, T* re, T* im, std::size_t batch,
+                   std::size_t first, std::size_t last) const {
+        if (signal_plan) {
+            auto* signal = details::scratch<T>(n, details::batch_signal_slot);
+            for (std::size_t lane = first; lane < last; lane++) {
+                for (std::size_t i = 0; i < n; i++) {
+                    signal[i] = std::complex<T>(in_re[i * in_stride + lane], in_im[i * in_stride + lane]);
+                }
+                if (inverse) {
+                    // Unscaled like the mixed radix stages, inverse is the conjugate of forward
+                    std::transform(signal, signal + n, signal, [](auto val) { return std::conj(val); });
+                    signal_plan->forward(signal);
+                    std::transform(signal, signal + n, signal, [](auto val) { return std::conj(val); });
+                } else {
+                    signal_plan->forward(signal);
+                }
+                for (std::size_t i = 0; i < n; i++) {
+                    re[i * batch + lane] = signal[i].real();
+                    im[i * batch + lane] = signal[i].imag();
+                }
+            }
+            return;
+        }
+
+        const std::size_t count = (last - first) * sizeof(T);
+        for (std::size_t pos = 0; pos < n; pos++) {
+            std::memcpy(re + pos * batch + first, in_re + input_order[pos] * in_stride + first, count);
+            std::memcpy(im + pos * batch + first, in_im + input_order[pos] * in_stride + first, count);
+        }
+        for (const auto& stage : stages) {
+            simd::batch_kernel<T>(inverse, stage.radix)(re, im, n, stage.span, batch, first, last,
+                                                       &twiddles_re[stage.twiddle_offset],
+                                                       &twiddles_im[stage.twiddle_offset]);
+        }
+    }
+
+    void scale(T* re, T* im, std::size_t batch, std::size_t first, std::size_t last) const {
+        const T factor = 1.0 / n;
+        for (std::size_t pos = 0; pos < n; pos++) {
+            for (std::size_t lane = first; lane < last; lane++) {
+                re[pos * batch + lane] *= factor;
+                im[pos * batch + lane] *= factor;
+            }
+        }
+    }
+};
+
+// Transforms of many real signals of the same even size n at once, interleaved by batch like
+// BasicBatchFftPlan. As with BasicRealFftPlan the even & odd samples are packed into a batch of complex
+// transforms of size n/2, and the n/2+1 non-redundant bins are stored, also interleaved by batch.
+template <typename T>
+class BasicBatchRealFftPlan {
+public:
+    explicit BasicBatchRealFftPlan(std::size_t size) : n(size), half(size / 2) {
+        if (n < 2 || n % 2) {
+            throw std::invalid_argument("Real FFT plan size must be even and at least 2");
+        }
+
+        twiddles.resize(n / 4 + 1);
+        for (std::size_t k = 0; k < twiddles.size(); k++) {
+            twiddles[k] = (std::complex<T>)std::polar(1.0, -2.0 * M_PI * (double)k / (double)n);
+        }
+    }
+
+    std::size_t size() const { return n; }
+    std::size_t spectrum_size() const { return n / 2 + 1; }
+    std::size_t bytes() const { return half.bytes() + details::vector_bytes(twiddles); }
+
+    // 'in' holds n samples of every signal, 'out_re' & 'out_im' receive n/2+1 bins of every signal
+    void forward(const T* in, T* out_re, T* out_im, std::size_t batch, ThreadPool* pool=nullptr) const {
+        const std::size_t h = n / 2;
+        half.executor(batch, pool).run(half.lane_groups(batch), [&](std::size_t begin, std::size_t end) {
+            const std::size_t first = half.lanes(begin, batch), last = half.lanes(end, batch);
+
+            // Even samples as real & odd samples as imaginary parts, transformed into the first h bins
+            half.template transform<false>(in, in + batch, 2 * batch, out_re, out_im, batch, first, last);
+
+            // Separate the transforms of even & odd samples and combine them in place
+            simd::bins_kernel<T>(false)(out_re, out_im, out_re, out_im, h, batch, first, last,
+                                        reinterpret_cast<const T*>(twiddles.data()));
+            for (std::size_t lane = first; lane < last; lane++) {
+                const T z0_re = out_re[lane], z0_im = out_im[lane];
+                out_re[lane] = z0_re + z0_im;
+                out_im[lane] = 0;
+                out_re[h * batch + lane] = z0_re - z0_im;
+                out_im[h * batch + lane] = 0;
+            }
+        });
+    }
+
+    // 'in_re' & 'in_im' hold n/2+1 bins of every signal, 'out' receives n samples of every signal
+    void inverse(const T* in_re, const T* in_im, T* out, std::size_t batch, ThreadPool* pool=nullptr) const {
+        const std::size_t h = n / 2;
+        half.executor(batch, pool).run(half.lane_groups(batch), [&](std::size_t begin, std::size_t end) {
+            const std::size_t first = half.lanes(begin, batch), last = half.lanes(end, batch);
+
+            // Rebuild the packed half size spectra, then transform them next to each other
+            auto* packed_re = reinterpret_cast<T*>(details::scratch<T>(2 * h * batch, details::batch_slot));
+            auto* packed_im = packed_re + h * batch;
+            auto* re = packed_im + h * batch;
+            auto* im = re + h * batch;
+            simd::bins_kernel<T>(true)(in_re, in_im, packed_re, packed_im, h, batch, first, last,
+                                       reinterpret_cast<const T*>(twiddles.data()));
+            for (std::size_t lane = first; lane < last; lane++) {
+                packed_re[lane] = (in_re[lane] + in_re[h * batch + lane]) * (T)0.5;
+                packed_im[lane] = (in_re[lane] - in_re[h * batch + lane]) * (T)0.5;
+            }
+            half.template transform<true>(packed_re, packed_im, batch, re, im, batch, first, last);
+
+            const T scale = 1.0 / h;
+            for (std::size_t k = 0; k < h; k++) {
+                for (std::size_t lane = first; lane < last; lane++) {
+                    out[2 * k * batch + lane] = re[k * batch + lane] * scale;
+                    out[(2 * k + 1) * batch + lane] = im[k * batch + lane] * scale;
+                }
+            }
+        });
+    }
+
+private:
+    std::size_t n;
+    BasicBatchFftPlan<T> half;
+    std::vector<std::complex<T>> twiddles;
+};
+
+using BatchFftPlan = BasicBatchFftPlan<double>;
+using BatchRealFftPlan = BasicBatchRealFftPlan<double>;
+
+// Returns shared batched plans for the given size & sample type, plans are built on first use
+template <typename T=double>
+std::shared_ptr<const BasicBatchFftPlan<T>> get_batch_plan(std::size_t size) {
+    return details::cached_plan<BasicBatchFftPlan<T>>(size);
+}
+
+template <typename T=double>
+std::shared_ptr<const BasicBatchRealFftPlan<T>> get_batch_real_plan(std::size_t size) {
+    return details::cached_plan<BasicBatchRealFftPlan<T>>(size);
+}
+} // Namespace ctf
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <functional>
+
+namespace ctf {
+namespace details {
+
+// Bytes held by a vector's elements
+template <typename V>
+std::size_t vector_bytes(const V& v) {
+    return v.capacity() * sizeof(typename V::value_type);
+}
+
+// Shared values by key, the least recently used ones are dropped once all values together hold more than
+// 'limit' bytes. The value added last is kept even if it alone is larger. Dropped values stay alive for
+// users still holding them, so long-lived processes keep only the values they keep using.
+template <typename Key, typename Value>
+class LruCache {
+public:
+    explicit LruCache(std::size_t limit) : limit(limit) {}
+
+    // Returns the value of 'key', or null if it isn't cached. 'key' may be any type comparable with Key.
+    template <typename K>
+    std::shared_ptr<const Value> find(const K& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = index.find(key);
+        if (found == index.end()) return nullptr;
+        entries.splice(entries.begin(), entries, found->second);
+        return found->second->value;
+    }
+
+    // Adds 'value' of 'bytes' bytes, returns the value cached for 'key', which is the earlier one if another
+    // thread added it meanwhile
+    std::shared_ptr<const Value> insert(const Key& key, std::shared_ptr<const Value> value, std::size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = index.find(key);
+        if (found != index.end()) {
+            entries.splice(entries.begin(), entries, found->second);
+            return found->second->value;
+        }
+        entries.push_front({key, std::move(value), bytes});
+        index.emplace(key, entries.begin());
+        total += bytes;
+        while (total > limit && entries.size() > 1) {
+            total -= entries.back().bytes;
+            index.erase(entries.back().key);
+            entries.pop_back();
+        }
+        return entries.front().value;
+    }
+
+    // Bytes held by the cached values
+    std::size_t bytes() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return total;
+    }
+
+    std::size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.size();
+    }
+
+private:
+    struct Entry {
+        Key key;
+        std::shared_ptr<const Value> value;
+        std::size_t bytes;
+    };
+
+    mutable std::mutex mutex;
+    std::list<Entry> entries;  // Most recently used first
+    std::map<Key, typename std::list<Entry>::iterator, std::less<>> index;
+    std::size_t limit, total = 0;
+};
+} // Namespace details
+} // Namespace ctf
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <complex>
+#include <array>
+#include <cstddef>
+#include <utility>
+#include <bit>
+#include <string>
+#include <stdexcept>
+
+namespace ctf {
+namespace details {
+
+// Complex multiply without the NaN/inf recovery std::complex does by default
+template <typename T>
+std::complex<T> mul(const std::complex<T> a, const std::complex<T> b) {
+    return std::complex<T>(a.real() * b.real() - a.imag() * b.imag(),
+                           a.real() * b.imag() + a.imag() * b.real());
+}
+
+// Multiplies by -i in forward and by i in inverse transforms
+template <bool inverse, typename T>
+std::complex<T> rotate(const std::complex<T> a) {
+    return inverse ? std::complex<T>(-a.imag(), a.real()) : std::complex<T>(a.imag(), -a.real());
+}
+
+// DFT of 'radix' values in place
+template <bool inverse, std::size_t radix, typename T>
+[[gnu::always_inline]] inline void butterfly(std::complex<T>* a) {
+    if constexpr (radix == 2) {
+        const auto a0 = a[0];
+        a[0] = a0 + a[1];
+        a[1] = a0 - a[1];
+    } else if constexpr (radix == 4) {
+        const auto s02 = a[0] + a[2], d02 = a[0] - a[2];
+        const auto s13 = a[1] + a[3], d13 = rotate<inverse>(a[1] - a[3]);
+        a[0] = s02 + s13;
+        a[1] = d02 + d13;
+        a[2] = s02 - s13;
+        a[3] = d02 - d13;
+    } else if constexpr (radix == 3) {
+        constexpr T s = 0.86602540378443864676;  // sin(2pi/3)
+        const auto sum = a[1] + a[2];
+        const auto mid = a[0] - (T)0.5 * sum;
+        const auto rot = rotate<inverse>(a[1] - a[2]) * s;
+        a[0] = a[0] + sum;
+        a[1] = mid + rot;
+        a[2] = mid - rot;
+    } else {
+        constexpr T c1 = 0.30901699437494742410;   // cos(2pi/5)
+        constexpr T c2 = -0.80901699437494742410;  // cos(4pi/5)
+        constexpr T s1 = 0.95105651629515357212;   // sin(2pi/5)
+        constexpr T s2 = 0.58778525229247312917;   // sin(4pi/5)
+        const auto sum14 = a[1] + a[4], diff14 = a[1] - a[4];
+        const auto sum23 = a[2] + a[3], diff23 = a[2] - a[3];
+        const auto r1 = a[0] + c1 * sum14 + c2 * sum23;
+        const auto r2 = a[0] + c2 * sum14 + c1 * sum23;
+        const auto i1 = rotate<inverse>(s1 * diff14 + s2 * diff23);
+        const auto i2 = rotate<inverse>(s2 * diff14 - s1 * diff23);
+        a[0] = a[0] + sum14 + sum23;
+        a[1] = r1 + i1;
+        a[4] = r1 - i1;
+        a[2] = r2 + i2;
+        a[3] = r2 - i2;
+    }
+}
+
+constexpr long double pi = 3.141592653589793238462643383279502884L;
+
+// Taylor series of sin(x) & cos(x) for x in [0, pi/2]
+constexpr long double const_sin(long double x) {
+    long double term = x, sum = x;
+    for (int i = 1; i < 16; i++) {
+        term *= -x * x / ((2 * i) * (2 * i + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr long double const_cos(long double x) {
+    long double term = 1, sum = 1;
+    for (int i = 1; i < 16; i++) {
+        term *= -x * x / ((2 * i - 1) * (2 * i));
+        sum += term;
+    }
+    return sum;
+}
+
+// exp(-2 pi i m / length) at compile time, quarter turns are exact
+template <typename T>
+constexpr std::complex<T> const_twiddle(std::size_t m, std::size_t length) {
+    m %= length;
+    const std::size_t quarter = 4 * m / length;
+    const long double x = 2 * pi * (long double)(4 * m - quarter * length) / (long double)(4 * length);
+    const long double c = const_cos(x), s = const_sin(x);
+    switch (quarter) {
+        case 0: return std::complex<T>(c, -s);
+        case 1: return std::complex<T>(-s, -c);
+        case 2: return std::complex<T>(-c, s);
+        default: return std::complex<T>(s, c);
+    }
+}
+
+// Twiddles exp(-2 pi i m / length) for m in [0, length)
+template <typename T, std::size_t length>
+constexpr std::array<std::complex<T>, length> codelet_twiddles = [] {
+    std::array<std::complex<T>, length> table {};
+    for (std::size_t m = 0; m < length; m++) {
+        table[m] = const_twiddle<T>(m, length);
+    }
+    return table;
+}();
+
+// Codelets split N into the same radices as ctf::BasicFftPlan: a 2 first if log2(N) is odd, then 4s
+template <std::size_t N>
+constexpr std::size_t codelet_radix(std::size_t span) {
+    return span == 1 && std::countr_zero(N) % 2 ? 2 : 4;
+}
+
+// Input index of every position before the first stage, digit reversed for the codelet radices
+template <std::size_t N>
+constexpr std::array<std::size_t, N> codelet_order = [] {
+    std::array<std::size_t, N> order {};
+    for (std::size_t idx = 0; idx < N; idx++) {
+        std::size_t pos = 0, rest = idx;
+        for (std::size_t size = N; size > 1; ) {
+            // Radices from the outermost stage to the innermost
+            const std::size_t radix = size == 2 ? 2 : 4;
+            size /= radix;
+            pos += (rest % radix) * size;
+            rest /= radix;
+        }
+        order[pos] = idx;
+    }
+    return order;
+}();
+
+// Access to complex values stored interleaved or split into real & imaginary arrays
+template <typename T>
+struct Interleaved {
+    std::complex<T>* data;
+
+    std::complex<T> load(std::size_t i) const { return data[i]; }
+    void store(std::size_t i, const std::complex<T> value) const { data[i] = value; }
+    Interleaved at(std::size_t offset) const { return {data + offset}; }
+};
+
+template <typename T>
+struct Split {
+    T *re, *im;
+
+    std::complex<T> load(std::size_t i) const { return std::complex<T>(re[i], im[i]); }
+    void store(std::size_t i, const std::complex<T> value) const { re[i] = value.real(); im[i] = value.imag(); }
+    Split at(std::size_t offset) const { return {re + offset, im + offset}; }
+};
+
+// Multiplies by the twiddle exp(-2 pi i m / length), conjugated in inverse transforms.
+// The twiddle is a compile time constant, multiplications by 1 & -i are left out.
+template <bool inverse, std::size_t m, std::size_t length, typename T>
+[[gnu::always_inline]] inline std::complex<T> twiddle(const std::complex<T> value) {
+    if constexpr (m == 0) {
+        return value;
+    } else if constexpr (4 * m == length) {
+        return rotate<inverse>(value);
+    } else {
+        constexpr auto w = codelet_twiddles<T, length>[m];
+        return mul(value, inverse ? std::conj(w) : w);
+    }
+}
+
+// One butterfly at offset k of a stage, j is the sequence of inputs [0, radix)
+template <bool inverse, std::size_t radix, std::size_t span, std::size_t k, typename T, typename Data,
+          std::size_t... j>
+[[gnu::always_inline]] inline void codelet_butterfly(const Data x, std::index_sequence<j...>) {
+    std::complex<T> a[radix] {twiddle<inverse, j * k, radix * span>(x.load(k + j * span))...};
+    butterfly<inverse, radix>(a);
+    (x.store(k + j * span, a[j]), ...);
+}
+
+// Butterflies of one group of 'radix' sub-transforms, unrolled
+template <bool inverse, std::size_t radix, std::size_t span, typename T, typename Data, std::size_t... k>
+[[gnu::always_inline]] inline void codelet_group(const Data x, std::index_sequence<k...>) {
+    (codelet_butterfly<inverse, radix, span, k, T>(x, std::make_index_sequence<radix>()), ...);
+}
+
+// All butterflies of one stage of an N point transform, unrolled
+template <bool inverse, std::size_t radix, std::size_t span, typename T, typename Data, std::size_t... base>
+[[gnu::always_inline]] inline void codelet_stage(const Data x, std::index_sequence<base...>) {
+    (codelet_group<inverse, radix, span, T>(x.at(base * radix * span), std::make_index_sequence<span>()), ...);
+}
+
+// Stages from 'span' onwards of an N point transform of digit reversed input
+template <bool inverse, std::size_t N, typename T, std::size_t span=1, typename Data>
+[[gnu::always_inline]] inline void codelet_stages(const Data x) {
+    if constexpr (span < N) {
+        constexpr std::size_t radix = codelet_radix<N>(span);
+        codelet_stage<inverse, radix, span, T>(x, std::make_index_sequence<N / (radix * span)>());
+        codelet_stages<inverse, N, T, span * radix>(x);
+    }
+}
+
+// Complete N point transforms of digit reversed input over 'length' values, N at a time
+template <bool inverse, std::size_t N, typename T>
+void codelet(std::complex<T>* data, std::size_t length) {
+    for (std::size_t offset = 0; offset < length; offset += N) {
+        codelet_stages<inverse, N, T>(Interleaved<T> {data + offset});
+    }
+}
+
+template <bool inverse, std::size_t N, typename T>
+void split_codelet(T* re, T* im, std::size_t length) {
+    for (std::size_t offset = 0; offset < length; offset += N) {
+        codelet_stages<inverse, N, T>(Split<T> {re + offset, im + offset});
+    }
+}
+
+// N point transform of the values 'stride' apart from 'in' into 'out'
+template <bool inverse, std::size_t N, typename T>
+void strided_codelet(const std::complex<T>* in, std::size_t stride, std::complex<T>* out) {
+    for (std::size_t pos = 0; pos < N; pos++) {
+        out[pos] = in[stride * codelet_order<N>[pos]];
+    }
+    codelet_stages<inverse, N, T>(Interleaved<T> {out});
+}
+
+// Largest codelet size, larger transforms are built with stages on top of codelets
+constexpr std::size_t max_codelet_size = 64;
+
+template <typename T>
+using Codelet = void (*)(std::complex<T>*, std::size_t);
+
+template <typename T>
+using SplitCodelet = void (*)(T*, T*, std::size_t);
+
+// Thrown for sizes without a codelet, which only a plan bug asks for
+[[noreturn]] inline void no_codelet(std::size_t size) {
+    throw std::invalid_argument("No codelet of size " + std::to_string(size));
+}
+
+// Codelets of sizes 8 to 64, smaller transforms are a single butterfly anyway
+template <bool inverse, typename T>
+Codelet<T> get_codelet(std::size_t size) {
+    switch (size) {
+        case 8: return codelet<inverse, 8, T>;
+        case 16: return codelet<inverse, 16, T>;
+        case 32: return codelet<inverse, 32, T>;
+        case 64: return codelet<inverse, 64, T>;
+        default: no_codelet(size);
+    }
+}
+
+template <typename T>
+using StridedCodelet = void (*)(const std::complex<T>*, std::size_t, std::complex<T>*);
+
+// Strided codelets of sizes 2 to 64
+template <bool inverse, typename T>
+StridedCodelet<T> get_strided_codelet(std::size_t size) {
+    switch (size) {
+        case 2: return strided_codelet<inverse, 2, T>;
+        case 4: return strided_codelet<inverse, 4, T>;
+        case 8: return strided_codelet<inverse, 8, T>;
+        case 16: return strided_codelet<inverse, 16, T>;
+        case 32: return strided_codelet<inverse, 32, T>;
+        case 64: return strided_codelet<inverse, 64, T>;
+        default: no_codelet(size);
+    }
+}
+
+// Split complex codelets of sizes 8 to 64
+template <bool inverse, typename T>
+SplitCodelet<T> get_split_codelet(std::size_t size) {
+    switch (size) {
+        case 8: return split_codelet<inverse, 8, T>;
+        case 16: return split_codelet<inverse, 16, T>;
+        case 32: return split_codelet<inverse, 32, T>;
+        case 64: return split_codelet<inverse, 64, T>;
+        default: no_codelet(size);
+    }
+}
+} // Namespace details
+
+} // Namespace ctf
@@ -0,0 +1,97 @@
+/* C interface of libctf, for filtering audio inside other programs without starting ctf for every clip.
+ *
+ * A session filters interleaved float clips of a sample rate, channel count & band set. Push samples in
+ * buffers of any size, pull the filtered samples as they become ready and call ctf_session_finish()
+ * at the end of each clip. Filter spectra, transform plans & buffers stay with the session, so filtering
+ * one clip after another costs only the filtering. Output is aligned with the input and, once a clip is
+ * finished, as long as it.
+ *
+ * Functions returning int return CTF_OK or a negative error code, ctf_last_error() describes the last error
+ * of the calling thread. A session may be used from any thread, but from one thread at a time.
+ * The interface only grows: functions keep their signatures and new fields go to the end of structs.
+ */
+#ifndef CTF_H
+#define CTF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(CTF_SHARED) && defined(__GNUC__)
+#define CTF_API __attribute__((visibility("default")))
+#else
+#define CTF_API
+#endif
+
+/* Version of this interface, returned by ctf_api_version() */
+#define CTF_API_VERSION 1
+
+#define CTF_OK 0
+#define CTF_INVALID_ARGUMENT -1
+#define CTF_OUT_OF_MEMORY -2
+#define CTF_ERROR -3
+
+/* Frequencies between freq1 & freq2 hertz are cut to a gain interpolated from gain1 to gain2 */
+typedef struct ctf_band {
+    uint32_t freq1, freq2;
+    double gain1, gain2;
+} ctf_band;
+
+/* Settings of a session, set 'size' to sizeof(ctf_session_config) or use ctf_session_config_init() */
+typedef struct ctf_session_config {
+    size_t size;
+    uint32_t sample_rate;
+    uint32_t channels;
+    const ctf_band* bands;
+    size_t band_count;
+    int32_t roll;              /* Roll off in hertz around every band, 50 by default */
+    uint32_t block_size;       /* Frames filtered at a time, the latency of buffering input, 256 by default */
+    uint32_t design_size;      /* Transform size of the filter design, larger for sharper bands, 4096 by default */
+    int32_t double_precision;  /* Non-zero to filter in double instead of float precision */
+} ctf_session_config;
+
+typedef struct ctf_session ctf_session;
+
+CTF_API int ctf_api_version(void);
+
+/* Message of the last error on the calling thread, empty if none */
+CTF_API const char* ctf_last_error(void);
+
+/* Sets 'config' to the defaults: 44100 Hz, 1 channel, no bands */
+CTF_API void ctf_session_config_init(ctf_session_config* config);
+
+/* Creates a session in '*session', which must be destroyed with ctf_session_destroy() */
+CTF_API int ctf_session_create(const ctf_session_config* config, ctf_session** session);
+
+CTF_API void ctf_session_destroy(ctf_session* session);
+
+/* Frames of a clip to push before its first filtered frame is ready */
+CTF_API size_t ctf_session_latency(const ctf_session* session);
+
+/* Filters 'frames' interleaved frames of the current clip */
+CTF_API int ctf_session_push(ctf_session* session, const float* samples, size_t frames);
+
+/* Ends the current clip, its remaining frames become ready and the next push starts a new clip */
+CTF_API int ctf_session_finish(ctf_session* session);
+
+/* Number of filtered frames ready to pull */
+CTF_API size_t ctf_session_available(const ctf_session* session);
+
+/* Moves up to 'frames' ready interleaved frames to 'samples', returns the number of frames moved */
+CTF_API size_t ctf_session_pull(ctf_session* session, float* samples, size_t frames);
+
+/* Drops the current clip and any frames not pulled yet */
+CTF_API void ctf_session_reset(ctf_session* session);
+
+/* Filters a whole clip of 'frames' interleaved frames from 'in' to 'out', which may be the same.
+ * Frames of an earlier clip not pulled yet are dropped. */
+CTF_API int ctf_filter_clip(ctf_session* session, const float* in, float* out, size_t frames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -5,6 +5,19 @@
 #include <algorithm>
 #include <stdexcept>
 #include <cmath>
+#include <bit>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <tuple>
+#include <span>
+#include <optional>
+
+#include "simd.hpp"
+#include "codelet.hpp"
+#include "parallel.hpp"
+#include "workspace.hpp"
+#include "cache.hpp"
 
 #define comp(a, b) std::complex<double>(a, b)
 
@@ -12,12 +25,12 @@ namespace ctf {
 namespace details {
 
 // Swaps real & imaginary parts of every value in the input vector
-void flip_all(std::vector<std::complex<double>>& input) {
+inline void flip_all(std::vector<std::complex<double>>& input) {
     std::transform(input.begin(), input.end(), input.begin(), [](auto val) { return comp(val.imag(), val.real()); });
 }
 
 // Naive DFT used for testing
-void dft_naive(std::vector<std::complex<double>>& input) {
+inline void dft_naive(std::vector<std::complex<double>>& input) {
     std::vector<std::complex<double>> transform (input.size());
     
     for (int i = 0; i < input.size(); i++) {
@@ -30,72 +43,1056 @@ void dft_naive(std::vector<std::complex<double>>& input) {
     input = transform;
 }
 
-void radix2fft_rec(std::vector<std::complex<double>>& input, uint32_t size, uint32_t offset=0, uint32_t step=1) {
-    if (size == 1) return;
+// Butterflies of one mixed radix stage for k in [k_begin, k_end). Every group of 'radix'
+// sub-transforms of length 'span' is combined in place into one transform of length radix * span.
+template <bool inverse, std::size_t radix, typename T>
+void radix_stage(std::complex<T>* data, std::size_t n, std::size_t span, const std::complex<T>* twiddles,
+                 std::size_t k_begin, std::size_t k_end) {
+    const auto tw = [](const std::complex<T> w) { return inverse ? std::conj(w) : w; };
+
+    for (std::size_t base = 0; base < n; base += radix * span) {
+        auto* x = data + base;
+        for (std::size_t k = k_begin; k < k_end; k++) {
+            const auto* w = twiddles + k * (radix - 1);
+
+            if constexpr (radix == 2) {
+                const auto a = x[k];
+                const auto b = mul(x[k + span], tw(w[0]));
+                x[k] = a + b;
+                x[k + span] = a - b;
+            } else if constexpr (radix == 4) {
+                const auto a0 = x[k];
+                const auto a1 = mul(x[k + span], tw(w[0]));
+                const auto a2 = mul(x[k + 2 * span], tw(w[1]));
+                const auto a3 = mul(x[k + 3 * span], tw(w[2]));
+                const auto s02 = a0 + a2, d02 = a0 - a2;
+                const auto s13 = a1 + a3, d13 = rotate<inverse>(a1 - a3);
+                x[k] = s02 + s13;
+                x[k + span] = d02 + d13;
+                x[k + 2 * span] = s02 - s13;
+                x[k + 3 * span] = d02 - d13;
+            } else if constexpr (radix == 3) {
+                constexpr T s = 0.86602540378443864676;  // sin(2pi/3)
+                const auto a0 = x[k];
+                const auto a1 = mul(x[k + span], tw(w[0]));
+                const auto a2 = mul(x[k + 2 * span], tw(w[1]));
+                const auto sum = a1 + a2;
+                const auto mid = a0 - (T)0.5 * sum;
+                const auto rot = rotate<inverse>(a1 - a2) * s;
+                x[k] = a0 + sum;
+                x[k + span] = mid + rot;
+                x[k + 2 * span] = mid - rot;
+            } else {
+                constexpr T c1 = 0.30901699437494742410;   // cos(2pi/5)
+                constexpr T c2 = -0.80901699437494742410;  // cos(4pi/5)
+                constexpr T s1 = 0.95105651629515357212;   // sin(2pi/5)
+                constexpr T s2 = 0.58778525229247312917;   // sin(4pi/5)
+                const auto a0 = x[k];
+                const auto a1 = mul(x[k + span], tw(w[0]));
+                const auto a2 = mul(x[k + 2 * span], tw(w[1]));
+                const auto a3 = mul(x[k + 3 * span], tw(w[2]));
+                const auto a4 = mul(x[k + 4 * span], tw(w[3]));
+                const auto sum14 = a1 + a4, diff14 = a1 - a4;
+                const auto sum23 = a2 + a3, diff23 = a2 - a3;
+                const auto r1 = a0 + c1 * sum14 + c2 * sum23;
+                const auto r2 = a0 + c2 * sum14 + c1 * sum23;
+                const auto i1 = rotate<inverse>(s1 * diff14 + s2 * diff23);
+                const auto i2 = rotate<inverse>(s2 * diff14 - s1 * diff23);
+                x[k] = a0 + sum14 + sum23;
+                x[k + span] = r1 + i1;
+                x[k + 4 * span] = r1 - i1;
+                x[k + 2 * span] = r2 + i2;
+                x[k + 3 * span] = r2 - i2;
+            }
+        }
+    }
+}
+
+// Bins k & h-k of the spectrum of 2h real samples from bins k & h-k of the transform of
+// the samples packed into h complex values, 'w' is exp(-2 pi i k / 2h)
+template <typename T>
+std::pair<std::complex<T>, std::complex<T>> unpack_bins(const std::complex<T> zk, const std::complex<T> zhk,
+                                                         const std::complex<T> w) {
+    const auto zm = std::conj(zhk);
+    const auto even = (zk + zm) * (T)0.5;
+    const auto diff = (zk - zm) * (T)0.5;
+    const auto odd = std::complex<T>(diff.imag(), -diff.real());  // diff / i
+    const auto q = mul(w, odd);
+    return {even + q, std::conj(even - q)};
+}
 
-    // Calculate the two halves recursively
-    // and combine the calculated serieses into one
-    radix2fft_rec(input, size/2, offset, step*2);
-    radix2fft_rec(input, size/2, offset+step, step*2);
+// Inverse of unpack_bins, bins k & h-k of the packed transform from bins k & h-k of the spectrum
+template <typename T>
+std::pair<std::complex<T>, std::complex<T>> pack_bins(const std::complex<T> xk, const std::complex<T> xhk,
+                                                       const std::complex<T> w) {
+    const auto xm = std::conj(xhk);
+    const auto even = (xk + xm) * (T)0.5;
+    const auto odd = mul((xk - xm) * (T)0.5, std::conj(w));
+    const auto i_odd = std::complex<T>(-odd.imag(), odd.real());
+    return {even + i_odd, std::conj(even - i_odd)};
+}
 
-    std::vector<std::complex<double>> temp(size, comp(0, 0));
-    for (int i = 0; i < size/2; i++) {
-        const uint32_t even = offset + i * step * 2; 
-        const uint32_t odd = even + step;
-        const auto p = input[even];
-        const auto q = std::exp(comp(0, -2.0 * M_PI * (double)i / (double)size)) * input[odd];
-        temp[i] = p + q;
-        temp[i + size/2] = p - q;
+// Radices of the mixed radix stages of a transform of size n from the innermost stage to the outermost,
+// only 2s if 'radix2' and otherwise 4s, which are cheaper than pairs of 2s.
+// Empty for sizes with factors other than 2, 3 & 5.
+inline std::optional<std::vector<std::size_t>> mixed_radices(std::size_t n, bool radix2) {
+    std::vector<std::size_t> radices;
+    std::size_t rest = n;
+    if (radix2) {
+        while (rest % 2 == 0) { radices.push_back(2); rest /= 2; }
     }
+    while (rest % 4 == 0) { radices.push_back(4); rest /= 4; }
+    if (rest % 2 == 0) { radices.insert(radices.begin(), 2); rest /= 2; }
+    while (rest % 3 == 0) { radices.push_back(3); rest /= 3; }
+    while (rest % 5 == 0) { radices.push_back(5); rest /= 5; }
+    if (rest != 1) return std::nullopt;
+    return radices;
+}
+
+// Decimation in time reads the input in mixed radix digit reversed order: the digits of a position
+// from the innermost radix up are the digits of its input index from the outermost radix up.
+// Positions are counted up digit by digit, each digit moves the input index by its weight.
+inline std::vector<uint32_t> digit_reversed_order(const std::vector<std::size_t>& radices) {
+    std::size_t n = 1;
+    for (auto radix : radices) n *= radix;
 
-    for (int i = 0; i < size; i++) {
-        const uint32_t pos = offset + i * step;
-        input[pos] = temp[i];
+    std::vector<uint32_t> order(n);
+    std::vector<std::size_t> digits(radices.size(), 0), weights(radices.size(), 1);
+    for (std::size_t r = radices.size(); r-- > 1; ) {
+        weights[r - 1] = weights[r] * radices[r];
     }
+    for (std::size_t pos = 0, idx = 0; pos < n; pos++) {
+        order[pos] = idx;
+        for (std::size_t d = 0; d < digits.size(); d++) {
+            idx += weights[d];
+            if (++digits[d] < radices[d]) break;
+            idx -= radices[d] * weights[d];
+            digits[d] = 0;
+        }
+    }
+    return order;
 }
+
+// Users of per thread scratch memory that can be active at the same time
+enum ScratchSlot {
+    bluestein_slot, split_slot, real_slot, real_split_slot, split_radix_slot, four_step_slot, four_step_block_slot,
+    batch_slot, batch_signal_slot, scratch_slots
+};
+
+// Per thread scratch memory, grows to the largest size requested and is then reused
+template <typename T>
+std::complex<T>* scratch(std::size_t size, ScratchSlot slot=bluestein_slot) {
+    thread_local std::vector<std::complex<T>> buffers[scratch_slots];
+    auto& buffer = buffers[slot];
+    if (buffer.size() < size) buffer.resize(size);
+    return buffer.data();
+}
+
+// Runs loops of independent iterations on a thread pool, or serially without one
+class Executor {
+public:
+    explicit Executor(ThreadPool* pool) : pool(pool && pool->size() > 1 ? pool : nullptr) {}
+
+    // Number of chunks work should be split into
+    std::size_t tasks() const { return pool ? 4 * pool->size() : 1; }
+
+    // Calls fn(begin, end) on ranges covering [0, count)
+    template <typename F>
+    void run(std::size_t count, const F& fn) const {
+        if (pool) {
+            pool->parallel_for(count, fn);
+        } else if (count > 0) {
+            fn(0, count);
+        }
+    }
+
+private:
+    ThreadPool* pool;
+};
 } // namespace details
 
-// Input: vector of samples
-// Output: Fourier series of input vector, size extended to nearest 2^n value
-std::vector<std::complex<double>> radix2fft(std::vector<double>& samples) {
-    std::vector<std::complex<double>> output_series;
-    for (auto sample : samples) {
-        output_series.push_back(comp(sample, 0));
+// Algorithms of power of 2 transforms, selectable for benchmarking them against each other.
+// radix4 runs radix 4 stages and one radix 2 stage if needed, radix2 only radix 2 stages,
+// split_radix recursively splits into a half and two quarter transforms.
+// Other factors (3 & 5) always use their own stages, split_radix uses radix4 for sizes that aren't powers of 2.
+// four_step splits any size above 64 with factors 2, 3 & 5 into two rounds of radix4 transforms of about sqrt(n).
+enum class FftAlgorithm { radix4, radix2, split_radix, four_step };
+
+inline const char* algorithm_name(FftAlgorithm algorithm) {
+    switch (algorithm) {
+        case FftAlgorithm::radix2: return "radix2";
+        case FftAlgorithm::split_radix: return "split_radix";
+        case FftAlgorithm::four_step: return "four_step";
+        default: return "radix4";
+    }
+}
+
+// Precomputed tables for transforms of one size.
+// Sizes with only factors 2, 3 & 5 use an in-place mixed radix transform
+// whose leading power of 2 stages run as one unrolled codelet (see codelet.hpp),
+// other sizes use Bluestein's algorithm on top of a power of 2 transform.
+// Build once per size and reuse, the transforms themselves don't allocate.
+// Transforms of complex data of any size n with samples of type T (float or double)
+template <typename T>
+class BasicFftPlan {
+public:
+    using C = std::complex<T>;
+
+    explicit BasicFftPlan(std::size_t size, FftAlgorithm algorithm=FftAlgorithm::radix4)
+        : n(size), algorithm(algorithm) {
+        if (n == 0) {
+            throw std::invalid_argument("FFT plan size must be positive");
+        }
+        if (algorithm == FftAlgorithm::split_radix && std::has_single_bit(n) && n > details::max_codelet_size) {
+            init_split_radix();
+            return;
+        }
+
+        const auto radices = details::mixed_radices(n, algorithm == FftAlgorithm::radix2);
+        if (!radices) {
+            init_bluestein();
+        } else if (algorithm == FftAlgorithm::four_step && n > details::max_codelet_size) {
+            init_four_step(*radices);
+        } else {
+            init_mixed_radix(*radices);
+        }
+    }
+
+    std::size_t size() const { return n; }
+    FftAlgorithm fft_algorithm() const { return algorithm; }
+
+    // Bytes held by the plan's tables, including the permutation cycles built on first use
+    std::size_t bytes() const {
+        std::size_t total = sizeof(*this) + details::vector_bytes(stages) + details::vector_bytes(twiddles)
+                            + details::vector_bytes(split_twiddles_re) + details::vector_bytes(split_twiddles_im)
+                            + 2 * details::vector_bytes(input_order) + details::vector_bytes(chirp)
+                            + details::vector_bytes(chirp_series) + details::vector_bytes(split_radix_twiddles)
+                            + details::vector_bytes(coarse_twiddles) + details::vector_bytes(fine_twiddles);
+        for (const auto* plan : {bluestein_plan.get(), column_plan.get(), row_plan.get()}) {
+            if (plan) total += plan->bytes();
+        }
+        return total;
+    }
+
+    // Transforms below take an optional thread pool to split large transforms across.
+    // The result is bit-identical for any number of threads.
+
+    // In-place forward transform
+    void forward(C* data, ThreadPool* pool=nullptr) const {
+        if (bluestein_plan) {
+            bluestein(data);
+        } else if (!split_radix_twiddles.empty()) {
+            split_radix<false>(data);
+        } else {
+            transform<false>(data, executor(pool));
+        }
+    }
+    void forward(std::vector<C>& data) const { check(data); forward(data.data()); }
+
+    // In-place inverse transform, scaled by 1/n
+    void inverse(C* data, ThreadPool* pool=nullptr) const {
+        if (bluestein_plan) {
+            // Inverse transform is the conjugate of the forward transform of the conjugate
+            std::transform(data, data + n, data, [](auto val) { return std::conj(val); });
+            bluestein(data);
+            std::transform(data, data + n, data, [this](auto val) { return std::conj(val) / (T)n; });
+        } else if (!split_radix_twiddles.empty()) {
+            split_radix<true>(data);
+            std::transform(data, data + n, data, [this](auto val) { return val / (T)n; });
+        } else {
+            const auto exec = executor(pool);
+            transform<true>(data, exec);
+            const T scale = 1.0 / n;
+            exec.run(n, [&](std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i < end; i++) {
+                    data[i] *= scale;
+                }
+            });
+        }
+    }
+    void inverse(std::vector<C>& data) const { check(data); inverse(data.data()); }
+
+    // Inverse transform of 'in' into the real parts of the result, scaled by 1/n, for spectra of real signals.
+    // Reading the input in butterfly order, scaling & extracting real parts are fused into the transform passes.
+    // 'work' holds n values and may not overlap 'in', which is left unchanged.
+    void inverse_real(const C* in, T* out, C* work, ThreadPool* pool=nullptr) const {
+        const auto exec = executor(pool);
+        if (bluestein_plan) {
+            // Conjugating the result doesn't change its real parts
+            for (std::size_t i = 0; i < n; i++) {
+                work[i] = std::conj(in[i]);
+            }
+            bluestein(work);
+        } else if (!split_radix_twiddles.empty()) {
+            split_radix_step<true>(in, 1, work, n, split_radix_twiddles.data());
+        } else if (column_plan) {
+            four_step<true>(in, work, exec);
+        } else {
+            exec.run(n, [&](std::size_t begin, std::size_t end) {
+                for (std::size_t pos = begin; pos < end; pos++) {
+                    work[pos] = in[input_order[pos]];
+                }
+            });
+            transform_stages<true>(work, exec);
+        }
+        const T scale = 1.0 / n;
+        exec.run(n, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; i++) {
+                out[i] = work[i].real() * scale;
+            }
+        });
+    }
+    void inverse_real(const C* in, T* out, ThreadPool* pool=nullptr) const {
+        inverse_real(in, out, details::scratch<T>(n, details::split_slot), pool);
+    }
+
+    // In-place transforms of split complex data, real & imaginary parts in separate arrays.
+    // Butterflies run on the SIMD kernels selected at runtime (see ctf::simd::active_isa).
+    void forward(T* re, T* im, ThreadPool* pool=nullptr) const {
+        split_transform<false>(re, im, executor(pool));
+    }
+    void inverse(T* re, T* im, ThreadPool* pool=nullptr) const {
+        const auto exec = executor(pool);
+        split_transform<true>(re, im, exec);
+        scale_split(re, im, exec);
+    }
+
+    // Out-of-place transforms of interleaved complex input ('in' holds n real & imaginary pairs)
+    // to split complex output. The input is read straight in the order the butterflies need it.
+    void forward(const T* in, T* re, T* im, ThreadPool* pool=nullptr) const {
+        split_transform<false>(in, re, im, executor(pool));
+    }
+    void inverse(const T* in, T* re, T* im, ThreadPool* pool=nullptr) const {
+        const auto exec = executor(pool);
+        split_transform<true>(in, re, im, exec);
+        scale_split(re, im, exec);
+    }
+
+private:
+    struct Stage {
+        std::size_t radix, span, twiddle_offset, split_offset;
+    };
+
+    // Smaller transforms are not worth splitting across threads
+    static constexpr std::size_t parallel_size = 1 << 15;
+
+    // Leading stages run on chunks of this many bytes at a time, which stay in the L2 cache
+    static constexpr std::size_t cache_block_bytes = 1 << 17;
+
+    std::size_t n;
+    FftAlgorithm algorithm;
+
+    // Mixed radix tables
+    std::vector<Stage> stages;
+    std::vector<C> twiddles;
+    std::vector<T> split_twiddles_re, split_twiddles_im;  // Grouped by input for SIMD loads
+    std::vector<uint32_t> input_order;  // Input index of every position before the first stage
+    mutable std::vector<uint32_t> cycles;  // Same permutation as cycles, each prefixed by its length
+    mutable std::vector<std::size_t> cycle_chunks;  // Offsets splitting 'cycles' into independent chunks
+    mutable std::once_flag cycles_built;  // Cycles are built on the first in-place transform
+
+    // Bluestein tables
+    std::unique_ptr<BasicFftPlan> bluestein_plan;
+    std::vector<C> chirp, chirp_series;
+
+    // Split radix tables, w^k & w^3k of every transform length m from n down to 128 (see split_radix)
+    std::vector<C> split_radix_twiddles;
+
+    // Four-step tables, n = rows * columns (see four_step)
+    std::size_t rows = 0, columns = 0;
+    std::unique_ptr<BasicFftPlan> column_plan, row_plan;
+    std::vector<C> coarse_twiddles, fine_twiddles;  // exp(-2 pi i m / n) = coarse[m / columns] * fine[m % columns]
+
+    void check(const std::vector<C>& data) const {
+        if (data.size() != n) {
+            throw std::invalid_argument("Input size does not match FFT plan size");
+        }
+    }
+
+    details::Executor executor(ThreadPool* pool) const {
+        return details::Executor(n >= parallel_size ? pool : nullptr);
+    }
+
+    void init_mixed_radix(const std::vector<std::size_t>& radices) {
+        // Leading power of 2 stages run as one codelet stage of radix 8 to 64, without twiddle tables.
+        // Codelets split the same way as radix4, so radix2 plans run radix 2 stages only.
+        std::size_t span = 1, covered = 0;
+        while (algorithm == FftAlgorithm::radix4 && covered < radices.size() && radices[covered] % 2 == 0
+               && span * radices[covered] <= details::max_codelet_size) {
+            span *= radices[covered++];
+        }
+        if (span >= 8) {
+            stages.push_back({span, 1, 0, 0});
+        } else {
+            span = 1;
+            covered = 0;
+        }
+
+        std::size_t table_size = 0;
+        for (std::size_t r = covered, size = span; r < radices.size(); size *= radices[r++]) {
+            table_size += size * (radices[r] - 1);
+        }
+        twiddles.reserve(table_size);
+        split_twiddles_re.reserve(table_size);
+        split_twiddles_im.reserve(table_size);
+
+        for (std::size_t r = covered; r < radices.size(); r++) {
+            const std::size_t radix = radices[r];
+            stages.push_back({radix, span, twiddles.size(), split_twiddles_re.size()});
+            for (std::size_t k = 0; k < span; k++) {
+                for (std::size_t j = 1; j < radix; j++) {
+                    twiddles.push_back((C)std::polar(1.0, -2.0 * M_PI * (double)(j * k) / (double)(span * radix)));
+                }
+            }
+            for (std::size_t j = 1; j < radix; j++) {
+                for (std::size_t k = 0; k < span; k++) {
+                    const auto w = twiddles[stages.back().twiddle_offset + k * (radix - 1) + j - 1];
+                    split_twiddles_re.push_back(w.real());
+                    split_twiddles_im.push_back(w.imag());
+                }
+            }
+            span *= radix;
+        }
+
+        input_order = details::digit_reversed_order(radices);
+    }
+
+    // Cycles of the input order for permuting in place, only in-place transforms need them
+    void init_cycles() const {
+        std::vector<bool> visited(n, false);
+        for (std::size_t start = 0; start < n; start++) {
+            if (visited[start] || input_order[start] == start) continue;
+
+            const auto length_at = cycles.size();
+            cycles.push_back(0);
+            for (auto pos = start; !visited[pos]; pos = input_order[pos]) {
+                visited[pos] = true;
+                cycles.push_back(pos);
+            }
+            cycles[length_at] = cycles.size() - length_at - 1;
+        }
+
+        // Cycles are disjoint, so chunks of whole cycles can be permuted in parallel
+        constexpr std::size_t max_chunks = 256;
+        cycle_chunks.push_back(0);
+        for (std::size_t c = 0; c < cycles.size(); c += cycles[c] + 1) {
+            if (c >= cycle_chunks.back() + cycles.size() / max_chunks + 1) cycle_chunks.push_back(c);
+        }
+        cycle_chunks.push_back(cycles.size());
+    }
+
+    void init_split_radix() {
+        for (std::size_t m = n; m > details::max_codelet_size; m /= 2) {
+            for (std::size_t k = 0; k < m / 4; k++) {
+                split_radix_twiddles.push_back((C)std::polar(1.0, -2.0 * M_PI * (double)k / (double)m));
+                split_radix_twiddles.push_back((C)std::polar(1.0, -6.0 * M_PI * (double)k / (double)m));
+            }
+        }
+    }
+
+    void init_four_step(const std::vector<std::size_t>& radices) {
+        // Rows get the smaller half of the factors, so both sub-transforms are close to sqrt(n)
+        rows = 1;
+        for (auto radix : radices) {
+            if (rows * radix * rows * radix <= n) rows *= radix;
+        }
+        columns = n / rows;
+        column_plan = std::make_unique<BasicFftPlan>(rows);
+        row_plan = std::make_unique<BasicFftPlan>(columns);
+
+        coarse_twiddles.resize(rows);
+        for (std::size_t h = 0; h < rows; h++) {
+            coarse_twiddles[h] = (C)std::polar(1.0, -2.0 * M_PI * (double)h / (double)rows);
+        }
+        fine_twiddles.resize(columns);
+        for (std::size_t l = 0; l < columns; l++) {
+            fine_twiddles[l] = (C)std::polar(1.0, -2.0 * M_PI * (double)l / (double)n);
+        }
+    }
+
+    void init_bluestein() {
+        const std::size_t m = std::bit_ceil(2 * n - 1);
+        bluestein_plan = std::make_unique<BasicFftPlan>(m);
+
+        // exp(-pi i k^2 / n), k^2 is reduced mod 2n to keep the angle accurate
+        chirp.resize(n);
+        for (std::size_t k = 0; k < n; k++) {
+            chirp[k] = (C)std::polar(1.0, -M_PI * (double)((k * k) % (2 * n)) / (double)n);
+        }
+
+        // Transform of the conjugate chirp, scaled so the inverse can skip scaling
+        chirp_series.assign(m, C(0, 0));
+        chirp_series[0] = std::conj(chirp[0]);
+        for (std::size_t k = 1; k < n; k++) {
+            chirp_series[k] = chirp_series[m - k] = std::conj(chirp[k]);
+        }
+        bluestein_plan->forward(chirp_series);
+        for (auto& c : chirp_series) {
+            c /= (T)m;
+        }
+    }
+
+    template <typename V>
+    void permute(V* data, const details::Executor& exec) const {
+        std::call_once(cycles_built, [this] { init_cycles(); });
+        exec.run(cycle_chunks.size() - 1, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t c = cycle_chunks[begin]; c < cycle_chunks[end]; c += cycles[c] + 1) {
+                const auto* cycle = &cycles[c + 1];
+                const auto first = data[cycle[0]];
+                for (std::size_t i = 0; i + 1 < cycles[c]; i++) {
+                    data[cycle[i]] = data[cycle[i + 1]];
+                }
+                data[cycle[cycles[c] - 1]] = first;
+            }
+        });
+    }
+
+    // Runs all butterfly stages, 'butterflies(stage, offset, length, k_begin, k_end)' runs the
+    // butterflies of one stage on positions [offset, offset + length) for k in [k_begin, k_end).
+    // Stages of radix >= 8 are codelets, complete transforms of every 'radix' positions.
+    // Leading stages run on contiguous chunks that are independent sub-transforms, those whose
+    // sub-transforms fit in a cache block all run on one block before moving to the next.
+    // The later ones are split along k in steps that keep SIMD lanes the same as with one thread.
+    template <typename Butterflies>
+    void run_stages(const details::Executor& exec, const Butterflies& butterflies) const {
+        std::size_t leading = 0, chunk = 1;
+        while (leading < stages.size() && n / (chunk * stages[leading].radix) >= exec.tasks()) {
+            chunk *= stages[leading++].radix;
+        }
+        std::size_t blocked = 0, block = 1;
+        while (blocked < leading && block * stages[blocked].radix * sizeof(C) <= cache_block_bytes) {
+            block *= stages[blocked++].radix;
+        }
+        exec.run(n / chunk, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t offset = begin * chunk; offset < end * chunk; offset += block) {
+                for (std::size_t s = 0; s < blocked; s++) {
+                    butterflies(stages[s], offset, block, 0, stages[s].span);
+                }
+            }
+            for (std::size_t s = blocked; s < leading; s++) {
+                butterflies(stages[s], begin * chunk, (end - begin) * chunk, 0, stages[s].span);
+            }
+        });
+
+        constexpr std::size_t step = 8;
+        for (std::size_t s = leading; s < stages.size(); s++) {
+            const auto& stage = stages[s];
+            exec.run((stage.span + step - 1) / step, [&](std::size_t begin, std::size_t end) {
+                butterflies(stage, 0, n, begin * step, std::min(end * step, stage.span));
+            });
+        }
+    }
+
+    template <bool inverse>
+    void transform(C* data, const details::Executor& exec) const {
+        if (column_plan) {
+            four_step<inverse>(data, data, exec);
+            return;
+        }
+        permute(data, exec);
+        transform_stages<inverse>(data, exec);
+    }
+
+    // Four-step transform of 'in' into 'out', which may be the same.
+    // The input is a matrix of 'rows' x 'columns' values, the output is ordered the other way around:
+    // 1. every column is transformed and multiplied by twiddles into a row of a transposed copy,
+    // 2. every column of the copy is transformed into a row of the output.
+    // Both steps move 'block' neighbouring columns at a time, so every cache line read is used in full,
+    // and gather them in the digit reversed order of the sub-transforms.
+    template <bool inverse>
+    void four_step(const C* in, C* out, const details::Executor& exec) const {
+        constexpr std::size_t block = 256 / sizeof(C), prefetch = 16;
+        // Gathers jump between rows in digit reversed order, which hardware prefetchers can't follow
+        const auto prefetch_block = [](const C* p) {
+            for (std::size_t line = 0; line < block * sizeof(C); line += 64) {
+                __builtin_prefetch(reinterpret_cast<const char*>(p) + line);
+            }
+        };
+        const details::Executor serial(nullptr);
+        auto* work = details::scratch<T>(n, details::four_step_slot);
+
+        exec.run((columns + block - 1) / block, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t first = begin * block; first < std::min(end * block, columns); first += block) {
+                const std::size_t count = std::min(block, columns - first);
+                for (std::size_t pos = 0; pos < rows; pos++) {
+                    const auto* source = in + column_plan->input_order[pos] * columns + first;
+                    if (pos + prefetch < rows) {
+                        prefetch_block(in + column_plan->input_order[pos + prefetch] * columns + first);
+                    }
+                    for (std::size_t b = 0; b < count; b++) {
+                        work[(first + b) * rows + pos] = source[b];
+                    }
+                }
+                for (std::size_t j2 = first; j2 < first + count; j2++) {
+                    auto* row = work + j2 * rows;
+                    column_plan->template transform_stages<inverse>(row, serial);
+
+                    // Twiddle exp(-2 pi i j2 k1 / n), the exponent is stepped without divisions
+                    for (std::size_t k1 = 1, coarse = 0, fine = j2; k1 < rows; k1++) {
+                        const auto w = details::mul(coarse_twiddles[coarse], fine_twiddles[fine]);
+                        row[k1] = details::mul(row[k1], inverse ? std::conj(w) : w);
+                        fine += j2;
+                        if (fine >= columns) { fine -= columns; coarse++; }
+                    }
+                }
+            }
+        });
+
+        exec.run((rows + block - 1) / block, [&](std::size_t begin, std::size_t end) {
+            auto* buffer = details::scratch<T>(block * columns, details::four_step_block_slot);
+            for (std::size_t first = begin * block; first < std::min(end * block, rows); first += block) {
+                const std::size_t count = std::min(block, rows - first);
+                for (std::size_t pos = 0; pos < columns; pos++) {
+                    const auto* source = work + row_plan->input_order[pos] * rows + first;
+                    if (pos + prefetch < columns) {
+                        prefetch_block(work + row_plan->input_order[pos + prefetch] * rows + first);
+                    }
+                    for (std::size_t b = 0; b < count; b++) {
+                        buffer[b * columns + pos] = source[b];
+                    }
+                }
+                for (std::size_t b = 0; b < count; b++) {
+                    row_plan->template transform_stages<inverse>(buffer + b * columns, serial);
+                }
+                for (std::size_t k2 = 0; k2 < columns; k2++) {
+                    for (std::size_t b = 0; b < count; b++) {
+                        out[k2 * rows + first + b] = buffer[b * columns + k2];
+                    }
+                }
+            }
+        });
+    }
+
+    // Butterfly stages of data already in digit reversed order
+    template <bool inverse>
+    void transform_stages(C* data, const details::Executor& exec) const {
+        run_stages(exec, [&](const Stage& stage, std::size_t offset, std::size_t length,
+                             std::size_t k_begin, std::size_t k_end) {
+            const auto* w = &twiddles[stage.twiddle_offset];
+            auto* x = data + offset;
+            switch (stage.radix) {
+                case 2: details::radix_stage<inverse, 2>(x, length, stage.span, w, k_begin, k_end); break;
+                case 3: details::radix_stage<inverse, 3>(x, length, stage.span, w, k_begin, k_end); break;
+                case 4: details::radix_stage<inverse, 4>(x, length, stage.span, w, k_begin, k_end); break;
+                case 5: details::radix_stage<inverse, 5>(x, length, stage.span, w, k_begin, k_end); break;
+                default: details::get_codelet<inverse, T>(stage.radix)(x, length); break;
+            }
+        });
     }
 
-    // Expand the sample vector to 2^n values
-    uint32_t up = std::pow(2, std::ceil(std::log2(samples.size())));
-    output_series.insert(output_series.end(), up - output_series.size(), comp(0, 0));
+    void scale_split(T* re, T* im, const details::Executor& exec) const {
+        const T scale = 1.0 / n;
+        exec.run(n, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; i++) {
+                re[i] *= scale;
+                im[i] *= scale;
+            }
+        });
+    }
+
+    template <bool inverse>
+    void split_transform(T* re, T* im, const details::Executor& exec) const {
+        if (bluestein_plan || !split_radix_twiddles.empty() || column_plan) {
+            // Bluestein, split radix & four-step run on interleaved data, inverse as the conjugate of forward
+            auto* work = details::scratch<T>(n, details::split_slot);
+            for (std::size_t i = 0; i < n; i++) {
+                work[i] = C(re[i], inverse ? -im[i] : im[i]);
+            }
+            if (bluestein_plan) {
+                bluestein(work);
+            } else if (column_plan) {
+                four_step<false>(work, work, exec);
+            } else {
+                split_radix<false>(work);
+            }
+            for (std::size_t i = 0; i < n; i++) {
+                re[i] = work[i].real();
+                im[i] = inverse ? -work[i].imag() : work[i].imag();
+            }
+            return;
+        }
 
+        permute(re, exec);
+        permute(im, exec);
+        split_stages<inverse>(re, im, exec);
+    }
+
+    template <bool inverse>
+    void split_transform(const T* in, T* re, T* im, const details::Executor& exec) const {
+        if (bluestein_plan || !split_radix_twiddles.empty() || column_plan) {
+            for (std::size_t i = 0; i < n; i++) {
+                re[i] = in[2 * i];
+                im[i] = in[2 * i + 1];
+            }
+            split_transform<inverse>(re, im, exec);
+            return;
+        }
+
+        exec.run(n, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t pos = begin; pos < end; pos++) {
+                re[pos] = in[2 * input_order[pos]];
+                im[pos] = in[2 * input_order[pos] + 1];
+            }
+        });
+        split_stages<inverse>(re, im, exec);
+    }
+
+    template <bool inverse>
+    void split_stages(T* re, T* im, const details::Executor& exec) const {
+        run_stages(exec, [&](const Stage& stage, std::size_t offset, std::size_t length,
+                             std::size_t k_begin, std::size_t k_end) {
+            if (stage.radix > 5) {
+                details::get_split_codelet<inverse, T>(stage.radix)(re + offset, im + offset, length);
+                return;
+            }
+            simd::stage_kernel<T>(inverse, stage.radix)(re + offset, im + offset, length, stage.span, k_begin, k_end,
+                                                     &split_twiddles_re[stage.split_offset],
+                                                     &split_twiddles_im[stage.split_offset]);
+        });
+    }
+
+    // Split radix transform of 'in' into 'out' over m values 'stride' apart, with the twiddles of length m
+    // at 'twiddles'. The sub-transforms of even, 4k+1 & 4k+3 values are combined with L shaped butterflies.
+    template <bool inverse>
+    void split_radix_step(const C* in, std::size_t stride, C* out, std::size_t m, const C* twiddles) const {
+        if (m <= details::max_codelet_size) {
+            details::get_strided_codelet<inverse, T>(m)(in, stride, out);
+            return;
+        }
+
+        // Twiddles of length m/2 follow the m/4 pairs of length m, those of m/4 the m/8 pairs of m/2
+        const std::size_t q = m / 4;
+        split_radix_step<inverse>(in, 2 * stride, out, m / 2, twiddles + 2 * q);
+        split_radix_step<inverse>(in + stride, 4 * stride, out + 2 * q, q, twiddles + 3 * q);
+        split_radix_step<inverse>(in + 3 * stride, 4 * stride, out + 3 * q, q, twiddles + 3 * q);
+
+        for (std::size_t k = 0; k < q; k++) {
+            const auto w1 = inverse ? std::conj(twiddles[2 * k]) : twiddles[2 * k];
+            const auto w3 = inverse ? std::conj(twiddles[2 * k + 1]) : twiddles[2 * k + 1];
+            const auto a = details::mul(out[k + 2 * q], w1);
+            const auto b = details::mul(out[k + 3 * q], w3);
+            const auto sum = a + b;
+            const auto diff = details::rotate<inverse>(a - b);
+            const auto u0 = out[k], u1 = out[k + q];
+            out[k] = u0 + sum;
+            out[k + 2 * q] = u0 - sum;
+            out[k + q] = u1 + diff;
+            out[k + 3 * q] = u1 - diff;
+        }
+    }
 
-    details::radix2fft_rec(output_series, output_series.size());
+    template <bool inverse>
+    void split_radix(C* data) const {
+        auto* work = details::scratch<T>(n, details::split_radix_slot);
+        std::copy(data, data + n, work);
+        split_radix_step<inverse>(work, 1, data, n, split_radix_twiddles.data());
+    }
+
+    // Transform as a convolution with a chirp, computed with power of 2 transforms
+    void bluestein(C* data) const {
+        const std::size_t m = bluestein_plan->size();
+        auto* work = details::scratch<T>(m);
+        const details::Executor serial(nullptr);
+
+        for (std::size_t k = 0; k < n; k++) {
+            work[k] = details::mul(data[k], chirp[k]);
+        }
+        std::fill(work + n, work + m, C(0, 0));
+
+        bluestein_plan->template transform<false>(work, serial);
+        for (std::size_t k = 0; k < m; k++) {
+            work[k] = details::mul(work[k], chirp_series[k]);
+        }
+        bluestein_plan->template transform<true>(work, serial);
+
+        for (std::size_t k = 0; k < n; k++) {
+            data[k] = details::mul(work[k], chirp[k]);
+        }
+    }
+};
+
+// Transforms of real input of even size n, computed with a complex
+// transform of size n/2. Only the n/2+1 non-redundant bins are stored,
+// the rest of the spectrum are their complex conjugates.
+template <typename T>
+class BasicRealFftPlan {
+public:
+    using C = std::complex<T>;
+
+    explicit BasicRealFftPlan(std::size_t size, FftAlgorithm algorithm=FftAlgorithm::radix4)
+        : n(size), half(size / 2, algorithm) {
+        if (n < 2 || n % 2) {
+            throw std::invalid_argument("Real FFT plan size must be even and at least 2");
+        }
+
+        twiddles.resize(n / 4 + 1);
+        for (std::size_t k = 0; k < twiddles.size(); k++) {
+            twiddles[k] = (C)std::polar(1.0, -2.0 * M_PI * (double)k / (double)n);
+        }
+    }
+
+    std::size_t size() const { return n; }
+    std::size_t spectrum_size() const { return n / 2 + 1; }
+    FftAlgorithm fft_algorithm() const { return half.fft_algorithm(); }
+    std::size_t bytes() const { return half.bytes() + details::vector_bytes(twiddles); }
+
+    // 'in' holds n samples, 'out' receives n/2+1 bins
+    void forward(const T* in, C* out, ThreadPool* pool=nullptr) const {
+        const std::size_t h = n / 2;
+        const details::Executor exec(n >= parallel_size ? pool : nullptr);
+
+        // Transform even samples as real and odd samples as imaginary parts
+        auto* re = reinterpret_cast<T*>(details::scratch<T>(h, details::real_slot));
+        auto* im = re + h;
+        const bool split = simd::active_isa() != simd::Isa::scalar;
+        if (split) {
+            half.forward(in, re, im, pool);
+        } else {
+            exec.run(h, [&](std::size_t begin, std::size_t end) {
+                for (std::size_t k = begin; k < end; k++) {
+                    out[k] = C(in[2 * k], in[2 * k + 1]);
+                }
+            });
+            half.forward(out, pool);
+        }
+        const auto packed = [&](std::size_t k) { return split ? C(re[k], im[k]) : out[k]; };
+
+        // Separate the transforms of even & odd samples and combine them
+        const auto z0 = packed(0);
+        exec.run(h / 2, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t k = begin + 1; k <= end; k++) {
+                const auto [xk, xhk] = details::unpack_bins(packed(k), packed(h - k), twiddles[k]);
+                out[k] = xk;
+                out[h - k] = xhk;
+            }
+        });
+        out[0] = C(z0.real() + z0.imag(), 0);
+        out[h] = C(z0.real() - z0.imag(), 0);
+    }
+
+    // 'in' holds n/2+1 bins, 'out' receives n samples
+    void inverse(const C* in, T* out, ThreadPool* pool=nullptr) const {
+        const std::size_t h = n / 2;
+        const details::Executor exec(n >= parallel_size ? pool : nullptr);
+
+        // Rebuild the packed half size spectrum
+        auto* packed = details::scratch<T>(h, details::real_slot);
+        packed[0] = C(in[0].real() + in[h].real(), in[0].real() - in[h].real()) * (T)0.5;
+        exec.run(h / 2, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t k = begin + 1; k <= end; k++) {
+                const auto [zk, zhk] = details::pack_bins(in[k], in[h - k], twiddles[k]);
+                packed[k] = zk;
+                packed[h - k] = zhk;
+            }
+        });
+
+        if (simd::active_isa() != simd::Isa::scalar) {
+            auto* re = reinterpret_cast<T*>(details::scratch<T>(h, details::real_split_slot));
+            auto* im = re + h;
+            half.inverse(reinterpret_cast<const T*>(packed), re, im, pool);
+            exec.run(h, [&](std::size_t begin, std::size_t end) {
+                for (std::size_t k = begin; k < end; k++) {
+                    out[2 * k] = re[k];
+                    out[2 * k + 1] = im[k];
+                }
+            });
+        } else {
+            half.inverse(packed, pool);
+            exec.run(h, [&](std::size_t begin, std::size_t end) {
+                for (std::size_t k = begin; k < end; k++) {
+                    out[2 * k] = packed[k].real();
+                    out[2 * k + 1] = packed[k].imag();
+                }
+            });
+        }
+    }
+
+private:
+    static constexpr std::size_t parallel_size = 1 << 16;
+
+    std::size_t n;
+    BasicFftPlan<T> half;
+    std::vector<C> twiddles;
+};
+
+using FftPlan = BasicFftPlan<double>;
+using RealFftPlan = BasicRealFftPlan<double>;
+
+namespace details {
+
+// Bytes of unused plans of one type kept for reuse, batch runs over files of many lengths would otherwise
+// keep a plan of every length
+constexpr std::size_t plan_cache_bytes = std::size_t(512) << 20;
+
+// Shared plans of one type by the arguments they are built from
+template <typename Plan, typename... Args>
+LruCache<std::tuple<Args...>, Plan>& plan_cache() {
+    static LruCache<std::tuple<Args...>, Plan> plans(plan_cache_bytes);
+    return plans;
+}
+
+template <typename Plan, typename... Args>
+std::shared_ptr<const Plan> cached_plan(Args... args) {
+    auto& plans = plan_cache<Plan, Args...>();
+    static std::mutex build_mutex;
+
+    if (auto plan = plans.find(std::tuple(args...))) return plan;
+    // Built under a lock, so threads asking for the same new plan build it once
+    std::lock_guard<std::mutex> lock(build_mutex);
+    if (auto plan = plans.find(std::tuple(args...))) return plan;
+    auto plan = std::make_shared<const Plan>(args...);
+    return plans.insert({args...}, plan, plan->bytes());
+}
+} // namespace details
+
+// Returns a shared plan for the given size, sample type & algorithm, plans are built on first use
+template <typename T=double>
+std::shared_ptr<const BasicFftPlan<T>> get_plan(std::size_t size, FftAlgorithm algorithm=FftAlgorithm::radix4) {
+    return details::cached_plan<BasicFftPlan<T>>(size, algorithm);
+}
+
+template <typename T=double>
+std::shared_ptr<const BasicRealFftPlan<T>> get_real_plan(std::size_t size, FftAlgorithm algorithm=FftAlgorithm::radix4) {
+    return details::cached_plan<BasicRealFftPlan<T>>(size, algorithm);
+}
+
+// Estimated number of floating point operations in a complex transform of given size
+inline double fft_cost(std::size_t size) {
+    // Per sample cost of one stage of each radix, butterfly plus twiddle multiplications
+    constexpr std::pair<std::size_t, double> radix_costs[] {{4, 8.5}, {2, 5}, {3, 10}, {5, 12.5}};
+
+    std::size_t rest = size;
+    double per_sample = 0;
+    for (auto [radix, cost] : radix_costs) {
+        while (rest % radix == 0) {
+            per_sample += cost;
+            rest /= radix;
+        }
+    }
+    if (rest == 1) return size * per_sample;
+
+    // Bluestein: two padded transforms and three chirp multiplications
+    const std::size_t padded = std::bit_ceil(2 * size - 1);
+    return 2 * fft_cost(padded) + 6.0 * (2 * size + padded);
+}
+
+// Returns the cheapest even length of at least 'size' samples to transform with ctf::rfft.
+// The exact length is compared against zero padded lengths with only factors 2, 3 & 5.
+inline std::size_t fft_size(std::size_t size) {
+    const auto real_cost = [](std::size_t length) { return fft_cost(length / 2) + 4.0 * length; };
+
+    const std::size_t exact = std::max<std::size_t>(2, size + size % 2);
+    std::size_t best = exact;
+    double best_cost = real_cost(exact);
+
+    const std::size_t limit = std::bit_ceil(exact);
+    for (std::size_t p5 = 1; p5 <= limit; p5 *= 5) {
+        for (std::size_t p3 = p5; p3 <= limit; p3 *= 3) {
+            std::size_t candidate = 2 * p3;
+            while (candidate < exact) candidate *= 2;
+
+            const double cost = real_cost(candidate);
+            if (cost < best_cost) {
+                best = candidate;
+                best_cost = cost;
+            }
+        }
+    }
+    return best;
+}
+
+// Input: samples, optionally the transform algorithm
+// Output: Fourier series of the samples zero padded to the size of 'series', a power of 2 of at least as many values
+inline void radix2fft(std::span<const double> samples, std::span<std::complex<double>> series,
+                      FftAlgorithm algorithm=FftAlgorithm::radix4) {
+    if (!std::has_single_bit(series.size()) || series.size() < samples.size()) {
+        throw std::invalid_argument("Fourier series size must be a power of 2 of at least the sample count");
+    }
+    std::copy(samples.begin(), samples.end(), series.begin());
+    std::fill(series.begin() + samples.size(), series.end(), comp(0, 0));
+
+    get_plan(series.size(), algorithm)->forward(series.data());
+}
+
+// Input: vector of samples, optionally the transform algorithm
+// Output: Fourier series of input vector, size extended to nearest 2^n value
+inline std::vector<std::complex<double>> radix2fft(const std::vector<double>& samples,
+                                                   FftAlgorithm algorithm=FftAlgorithm::radix4) {
+    std::vector<std::complex<double>> output_series(std::bit_ceil(samples.size()));
+    radix2fft(samples, output_series, algorithm);
 
     return output_series;
 }
 
-// Input: Fourier series
+// Input: Fourier series of any size, optionally the transform algorithm
+// Output: real parts of the inverse transform, as many samples as the series, computed in 'workspace'
+inline void radix2fft_inverse(std::span<const std::complex<double>> series, std::span<double> samples, Workspace& workspace,
+                              FftAlgorithm algorithm=FftAlgorithm::radix4) {
+    if (samples.size() != series.size()) {
+        throw std::invalid_argument("Sample count must match the Fourier series size");
+    }
+    const auto work = workspace.get<std::complex<double>>(series.size(), Workspace::transform_slot);
+    get_plan(series.size(), algorithm)->inverse_real(series.data(), samples.data(), work.data());
+}
+
+// Input: Fourier series of any size, optionally the transform algorithm
 // Output: vector of audio samples
-std::vector<double> radix2fft_inverse(std::vector<std::complex<double>>& fourier_series) {
-    if (fourier_series.size() & (fourier_series.size() - 1)) {
-        throw std::invalid_argument("Fourier series array size must be a power of 2");
+inline std::vector<double> radix2fft_inverse(const std::vector<std::complex<double>>& fourier_series,
+                                             FftAlgorithm algorithm=FftAlgorithm::radix4) {
+    std::vector<double> output_samples(fourier_series.size());
+    get_plan(fourier_series.size(), algorithm)->inverse_real(fourier_series.data(), output_samples.data());
+
+    return output_samples;
+}
+
+// Input: samples of an even count of at least 2, the transform length
+// Output: 'half_series' receives the n/2+1 bins of the non-redundant half of the Fourier series
+template <typename T>
+void rfft(std::span<const T> samples, std::span<std::complex<T>> half_series, ThreadPool* pool=nullptr) {
+    const auto plan = get_real_plan<T>(samples.size());
+    if (half_series.size() != plan->spectrum_size()) {
+        throw std::invalid_argument("Half Fourier series must have n/2+1 bins");
     }
+    plan->forward(samples.data(), half_series.data(), pool);
+}
 
-    // Use a trick to calculate the inverse Fourier transform
-    details::flip_all(fourier_series);
-    details::radix2fft_rec(fourier_series, fourier_series.size());
-    std::transform(fourier_series.begin(),
-                fourier_series.end(), 
-                fourier_series.begin(),
-                [fourier_series](auto val){
-                    return val / comp(fourier_series.size(), 0);  // Don't know why this has to be done..
-                });
-    details::flip_all(fourier_series);
+// Input: vector of samples
+// Output: non-redundant half of the Fourier series, n/2+1 bins where n is
+// the input size extended to the cheapest transform length (see ctf::fft_size)
+template <typename T>
+std::vector<std::complex<T>> rfft(const std::vector<T>& samples, ThreadPool* pool=nullptr) {
+    std::vector<T> padded(fft_size(samples.size()), 0);
+    std::copy(samples.begin(), samples.end(), padded.begin());
+
+    const auto plan = get_real_plan<T>(padded.size());
+    std::vector<std::complex<T>> half_series(plan->spectrum_size());
+    plan->forward(padded.data(), half_series.data(), pool);
 
-    std::vector<double> output_samples;
-    for (auto complex : fourier_series) {
-        output_samples.push_back(complex.real());
+    return half_series;
+}
+
+// Input: half Fourier series from rfft
+// Output: vector of audio samples
+template <typename T>
+std::vector<T> irfft(const std::vector<std::complex<T>>& half_series, ThreadPool* pool=nullptr) {
+    if (half_series.size() < 2) {
+        throw std::invalid_argument("Half Fourier series must have at least 2 bins");
     }
+    const std::size_t size = 2 * (half_series.size() - 1);
+
+    std::vector<T> output_samples(size);
+    get_real_plan<T>(size)->inverse(half_series.data(), output_samples.data(), pool);
 
     return output_samples;
 }
+
+// Input: half Fourier series from rfft
+// Output: 'samples' receives the 2*(bins-1) samples
+template <typename T>
+void irfft(std::span<const std::complex<T>> half_series, std::span<T> samples, ThreadPool* pool=nullptr) {
+    if (half_series.size() < 2 || samples.size() != 2 * (half_series.size() - 1)) {
+        throw std::invalid_argument("Sample count must be 2*(bins-1) of at least 2 bins");
+    }
+    get_real_plan<T>(samples.size())->inverse(half_series.data(), samples.data(), pool);
+}
 } // namespace dft
\ No newline at end of file
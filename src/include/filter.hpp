@@ -6,6 +6,11 @@
 #include <cmath>
 #include <string>
 #include <stdexcept>
+#include <memory>
+#include <tuple>
+#include <cstdint>
+
+#include "cache.hpp"
 
 #define comp(a, b) std::complex<double>(a, b)
 
@@ -14,56 +19,57 @@ namespace ctf {
 struct Band {
     uint32_t freq1, freq2;
     double gain1, gain2;
+
+    auto operator<=>(const Band&) const = default;
 };
 
-// Calculate gain values between frequencies
-double interpolate(int bin_curr, int bin1, int bin2, double gain1, double gain2, std::string curve="log") {
+namespace details {
+
+enum class Curve { log, lin };
+
+inline double interpolate(int bin_curr, int bin1, int bin2, double gain1, double gain2, Curve curve) {
+    // Bands narrower than a bin have one bin, cut to the band's first gain
+    if (bin1 == bin2) return gain1;
     const double lin_ratio = (double)(bin_curr - bin1) / (bin2 - bin1);
-    const double log_ratio = log(1 + lin_ratio * (M_E - 1));
-    return gain1 + (gain2 - gain1) * (curve == "log" ? log_ratio : lin_ratio);
+    if (curve == Curve::lin) return gain1 + (gain2 - gain1) * lin_ratio;
+    return gain1 + (gain2 - gain1) * log(1 + lin_ratio * (M_E - 1));
 }
 
-// Filters out frequencies in a given band from input Fourier series.
-// Band cut gain will be logarithmically or linearly interpolated between given gain values.
-void rm_freqs(std::vector<std::complex<double>> &fourier_series, uint32_t sample_rate, Band band, std::string curve="log") {
+// Calls fn(bin, gain) for every bin of a band in a half Fourier series of 'bins' bins,
+// optionally only for the bins in [first, last)
+template <typename F>
+void for_band_bins(std::size_t bins, uint32_t sample_rate, Band band, Curve curve, F fn,
+                   std::size_t first=0, std::size_t last=SIZE_MAX) {
     if (band.freq1 == band.freq2) return;
 
-    uint32_t bin1 = band.freq1 * fourier_series.size() / sample_rate;
-    uint32_t bin2 = band.freq2 * fourier_series.size() / sample_rate;
+    // Size of the full series the half series was taken from
+    const std::size_t size = 2 * (bins - 1);
+    const std::size_t bin1 = band.freq1 * size / sample_rate;
+    const std::size_t bin2 = std::min(band.freq2 * size / sample_rate, bins - 1);
 
-    // Cut given & mirrored freqs
-    for (auto bin = bin1; bin <= bin2; bin++) {
-        const auto bin_mirror = fourier_series.size() - bin;
-        const double gain = interpolate(bin, bin1, bin2, band.gain1, band.gain2);
-
-        fourier_series[bin] *= gain;
-        fourier_series[bin_mirror] *= gain;
+    // The mirrored freqs are not stored, so every bin is cut once
+    for (auto bin = std::max(bin1, first); bin <= bin2 && bin < last; bin++) {
+        fn(bin, interpolate(bin, bin1, bin2, band.gain1, band.gain2, curve));
     }
 }
 
-// Apply gradual roll off to both ends of a frequency band
-// 'roll_amount' sets the length of the roll off i.e. number of frequency bins affected
-// Rolling off happens only next to the frequency bands, the bands are not affected
-// Roll off curve is linear (ideally it probably should be S or F shaped)
-void roll_off(std::vector<std::complex<double>> &fourier_series, uint32_t sample_rate, Band band, uint32_t roll_amount) {
-    if (roll_amount == 0) return;
-
+// Returns the linear roll off bands below & above a band
+inline std::pair<Band, Band> roll_bands(Band band, uint32_t sample_rate, uint32_t roll_amount) {
     Band low_roll(band.freq1 - roll_amount, band.freq1, 1, band.gain1);
     if (band.freq1 < roll_amount) {
         low_roll.freq1 = 0;
-        low_roll.gain1 = interpolate(0, (int)band.freq1 - roll_amount, band.freq1, 1, band.gain1, "lin");
+        low_roll.gain1 = interpolate(0, (int)band.freq1 - roll_amount, band.freq1, 1, band.gain1, Curve::lin);
     }
 
     Band high_roll(band.freq2, band.freq2 + roll_amount, band.gain2, 1);
     if (band.freq2 + roll_amount > sample_rate / 2) {
         high_roll.freq2 = sample_rate / 2;
-        high_roll.gain2 = interpolate(sample_rate / 2, band.freq2, band.freq2 + roll_amount, band.gain2, 1, "lin");
+        high_roll.gain2 = interpolate(sample_rate / 2, band.freq2, band.freq2 + roll_amount, band.gain2, 1, Curve::lin);
     }
-    rm_freqs(fourier_series, sample_rate, low_roll, "lin");
-    rm_freqs(fourier_series, sample_rate, high_roll, "lin");
+    return {low_roll, high_roll};
 }
 
-void band_cut(std::vector<std::complex<double>> &fourier_series, uint32_t sample_rate, Band band, int roll) {
+inline void check_band(Band band, uint32_t sample_rate, int roll) {
     if (band.freq1 > sample_rate / 2 || band.freq2 > sample_rate / 2) {
         throw std::invalid_argument("Band frequencies must be below sample rate / 2");
     }
@@ -77,8 +83,138 @@ void band_cut(std::vector<std::complex<double>> &fourier_series, uint32_t sample
     if (roll < 0) {
         throw std::invalid_argument("Roll off amount must be non-negative");
     }
+}
+
+// Writes the gains of bins [first, first + count) of a half Fourier series of 'bins' bins
+// after all bands & their roll offs are cut to 'gain'
+inline void band_gains(std::size_t bins, uint32_t sample_rate, const std::vector<Band>& bands, int roll,
+                       std::size_t first, std::size_t count, double* gain) {
+    std::fill(gain, gain + count, 1.0);
+    const auto cut = [&](std::size_t bin, double g) { gain[bin - first] *= g; };
+    for (const auto& band : bands) {
+        check_band(band, sample_rate, roll);
+        for_band_bins(bins, sample_rate, band, Curve::log, cut, first, first + count);
+        if (roll == 0) continue;
+
+        const auto [low_roll, high_roll] = roll_bands(band, sample_rate, roll);
+        for_band_bins(bins, sample_rate, low_roll, Curve::lin, cut, first, first + count);
+        for_band_bins(bins, sample_rate, high_roll, Curve::lin, cut, first, first + count);
+    }
+}
+} // Namespace details
+
+// Calculate gain values between frequencies
+inline double interpolate(int bin_curr, int bin1, int bin2, double gain1, double gain2, std::string curve="log") {
+    return details::interpolate(bin_curr, bin1, bin2, gain1, gain2, curve == "log" ? details::Curve::log : details::Curve::lin);
+}
+
+// Filters out frequencies in a given band from input half Fourier series (see ctf::rfft).
+// Band cut gain will be logarithmically or linearly interpolated between given gain values.
+template <typename T>
+void rm_freqs(std::vector<std::complex<T>> &fourier_series, uint32_t sample_rate, Band band, std::string curve="log") {
+    const auto shape = curve == "log" ? details::Curve::log : details::Curve::lin;
+    details::for_band_bins(fourier_series.size(), sample_rate, band, shape, [&](std::size_t bin, double gain) {
+        fourier_series[bin] *= gain;
+    });
+}
+
+// Apply gradual roll off to both ends of a frequency band
+// 'roll_amount' sets the length of the roll off i.e. number of frequency bins affected
+// Rolling off happens only next to the frequency bands, the bands are not affected
+// Roll off curve is linear (ideally it probably should be S or F shaped)
+template <typename T>
+void roll_off(std::vector<std::complex<T>> &fourier_series, uint32_t sample_rate, Band band, uint32_t roll_amount) {
+    if (roll_amount == 0) return;
+
+    const auto [low_roll, high_roll] = details::roll_bands(band, sample_rate, roll_amount);
+    rm_freqs(fourier_series, sample_rate, low_roll, "lin");
+    rm_freqs(fourier_series, sample_rate, high_roll, "lin");
+}
+
+template <typename T>
+void band_cut(std::vector<std::complex<T>> &fourier_series, uint32_t sample_rate, Band band, int roll) {
+    details::check_band(band, sample_rate, roll);
 
     rm_freqs(fourier_series, sample_rate, band);
     roll_off(fourier_series, sample_rate, band, roll);
 }
+
+// Gain of every bin of a half Fourier series after a set of bands & their roll offs are cut.
+// Compiled once, then applied to any number of series of the same size in one pass.
+class FilterResponse {
+public:
+    // 'size' is the length of the transformed signal, the response has size/2+1 bins
+    FilterResponse(std::size_t size, uint32_t sample_rate, const std::vector<Band>& bands, int roll)
+        : gain(size / 2 + 1) {
+        if (size < 2) {
+            throw std::invalid_argument("Filter response size must be at least 2");
+        }
+        details::band_gains(gain.size(), sample_rate, bands, roll, 0, gain.size(), gain.data());
+    }
+
+    std::size_t size() const { return gain.size(); }
+    const std::vector<double>& gains() const { return gain; }
+
+    // Multiplies a half Fourier series of size() bins by the response
+    template <typename T>
+    void apply(std::complex<T>* fourier_series) const {
+        // Plain floating point values, so the loop vectorizes
+        auto* values = reinterpret_cast<T*>(fourier_series);
+        for (std::size_t bin = 0; bin < gain.size(); bin++) {
+            const T g = gain[bin];
+            values[2 * bin] *= g;
+            values[2 * bin + 1] *= g;
+        }
+    }
+
+    // Multiplies 'in' by the response into 'out', for keeping the unfiltered series
+    template <typename T>
+    void apply(const std::complex<T>* in, std::complex<T>* out) const {
+        const auto* values = reinterpret_cast<const T*>(in);
+        auto* result = reinterpret_cast<T*>(out);
+        for (std::size_t bin = 0; bin < gain.size(); bin++) {
+            const T g = gain[bin];
+            result[2 * bin] = values[2 * bin] * g;
+            result[2 * bin + 1] = values[2 * bin + 1] * g;
+        }
+    }
+
+    template <typename T>
+    void apply(std::vector<std::complex<T>>& fourier_series) const {
+        if (fourier_series.size() != gain.size()) {
+            throw std::invalid_argument("Fourier series size does not match filter response size");
+        }
+        apply(fourier_series.data());
+    }
+
+private:
+    std::vector<double> gain;
+};
+
+namespace details {
+
+// Bytes of unused filter responses kept for reuse, each holds a gain per bin of its length
+constexpr std::size_t response_cache_bytes = std::size_t(256) << 20;
+} // Namespace details
+
+// Returns a shared filter response, each combination of size, sample rate, bands & roll off is compiled once
+// while it keeps being used (see details::LruCache)
+inline std::shared_ptr<const FilterResponse> get_filter_response(std::size_t size, uint32_t sample_rate,
+                                                                 const std::vector<Band>& bands, int roll) {
+    using Key = std::tuple<std::size_t, uint32_t, std::vector<Band>, int>;
+    static details::LruCache<Key, FilterResponse> cache(details::response_cache_bytes);
+
+    // Looked up without copying the bands, so cached responses are found without allocating
+    if (auto found = cache.find(std::tie(size, sample_rate, bands, roll))) return found;
+
+    // Compiled outside the lock, so files with different responses do not wait for each other
+    auto response = std::make_shared<const FilterResponse>(size, sample_rate, bands, roll);
+    return cache.insert(Key(size, sample_rate, bands, roll), response, details::vector_bytes(response->gains()));
+}
+
+// Returns the gain of every bin of a half Fourier series after all bands are cut
+// 'size' is the length of the transformed signal
+inline std::vector<double> band_gains(std::size_t size, uint32_t sample_rate, const std::vector<Band>& bands, int roll) {
+    return FilterResponse(size, sample_rate, bands, roll).gains();
+}
 } // Namespace ctf
\ No newline at end of file
@@ -0,0 +1,564 @@
+#pragma once
+
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <tuple>
+#include <functional>
+#include <bit>
+#include <string>
+#include <stdexcept>
+
+#include "filter.hpp"
+#include "fft.hpp"
+#include "parallel.hpp"
+#include "wav.hpp"
+#include "stats.hpp"
+#include "outofcore.hpp"
+
+namespace ctf {
+
+// Second order IIR section with a0 normalized to 1
+struct Biquad {
+    double b0 = 1, b1 = 0, b2 = 0, a1 = 0, a2 = 0;
+
+    // Squared magnitude of the response at 'w' radians per sample
+    double power(double w) const {
+        const double c1 = std::cos(w), c2 = std::cos(2 * w);
+        const double num = b0 * b0 + b1 * b1 + b2 * b2 + 2 * (b0 * b1 + b1 * b2) * c1 + 2 * b0 * b2 * c2;
+        const double den = 1 + a1 * a1 + a2 * a2 + 2 * (a1 + a1 * a2) * c1 + 2 * a2 * c2;
+        return num / den;
+    }
+};
+
+// Cascade of biquad sections with their state, for filtering a stream block by block.
+// Sections run in transposed direct form II on doubles whatever the sample type,
+// the state of all sections is a few cache lines, so long signals stream through it in one pass.
+class BiquadCascade {
+public:
+    explicit BiquadCascade(std::vector<Biquad> sections) : sections(std::move(sections)), state(2 * this->sections.size(), 0) {}
+
+    std::size_t size() const { return sections.size(); }
+
+    void reset() { std::fill(state.begin(), state.end(), 0); }
+
+    // Filters 'count' samples in place, continuing from the previous block
+    template <typename T>
+    void process(T* samples, std::size_t count) {
+        for (std::size_t i = 0; i < count; i++) {
+            samples[i] = (T)step(samples[i]);
+        }
+    }
+
+    // Filters 'count' samples in place from the last one to the first
+    template <typename T>
+    void process_reverse(T* samples, std::size_t count) {
+        for (std::size_t i = count; i-- > 0; ) {
+            samples[i] = (T)step(samples[i]);
+        }
+    }
+
+    // Filters forward, then backward from a cleared state, so the phase shifts cancel out and the signal
+    // is filtered with the squared magnitude of the cascade, without delay like the FFT filters
+    template <typename T>
+    void process_zero_phase(T* samples, std::size_t count) {
+        reset();
+        process(samples, count);
+        reset();
+        process_reverse(samples, count);
+    }
+
+private:
+    std::vector<Biquad> sections;
+    std::vector<double> state;
+
+    double step(double x) {
+        double* s = state.data();
+        for (const auto& q : sections) {
+            const double y = q.b0 * x + s[0];
+            s[0] = q.b1 * x - q.a1 * y + s[1];
+            s[1] = q.b2 * x - q.a2 * y;
+            x = y;
+            s += 2;
+        }
+        return x;
+    }
+};
+
+// Filters built from the Audio EQ Cookbook designs (R. Bristow-Johnson) at 'freq' hertz.
+// 'gain' is the linear gain at the center or shelf, 'q' the quality factor.
+namespace biquad {
+
+inline double angle(double freq, uint32_t sample_rate) {
+    return 2 * M_PI * freq / sample_rate;
+}
+
+inline Biquad normalized(double b0, double b1, double b2, double a0, double a1, double a2) {
+    return {b0 / a0, b1 / a0, b2 / a0, a1 / a0, a2 / a0};
+}
+
+inline Biquad high_pass(double freq, double q, uint32_t sample_rate) {
+    const double w = angle(freq, sample_rate), c = std::cos(w), alpha = std::sin(w) / (2 * q);
+    return normalized((1 + c) / 2, -(1 + c), (1 + c) / 2, 1 + alpha, -2 * c, 1 - alpha);
+}
+
+inline Biquad low_pass(double freq, double q, uint32_t sample_rate) {
+    const double w = angle(freq, sample_rate), c = std::cos(w), alpha = std::sin(w) / (2 * q);
+    return normalized((1 - c) / 2, 1 - c, (1 - c) / 2, 1 + alpha, -2 * c, 1 - alpha);
+}
+
+// First order sections, as biquads with b2 = a2 = 0
+inline Biquad high_pass(double freq, uint32_t sample_rate) {
+    const double k = std::tan(angle(freq, sample_rate) / 2);
+    return {1 / (1 + k), -1 / (1 + k), 0, (k - 1) / (k + 1), 0};
+}
+
+inline Biquad low_pass(double freq, uint32_t sample_rate) {
+    const double k = std::tan(angle(freq, sample_rate) / 2);
+    return {k / (1 + k), k / (1 + k), 0, (k - 1) / (k + 1), 0};
+}
+
+// Gain below 1 at 'freq', 0 for a notch
+inline Biquad peaking(double freq, double gain, double q, uint32_t sample_rate) {
+    const double w = angle(freq, sample_rate), c = std::cos(w), alpha = std::sin(w) / (2 * q);
+    if (gain <= 0) return normalized(1, -2 * c, 1, 1 + alpha, -2 * c, 1 - alpha);
+    const double a = std::sqrt(gain);
+    return normalized(1 + alpha * a, -2 * c, 1 - alpha * a, 1 + alpha / a, -2 * c, 1 - alpha / a);
+}
+
+// 'gain' below 'freq'
+inline Biquad low_shelf(double freq, double gain, double q, uint32_t sample_rate) {
+    const double w = angle(freq, sample_rate), c = std::cos(w), alpha = std::sin(w) / (2 * q);
+    const double a = std::sqrt(gain), beta = 2 * std::sqrt(a) * alpha;
+    return normalized(a * ((a + 1) - (a - 1) * c + beta), 2 * a * ((a - 1) - (a + 1) * c),
+                      a * ((a + 1) - (a - 1) * c - beta), (a + 1) + (a - 1) * c + beta,
+                      -2 * ((a - 1) + (a + 1) * c), (a + 1) + (a - 1) * c - beta);
+}
+
+// 'gain' above 'freq'
+inline Biquad high_shelf(double freq, double gain, double q, uint32_t sample_rate) {
+    const double w = angle(freq, sample_rate), c = std::cos(w), alpha = std::sin(w) / (2 * q);
+    const double a = std::sqrt(gain), beta = 2 * std::sqrt(a) * alpha;
+    return normalized(a * ((a + 1) + (a - 1) * c + beta), -2 * a * ((a - 1) + (a + 1) * c),
+                      a * ((a + 1) + (a - 1) * c - beta), (a + 1) - (a - 1) * c + beta,
+                      2 * ((a - 1) - (a + 1) * c), (a + 1) - (a - 1) * c - beta);
+}
+
+// Butterworth filter of 'order' as a cascade, one first order section for odd orders
+inline std::vector<Biquad> butterworth(bool high, std::size_t order, double freq, uint32_t sample_rate) {
+    std::vector<Biquad> sections;
+    for (std::size_t k = 0; k < order / 2; k++) {
+        const double q = 1 / (2 * std::sin(M_PI * (2 * k + 1) / (2 * order)));
+        sections.push_back(high ? high_pass(freq, q, sample_rate) : low_pass(freq, q, sample_rate));
+    }
+    if (order % 2) sections.push_back(high ? high_pass(freq, sample_rate) : low_pass(freq, sample_rate));
+    return sections;
+}
+
+// Butterworth band stop of 'order' sections between 'freq1' & 'freq2', every section has its zeros at the center.
+// The analog prototype's poles move around the center (s -> bandwidth * s / (s^2 + center^2)) and into z by
+// the bilinear transform, with the edges prewarped.
+inline std::vector<Biquad> band_stop(std::size_t order, double freq1, double freq2, uint32_t sample_rate) {
+    const double edge1 = std::tan(angle(freq1, sample_rate) / 2), edge2 = std::tan(angle(freq2, sample_rate) / 2);
+    const double bandwidth = edge2 - edge1, center2 = edge1 * edge2;
+    const double c = std::cos(2 * std::atan(std::sqrt(center2)));
+
+    std::vector<Biquad> sections;
+    for (std::size_t k = 0; k < order; k++) {
+        // Prototype poles in the upper half plane & their mirrors give one pole above the real axis each
+        const auto pole = std::polar(1.0, M_PI * (double)(2 * k + order + 1) / (double)(2 * order));
+        const auto b = bandwidth / pole, root = std::sqrt(b * b - 4 * center2);
+        auto s = (b + root) / 2.0;
+        if (s.imag() < 0) s = (b - root) / 2.0;
+        if (s.imag() < 0) s = std::conj(s);
+        const auto z = (1.0 + s) / (1.0 - s);
+
+        // Unit gain at 0 Hz
+        Biquad section {1, -2 * c, 1, -2 * z.real(), std::norm(z)};
+        const double dc = (2 - 2 * c) / (1 + section.a1 + section.a2);
+        section.b0 /= dc;
+        section.b1 /= dc;
+        section.b2 /= dc;
+        sections.push_back(section);
+    }
+    return sections;
+}
+} // Namespace biquad
+
+// Biquad cascade approximating a set of bands, filtered forward & backward (see BiquadCascade::process_zero_phase)
+struct IirDesign {
+    std::vector<Biquad> sections;
+    double max_error = 0;  // Largest distance from the gains the bands allow, in linear gain
+};
+
+// Sections filtering in a single causal pass with the magnitude of the forward & backward pass of 'design':
+// every section twice, which doubles their phase shift instead of cancelling it
+inline std::vector<Biquad> causal_sections(const IirDesign& design) {
+    auto sections = design.sections;
+    sections.insert(sections.end(), design.sections.begin(), design.sections.end());
+    return sections;
+}
+
+namespace details {
+
+// Gains bands allow on a grid of frequencies finer than the band edges & roll offs given in whole hertz.
+// Inside a band and away from all bands the gain is fixed, across a roll off it may be anything between
+// the band's gain & 1: roll offs are transition bands, filters with other shapes of transition than
+// the linear ramps of the FFT filters still meet the bands.
+struct GainGrid {
+    GainGrid(uint32_t sample_rate, const std::vector<Band>& bands, int roll)
+        : rate(sample_rate), size(std::bit_ceil<std::size_t>(4 * sample_rate)), lower(size / 2 + 1, 1.0),
+          upper(size / 2 + 1, 1.0) {
+        const std::size_t bins = lower.size();
+        std::vector<double> band_lower(bins), band_upper(bins);
+        for (const auto& band : bands) {
+            band_gains(bins, rate, {band}, roll, 0, bins, band_lower.data());
+            band_upper = band_lower;
+            if (roll > 0) {
+                const auto [low_roll, high_roll] = roll_bands(band, rate, roll);
+                for_band_bins(bins, rate, low_roll, Curve::lin, [&](std::size_t bin, double) {
+                    band_lower[bin] = band.gain1;
+                    band_upper[bin] = 1;
+                });
+                for_band_bins(bins, rate, high_roll, Curve::lin, [&](std::size_t bin, double) {
+                    band_lower[bin] = band.gain2;
+                    band_upper[bin] = 1;
+                });
+            }
+            for (std::size_t bin = 0; bin < bins; bin++) {
+                lower[bin] *= band_lower[bin];
+                upper[bin] *= band_upper[bin];
+            }
+        }
+    }
+
+    double angle(std::size_t bin) const { return 2 * M_PI * (double)bin / (double)size; }
+    std::size_t bin(double freq) const { return std::min(lower.size() - 1, (std::size_t)(freq * size / rate)); }
+
+    // Distance of a gain from the allowed gains of a bin
+    double error(std::size_t bin, double gain) const { return std::max({0.0, lower[bin] - gain, gain - upper[bin]}); }
+
+    uint32_t rate;
+    std::size_t size;
+    std::vector<double> lower, upper;
+};
+
+inline double cascade_power(const std::vector<Biquad>& sections, double w) {
+    double power = 1;
+    for (const auto& section : sections) power *= section.power(w);
+    return power;
+}
+
+// Largest error of the squared magnitude of 'sections' at 'bins'
+inline double max_error(const std::vector<Biquad>& sections, const GainGrid& grid, const std::vector<std::size_t>& bins) {
+    double error = 0;
+    for (auto bin : bins) {
+        const double bin_error = grid.error(bin, cascade_power(sections, grid.angle(bin)));
+        if (!(bin_error <= error)) error = bin_error;  // NaN of unstable designs included
+    }
+    return error;
+}
+
+// Bins a band's fit is judged on: every part of the band & its roll offs, and a sparse spread over the whole range
+inline std::vector<std::size_t> fit_bins(const GainGrid& grid, double low, double high) {
+    std::vector<std::size_t> bins;
+    const std::size_t first = grid.bin(std::max(0.0, low)), last = grid.bin(high);
+    const std::size_t step = std::max<std::size_t>(1, (last - first) / 1024);
+    for (std::size_t bin = first; bin <= last; bin += step) bins.push_back(bin);
+    for (double freq = 1; freq < grid.rate / 2.0; freq *= 1.03) bins.push_back(grid.bin(freq));
+    return bins;
+}
+
+// Best of the candidates 'design(x)' for x in [low, high], refined around the best x once.
+// The errors of these families change smoothly with their parameter, so a scan finds the minimum.
+template <typename F>
+std::pair<std::vector<Biquad>, double> scan(double low, double high, bool log_scale, const GainGrid& grid,
+                                             const std::vector<std::size_t>& bins, const F& design) {
+    constexpr int steps = 32;
+    std::vector<Biquad> best;
+    double best_error = INFINITY, best_x = low;
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i <= steps; i++) {
+            const double t = (double)i / steps;
+            const double x = log_scale ? low * std::pow(high / low, t) : low + (high - low) * t;
+            auto sections = design(x);
+            const double error = max_error(sections, grid, bins);
+            if (error < best_error) {
+                best = std::move(sections);
+                best_error = error;
+                best_x = x;
+            }
+        }
+        // Next round between the neighbours of the best candidate
+        const double spread = log_scale ? std::pow(high / low, 1.0 / steps) : (high - low) / steps;
+        low = log_scale ? best_x / spread : best_x - spread;
+        high = log_scale ? best_x * spread : best_x + spread;
+    }
+    return {best, best_error};
+}
+
+// Sections approximating one band & its roll offs within 'tolerance', nothing for bands no family fits:
+// flat cuts from 0 Hz are high passes or low shelves, flat cuts up to the Nyquist frequency low passes or
+// high shelves, other flat cuts band stops or peaking cuts. The fewest sections that fit are chosen.
+inline std::optional<std::vector<Biquad>> fit_band(const Band& band, int roll, uint32_t sample_rate, double tolerance) {
+    const double nyquist = sample_rate / 2.0;
+    if (band.gain1 != band.gain2 || band.gain1 >= 1 || band.freq1 >= band.freq2) return std::nullopt;
+
+    const GainGrid grid(sample_rate, {band}, roll);
+    const double gain = band.gain1, f1 = band.freq1, f2 = band.freq2;
+    const double margin = std::max({f2 - f1, (double)roll, 20.0});
+    const auto bins = fit_bins(grid, f1 - roll - margin, f2 + roll + margin);
+
+    // Candidates of one family with 'sections' sections, scanned over their parameter
+    std::vector<std::tuple<std::size_t, std::function<std::vector<Biquad>(double)>, double, double, bool>> families;
+    if (f1 == 0 && f2 < nyquist) {
+        const double low = std::max(1.0, f2 - roll), high = std::min(nyquist * 0.95, f2 + 2.0 * roll + 1);
+        for (std::size_t order = 1; order <= 12 && gain == 0; order++) {
+            families.emplace_back((order + 1) / 2, [=](double freq) {
+                return biquad::butterworth(true, order, freq, sample_rate);
+            }, low, high, true);
+        }
+        for (double q : {0.5, 0.707, 1.0}) {
+            families.emplace_back(1, [=](double freq) {
+                return std::vector {biquad::low_shelf(freq, std::sqrt(gain), q, sample_rate)};
+            }, low, high, true);
+        }
+    } else if (f2 >= nyquist && f1 > 0) {
+        const double low = std::max(1.0, f1 - 2.0 * roll - 1), high = std::min(nyquist * 0.95, f1 + roll);
+        for (std::size_t order = 1; order <= 12 && gain == 0; order++) {
+            families.emplace_back((order + 1) / 2, [=](double freq) {
+                return biquad::butterworth(false, order, freq, sample_rate);
+            }, low, high, true);
+        }
+        for (double q : {0.5, 0.707, 1.0}) {
+            families.emplace_back(1, [=](double freq) {
+                return std::vector {biquad::high_shelf(freq, std::sqrt(gain), q, sample_rate)};
+            }, low, high, true);
+        }
+    } else if (f1 > 0 && gain == 0) {
+        // Edges moved out into the roll offs
+        const double narrow = (f2 - f1) / 4;
+        for (std::size_t order = 1; order <= 6; order++) {
+            families.emplace_back(order, [=](double offset) {
+                return biquad::band_stop(order, std::max(1.0, f1 - offset), std::min(nyquist * 0.99, f2 + offset),
+                                         sample_rate);
+            }, -narrow, roll + narrow + 1, false);
+        }
+    } else if (f1 > 0) {
+        // Q of the peak from its center over about the width of the band & its roll offs
+        const double center = (f1 + f2) / 2, width = f2 - f1 + roll;
+        for (std::size_t count : {1, 2}) {
+            const double section_gain = std::pow(gain, 0.5 / count);
+            families.emplace_back(count, [=](double q) {
+                return std::vector(count, biquad::peaking(center, section_gain, q, sample_rate));
+            }, center / (4 * width), 4 * center / width, true);
+        }
+    }
+    std::stable_sort(families.begin(), families.end(), [](const auto& a, const auto& b) {
+        return std::get<0>(a) < std::get<0>(b);
+    });
+
+    for (const auto& [sections, design, low, high, log_scale] : families) {
+        auto [best, error] = scan(low, high, log_scale, grid, bins, design);
+        if (error <= tolerance) return best;
+    }
+    return std::nullopt;
+}
+} // Namespace details
+
+// Designs a biquad cascade whose forward & backward filtering meets the bands within 'tolerance' in linear gain:
+// inside the bands & away from them as ctf::band_gains, across the roll offs anywhere between the band's gain & 1.
+// Nothing if the bands are not notches, low & high cuts or shelves that biquads fit that closely.
+inline std::optional<IirDesign> design_iir(uint32_t sample_rate, const std::vector<Band>& bands, int roll,
+                                           double tolerance=0.05) {
+    IirDesign design;
+    for (const auto& band : bands) {
+        details::check_band(band, sample_rate, roll);
+        // Errors of several bands add up
+        const auto sections = details::fit_band(band, roll, sample_rate, tolerance / (double)bands.size());
+        if (!sections) return std::nullopt;
+        design.sections.insert(design.sections.end(), sections->begin(), sections->end());
+    }
+
+    // Every bin of the whole response
+    const details::GainGrid grid(sample_rate, bands, roll);
+    for (std::size_t bin = 0; bin < grid.lower.size(); bin++) {
+        const double error = grid.error(bin, details::cascade_power(design.sections, grid.angle(bin)));
+        if (!(error <= design.max_error)) design.max_error = error;
+    }
+    if (!(design.max_error <= tolerance)) return std::nullopt;
+    return design;
+}
+
+// Returns a shared design, each combination of sample rate, bands & roll off is designed once.
+// Null if the bands have no IIR design (see ctf::design_iir).
+inline std::shared_ptr<const IirDesign> get_iir_design(uint32_t sample_rate, const std::vector<Band>& bands, int roll) {
+    using Key = std::tuple<uint32_t, std::vector<Band>, int>;
+    static std::map<Key, std::shared_ptr<const IirDesign>, std::less<>> cache;
+    static std::mutex cache_mutex;
+
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto found = cache.find(std::tie(sample_rate, bands, roll));
+        if (found != cache.end()) return found->second;
+    }
+
+    // Designed outside the lock, so files with different bands do not wait for each other
+    const auto design = design_iir(sample_rate, bands, roll);
+    auto shared = design ? std::make_shared<const IirDesign>(*design) : nullptr;
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return cache.emplace(Key(sample_rate, bands, roll), shared).first->second;
+}
+
+// Ways of filtering whole files: transforming them (see ctf::filter_wav) or running biquads over them
+enum class Engine { automatic, fft, iir };
+
+inline const char* engine_name(Engine engine) {
+    switch (engine) {
+        case Engine::fft: return "fft";
+        case Engine::iir: return "iir";
+        default: return "auto";
+    }
+}
+
+// The engine chosen for a file with the cost of both, estimated from operation counts (not timed)
+// in the units of ctf::fft_cost
+struct EngineChoice {
+    Engine engine = Engine::fft;
+    std::shared_ptr<const IirDesign> design;  // Null for bands only the FFT engine filters
+    double fft_cost = 0, iir_cost = INFINITY;
+};
+
+namespace details {
+
+// Cost of filtering a sample with one section, in the units of ctf::fft_cost.
+// Each output waits on the previous one, so a section costs the latency of its multiply-adds, not their
+// throughput: about 3 ns a sample, where transforms take about 0.5 ns per unit. A fixed estimate rather
+// than a timing like the planner's: the engines' outputs differ by more than rounding, so the choice
+// shouldn't depend on timing noise.
+constexpr double iir_section_cost = 6;
+
+// Samples of a channel the IIR engine filters at a time, so a chunk stays cached from reading to writing it
+constexpr std::size_t iir_chunk_frames = std::size_t(1) << 16;
+} // Namespace details
+
+// Chooses the engine for filtering 'channels' channels of 'frames' samples on 'threads' threads.
+// Both engines filter channels concurrently, the FFT engine also splits each transform across threads
+// while the recursion of the biquads keeps a channel on one thread. Throws std::invalid_argument
+// if the IIR engine is requested for bands it can't approximate.
+inline EngineChoice choose_engine(std::size_t frames, std::size_t channels, uint32_t sample_rate,
+                                  const std::vector<Band>& bands, int roll, std::size_t threads,
+                                  Engine requested=Engine::automatic) {
+    threads = std::max<std::size_t>(1, threads);
+    EngineChoice choice;
+    const std::size_t n = fft_size(frames);
+    choice.fft_cost = 2 * (fft_cost(n / 2) + 4.0 * n) * (double)channels / (double)threads;
+    if (requested == Engine::fft) return choice;
+
+    choice.design = get_iir_design(sample_rate, bands, roll);
+    if (!choice.design) {
+        if (requested == Engine::iir) {
+            throw std::invalid_argument("The bands can't be filtered with IIR filters, only notches, "
+                                        "low & high cuts with roll offs are");
+        }
+        return choice;
+    }
+    const double rounds = (double)((channels + threads - 1) / threads);
+    choice.iir_cost = 2 * (double)(choice.design->sections.size() * frames) * details::iir_section_cost * rounds;
+    if (requested == Engine::iir || choice.iir_cost < choice.fft_cost) choice.engine = Engine::iir;
+    return choice;
+}
+
+// Filters every channel of a WAVE file forward & backward with the sections of 'design' into an output file
+// of the same format, channels are filtered concurrently on 'pool'. The backward pass starts from the end of
+// the forward pass's output, so the forward pass runs in chunks from the input into a scratch file in
+// 'scratch_dir', and the backward pass in chunks from the end of the scratch file into the output. Each thread
+// holds a chunk of samples however long the file, channels of a single chunk skip the scratch file.
+template <typename T>
+void filter_wav_iir(const WavReader& reader, WavWriter& writer, const IirDesign& design, const std::string& scratch_dir,
+                    ThreadPool& pool, Stats* stats=nullptr) {
+    if (writer.frames() != reader.frames() || writer.channels() != reader.channels()) {
+        throw std::invalid_argument("Output does not match the input");
+    }
+    const std::size_t frames = reader.frames(), chunk = details::iir_chunk_frames;
+    pool.parallel_for(reader.channels(), [&](std::size_t first, std::size_t last) {
+        BiquadCascade cascade(design.sections);
+        std::vector<T> buffer;
+        std::optional<details::ScratchFile<T>> scratch;
+        if (frames <= chunk) {
+            buffer.resize(frames);
+        } else {
+            scratch.emplace(scratch_dir, frames);
+        }
+        T* const samples = scratch ? scratch->data() : buffer.data();
+
+        for (std::size_t channel = first; channel < last; channel++) {
+            cascade.reset();
+            for (std::size_t pos = 0; pos < frames; pos += chunk) {
+                const std::size_t count = std::min(chunk, frames - pos);
+                {
+                    Stats::Scope scope(stats, "load");
+                    reader.read(channel, pos, count, samples + pos);
+                }
+                Stats::Scope scope(stats, "iir_filter");
+                cascade.process(samples + pos, count);
+                if (scratch && pos + count < frames) scratch->drop(pos, count);
+            }
+
+            cascade.reset();
+            for (std::size_t end = frames; end > 0; ) {
+                const std::size_t count = std::min(chunk, end), pos = end - count;
+                {
+                    Stats::Scope scope(stats, "iir_filter");
+                    cascade.process_reverse(samples + pos, count);
+                }
+                Stats::Scope scope(stats, "save");
+                writer.write(channel, pos, count, samples + pos);
+                if (scratch) scratch->drop(pos, count);
+                end = pos;
+            }
+        }
+    }, reader.channels());
+}
+
+// Filters every channel of a WAVE file in a single causal pass through the sections of 'design' (see
+// ctf::causal_sections) into an output file of the same format, 'chunk_frames' samples at a time, channels
+// concurrently on 'pool'. Each thread holds a chunk of samples, but unlike ctf::filter_wav_iir the output
+// is delayed & phase shifted by the sections.
+template <typename T>
+void filter_wav_iir_causal(const WavReader& reader, WavWriter& writer, const IirDesign& design,
+                           std::size_t chunk_frames, ThreadPool& pool, Stats* stats=nullptr) {
+    if (writer.frames() != reader.frames() || writer.channels() != reader.channels()) {
+        throw std::invalid_argument("Output does not match the input");
+    }
+    if (chunk_frames == 0) {
+        throw std::invalid_argument("Chunk size must be positive");
+    }
+    const std::size_t frames = reader.frames();
+    pool.parallel_for(reader.channels(), [&](std::size_t first, std::size_t last) {
+        BiquadCascade cascade(causal_sections(design));
+        std::vector<T> samples(std::min(chunk_frames, frames));
+        for (std::size_t channel = first; channel < last; channel++) {
+            cascade.reset();
+            for (std::size_t pos = 0; pos < frames; pos += chunk_frames) {
+                const std::size_t count = std::min(chunk_frames, frames - pos);
+                {
+                    Stats::Scope scope(stats, "load");
+                    reader.read(channel, pos, count, samples.data());
+                }
+                {
+                    Stats::Scope scope(stats, "iir_filter");
+                    cascade.process(samples.data(), count);
+                }
+                Stats::Scope scope(stats, "save");
+                writer.write(channel, pos, count, samples.data());
+            }
+        }
+    }, reader.channels());
+}
+} // Namespace ctf
@@ -10,7 +10,7 @@
 namespace ctf {
 namespace details {
 
-void get_numeric(uint32_t& freq1, uint32_t& freq2, double& gain1, double& gain2) {
+inline void get_numeric(uint32_t& freq1, uint32_t& freq2, double& gain1, double& gain2) {
     std::cout << "\nLow freq & gain: ";
     std::cin >> freq1 >> gain1;
 
@@ -37,27 +37,19 @@ void get_numeric(uint32_t& freq1, uint32_t& freq2, double& gain1, double& gain2)
         std::cin >> freq2 >> gain2;
     }
 }
-} // Namespace details
-
-// Returns a vector of user defined frequency bands
-std::vector<ctf::Band> get_user_input(uint32_t sample_rate) {
-    std::cout << "Greetings!\n\n";
-    std::cout << "Please enter frequencies between 0 and " << sample_rate/2 << ".\n"
-                 "Gain must be between 0 and 1\n";
 
-    std::vector<ctf::Band> bands;
-    bool correct_input, ask_freqs = true;
-
-    while (ask_freqs) {
+// Asks for a band until a valid one is given
+inline Band get_band(uint32_t sample_rate) {
+    while (true) {
         uint32_t freq1, freq2;
         double gain1, gain2;
 
-        details::get_numeric(freq1, freq2, gain1, gain2);
+        get_numeric(freq1, freq2, gain1, gain2);
 
-        correct_input = freq1 <= sample_rate/2 &&
-                        freq2 <= sample_rate/2 &&
-                        gain1 >= 0 && gain1 <= 1 &&
-                        gain2 >= 0 && gain2 <= 1;
+        const bool correct_input = freq1 <= sample_rate/2 &&
+                                   freq2 <= sample_rate/2 &&
+                                   gain1 >= 0 && gain1 <= 1 &&
+                                   gain2 >= 0 && gain2 <= 1;
 
         if (!correct_input) {
             std::cout << "\nInput out of range\n";
@@ -69,32 +61,53 @@ std::vector<ctf::Band> get_user_input(uint32_t sample_rate) {
             continue;
         }
 
-        bands.push_back(ctf::Band(freq1, freq2, gain1, gain2));
-
-        std::cout << "Want to enter more frequency bands? (y/n)\n";
-        while (true) {
-            std::string ans;
-            std::cin >> ans;
-
-            // Ans to lowercase
-            std::transform(ans.begin(), ans.end(), ans.begin(), [](unsigned char c){return std::tolower(c);});
-            
-            if (ans == "y" || ans == "yes") {
-                ask_freqs = true;
-                break;
-            } else if (ans == "n" || ans == "no") {
-                ask_freqs = false;
-                break;
-            } else {
-                std::cout << "Enter 'yes' or 'no'\n";
-            }
+        return ctf::Band(freq1, freq2, gain1, gain2);
+    }
+}
+
+// Asks a yes or no question until either is answered
+inline bool get_yes_no(const std::string& question) {
+    std::cout << question << " (y/n)\n";
+    while (true) {
+        std::string ans;
+        if (!(std::cin >> ans)) return false;
+
+        // Ans to lowercase
+        std::transform(ans.begin(), ans.end(), ans.begin(), [](unsigned char c){return std::tolower(c);});
+
+        if (ans == "y" || ans == "yes") {
+            return true;
+        } else if (ans == "n" || ans == "no") {
+            return false;
+        } else {
+            std::cout << "Enter 'yes' or 'no'\n";
         }
     }
+}
+} // Namespace details
+
+// Returns a vector of user defined frequency bands
+inline std::vector<ctf::Band> get_user_input(uint32_t sample_rate) {
+    std::cout << "Greetings!\n\n";
+    std::cout << "Please enter frequencies between 0 and " << sample_rate/2 << ".\n"
+                 "Gain must be between 0 and 1\n";
+
+    std::vector<ctf::Band> bands;
+    do {
+        bands.push_back(details::get_band(sample_rate));
+    } while (details::get_yes_no("Want to enter more frequency bands?"));
     return bands;
 }
 
+// Asks whether to add another band to 'bands' after filtering, returns false when the user is done
+inline bool add_user_band(std::vector<ctf::Band>& bands, uint32_t sample_rate) {
+    if (!details::get_yes_no("\nAdd another frequency band and filter again?")) return false;
+    bands.push_back(details::get_band(sample_rate));
+    return true;
+}
+
 // Returns false on valid input
-bool validate_input(std::vector<ctf::Band> &bands, uint32_t sample_rate, int roll) {
+inline bool validate_input(std::vector<ctf::Band> &bands, uint32_t sample_rate, int roll) {
     for (auto band : bands) {
         if (band.freq1 > sample_rate / 2 || band.freq2 > sample_rate / 2) {
             std::cerr << "Band frequencies must be below sample rate / 2" << std::endl;
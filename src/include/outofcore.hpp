@@ -0,0 +1,307 @@
+#pragma once
+
+#include <vector>
+#include <complex>
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "fft.hpp"
+#include "filter.hpp"
+#include "parallel.hpp"
+#include "wav.hpp"
+#include "stats.hpp"
+
+namespace ctf {
+namespace details {
+
+// True if 'size' has no prime factors other than 2, 3 & 5
+inline bool is_smooth(std::size_t size) {
+    for (std::size_t factor : {2, 3, 5}) {
+        while (size % factor == 0) size /= factor;
+    }
+    return size == 1;
+}
+
+// Memory mapped file of 'count' values in 'dir', removed from the file system right away
+// so it disappears however the process ends
+template <typename V>
+class ScratchFile {
+public:
+    ScratchFile(const std::string& dir, std::size_t count) : count(count) {
+        std::string path = dir + "/ctf-scratch-XXXXXX";
+        const int fd = ::mkstemp(path.data());
+        if (fd < 0) {
+            throw std::runtime_error("Failed to create a scratch file in " + dir);
+        }
+        ::close(fd);
+        try {
+            file = std::make_unique<MappedFile>(path, count * sizeof(V));
+        } catch (...) {
+            ::unlink(path.c_str());
+            throw;
+        }
+        ::unlink(path.c_str());
+        // Passes jump between rows, reading ahead would only fill memory
+        ::madvise(file->data(), file->size(), MADV_RANDOM);
+    }
+
+    V* data() const { return reinterpret_cast<V*>(file->data()); }
+    std::size_t size() const { return count; }
+
+    // Writes values [first, first + length) back to the file and drops them from memory
+    void release(std::size_t first, std::size_t length) const {
+        file->release(first * sizeof(V), length * sizeof(V));
+    }
+
+    // Drops values [first, first + length) from memory, they are written back later (see MappedFile::drop)
+    void drop(std::size_t first, std::size_t length) const {
+        file->drop(first * sizeof(V), length * sizeof(V));
+    }
+
+    // Same as release for 'rows' ranges of 'length' values, 'stride' apart
+    void release(std::size_t first, std::size_t length, std::size_t stride, std::size_t rows) const {
+        for (std::size_t row = 0; row < rows; row++) {
+            release(first + row * stride, length);
+        }
+    }
+
+private:
+    std::size_t count;
+    std::unique_ptr<MappedFile> file;
+};
+} // Namespace details
+
+// Transforms of complex data in memory mapped scratch files, using at most about 'memory_budget' bytes of memory.
+// The four-step algorithm splits a size n = rows * columns into transforms of every column & every row,
+// both passes go through the data once, a block of neighbouring columns or rows that fits the budget at a time.
+// Blocks are multiples of a page where possible, so every page is read & written once per pass.
+template <typename T>
+class BasicOutOfCoreFft {
+public:
+    using C = std::complex<T>;
+    using Scratch = details::ScratchFile<C>;
+
+    BasicOutOfCoreFft(std::size_t size, std::size_t memory_budget) : n(size) {
+        if (n == 0 || !details::is_smooth(n)) {
+            throw std::invalid_argument("Out-of-core FFT size must only have factors 2, 3 & 5");
+        }
+
+        // Rows get the smaller half of the factors, so both sub-transforms are close to sqrt(n)
+        rows = 1;
+        for (std::size_t factor : {2, 3, 5}) {
+            for (std::size_t rest = n; rest % factor == 0; rest /= factor) {
+                if (rows * factor * rows * factor <= n) rows *= factor;
+            }
+        }
+        columns = n / rows;
+        if (2 * columns * sizeof(C) > memory_budget) {
+            throw std::invalid_argument("Memory budget is too small for an out-of-core FFT of size " + std::to_string(n));
+        }
+        column_block = block_size(memory_budget / 2 / (rows * sizeof(C)), columns);
+        row_block = block_size(memory_budget / 2 / (columns * sizeof(C)), rows);
+
+        column_plan = get_plan<T>(rows);
+        row_plan = get_plan<T>(columns);
+        coarse_twiddles.resize(rows);
+        for (std::size_t h = 0; h < rows; h++) {
+            coarse_twiddles[h] = (C)std::polar(1.0, -2.0 * M_PI * (double)h / (double)rows);
+        }
+        fine_twiddles.resize(columns);
+        for (std::size_t l = 0; l < columns; l++) {
+            fine_twiddles[l] = (C)std::polar(1.0, -2.0 * M_PI * (double)l / (double)n);
+        }
+    }
+
+    std::size_t size() const { return n; }
+
+    // In-place transforms of 'data', 'work' is scratch of the same size. Blocks are split across 'pool' if given.
+    void forward(const Scratch& data, const Scratch& work, ThreadPool* pool=nullptr) const {
+        transform<false>(data, work, pool);
+    }
+
+    // Scaled by 1/n
+    void inverse(const Scratch& data, const Scratch& work, ThreadPool* pool=nullptr) const {
+        transform<true>(data, work, pool);
+    }
+
+private:
+    std::size_t n, rows, columns, column_block, row_block;
+    std::shared_ptr<const BasicFftPlan<T>> column_plan, row_plan;
+    std::vector<C> coarse_twiddles, fine_twiddles;  // exp(-2 pi i m / n) = coarse[m / columns] * fine[m % columns]
+
+    // Largest count of lines up to 'fit', rounded down to whole pages when at least one fits
+    static std::size_t block_size(std::size_t fit, std::size_t lines) {
+        const std::size_t page = ::sysconf(_SC_PAGESIZE) / sizeof(C);
+        if (fit >= page) fit = fit / page * page;
+        return std::clamp<std::size_t>(fit, 1, lines);
+    }
+
+    // 1. every column of 'data' is transformed & multiplied by twiddles into a row of 'work',
+    // 2. every column of 'work' is transformed into a row of 'data', which leaves 'data' in natural order.
+    // Sub-transforms of the inverse are scaled by their size, which scales the whole by 1/n.
+    template <bool inverse>
+    void transform(const Scratch& data, const Scratch& work, ThreadPool* pool) const {
+        if (data.size() != n || work.size() != n) {
+            throw std::invalid_argument("Scratch file size does not match out-of-core FFT size");
+        }
+        const details::Executor exec(pool);
+        C* const x = data.data();
+        C* const y = work.data();
+
+        std::vector<C> buffer(column_block * rows);
+        for (std::size_t first = 0; first < columns; first += column_block) {
+            const std::size_t count = std::min(column_block, columns - first);
+            for (std::size_t j1 = 0; j1 < rows; j1++) {
+                std::copy(x + j1 * columns + first, x + j1 * columns + first + count, buffer.begin() + j1 * count);
+            }
+            data.release(first, count, columns, rows);
+
+            exec.run(count, [&](std::size_t begin, std::size_t end) {
+                for (std::size_t b = begin; b < end; b++) {
+                    const std::size_t j2 = first + b;
+                    C* row = y + j2 * rows;
+                    for (std::size_t j1 = 0; j1 < rows; j1++) {
+                        row[j1] = buffer[j1 * count + b];
+                    }
+                    if (inverse) {
+                        column_plan->inverse(row);
+                    } else {
+                        column_plan->forward(row);
+                    }
+
+                    // Twiddle exp(-2 pi i j2 k1 / n), the exponent is stepped without divisions
+                    for (std::size_t k1 = 1, coarse = 0, fine = j2; k1 < rows; k1++) {
+                        const auto w = details::mul(coarse_twiddles[coarse], fine_twiddles[fine]);
+                        row[k1] = details::mul(row[k1], inverse ? std::conj(w) : w);
+                        fine += j2;
+                        if (fine >= columns) { fine -= columns; coarse++; }
+                    }
+                }
+            });
+            work.release(first * rows, count * rows);
+        }
+
+        buffer.assign(row_block * columns, C(0, 0));
+        for (std::size_t first = 0; first < rows; first += row_block) {
+            const std::size_t count = std::min(row_block, rows - first);
+            for (std::size_t j2 = 0; j2 < columns; j2++) {
+                std::copy(y + j2 * rows + first, y + j2 * rows + first + count, buffer.begin() + j2 * count);
+            }
+            work.release(first, count, rows, columns);
+
+            exec.run(count, [&](std::size_t begin, std::size_t end) {
+                std::vector<C> line(columns);
+                for (std::size_t b = begin; b < end; b++) {
+                    for (std::size_t j2 = 0; j2 < columns; j2++) {
+                        line[j2] = buffer[j2 * count + b];
+                    }
+                    if (inverse) {
+                        row_plan->inverse(line.data());
+                    } else {
+                        row_plan->forward(line.data());
+                    }
+                    for (std::size_t k2 = 0; k2 < columns; k2++) {
+                        buffer[k2 * count + b] = line[k2];
+                    }
+                }
+            });
+            for (std::size_t k2 = 0; k2 < columns; k2++) {
+                std::copy(buffer.begin() + k2 * count, buffer.begin() + (k2 + 1) * count, x + k2 * rows + first);
+            }
+            data.release(first, count, rows, columns);
+        }
+    }
+};
+
+using OutOfCoreFft = BasicOutOfCoreFft<double>;
+
+// Filters every channel of a WAVE file like ctf::filter_wav does with whole file transforms,
+// with the transforms kept in scratch files in 'scratch_dir' and about 'memory_budget' bytes of memory.
+// The transform length is the same as in memory (see ctf::fft_size), so the results are the same
+// up to rounding. Stages are recorded to 'stats' if given.
+template <typename T>
+void filter_out_of_core(const WavReader& reader, WavWriter& writer, const std::vector<Band>& bands, int roll,
+                        std::size_t memory_budget, const std::string& scratch_dir, ThreadPool* pool=nullptr,
+                        Stats* stats=nullptr) {
+    using C = std::complex<T>;
+    const std::size_t frames = reader.frames();
+
+    // The samples are transformed as half as many complex values, whose size must split into rows & columns
+    std::size_t size = fft_size(frames);
+    while (!details::is_smooth(size / 2)) size += 2;
+    const std::size_t h = size / 2;
+
+    const auto [fft, scratch, work] = [&] {
+        Stats::Scope scope(stats, "plan");
+        return std::tuple(BasicOutOfCoreFft<T>(h, memory_budget), details::ScratchFile<C>(scratch_dir, h),
+                          details::ScratchFile<C>(scratch_dir, h));
+    }();
+    T* const samples = reinterpret_cast<T*>(scratch.data());
+    C* const packed = scratch.data();
+
+    // Samples & bins are moved in chunks of a quarter of the budget
+    const std::size_t chunk = std::max<std::size_t>(1, memory_budget / 4 / sizeof(C));
+    std::vector<double> gains(chunk), mirror_gains(chunk);
+
+    for (std::size_t channel = 0; channel < reader.channels(); channel++) {
+        {
+            Stats::Scope scope(stats, "load");
+            for (std::size_t pos = 0; pos < size; pos += 2 * chunk) {
+                const std::size_t count = std::min(2 * chunk, size - pos);
+                const std::size_t read = pos < frames ? std::min(count, frames - pos) : 0;
+                if (read) reader.read(channel, pos, read, samples + pos);
+                std::fill(samples + pos + read, samples + pos + count, 0);
+                scratch.release(pos / 2, count / 2);
+            }
+        }
+        {
+            Stats::Scope scope(stats, "forward_fft");
+            fft.forward(scratch, work, pool);
+        }
+        {
+            // Bins k & h-k of the real spectrum are unpacked, cut & packed back together
+            Stats::Scope scope(stats, "band_application");
+            double edge[2];
+            details::band_gains(h + 1, reader.sample_rate(), bands, roll, 0, 1, edge);
+            details::band_gains(h + 1, reader.sample_rate(), bands, roll, h, 1, edge + 1);
+            const C z0 = packed[0];
+            const T x0 = (z0.real() + z0.imag()) * (T)edge[0], xh = (z0.real() - z0.imag()) * (T)edge[1];
+            packed[0] = C(x0 + xh, x0 - xh) * (T)0.5;
+
+            for (std::size_t first = 1; first <= h / 2; first += chunk) {
+                const std::size_t count = std::min(chunk, h / 2 + 1 - first);
+                details::band_gains(h + 1, reader.sample_rate(), bands, roll, first, count, gains.data());
+                details::band_gains(h + 1, reader.sample_rate(), bands, roll, h - (first + count - 1), count,
+                                    mirror_gains.data());
+                for (std::size_t i = 0; i < count; i++) {
+                    const std::size_t k = first + i;
+                    const auto w = (C)std::polar(1.0, -2.0 * M_PI * (double)k / (double)size);
+                    auto [xk, xhk] = details::unpack_bins(packed[k], packed[h - k], w);
+                    xk *= (T)gains[i];
+                    xhk *= (T)mirror_gains[count - 1 - i];
+                    const auto [zk, zhk] = details::pack_bins(xk, xhk, w);
+                    packed[k] = zk;
+                    packed[h - k] = zhk;
+                }
+                scratch.release(first, count);
+                scratch.release(h - (first + count - 1), count);
+            }
+        }
+        {
+            Stats::Scope scope(stats, "inverse_fft");
+            fft.inverse(scratch, work, pool);
+        }
+        Stats::Scope scope(stats, "save");
+        for (std::size_t pos = 0; pos < frames; pos += 2 * chunk) {
+            const std::size_t count = std::min(2 * chunk, frames - pos);
+            writer.write(channel, pos, count, samples + pos);
+            scratch.release(pos / 2, (count + 1) / 2);
+        }
+    }
+}
+} // Namespace ctf
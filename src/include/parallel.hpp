@@ -0,0 +1,281 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <exception>
+#include <algorithm>
+#include <bit>
+
+namespace ctf {
+
+// Work-stealing thread pool. Every thread has its own task queue, idle threads
+// steal from the others. A parallel loop hands out its chunks through a shared
+// counter, and the thread that started it keeps taking chunks until none are left,
+// so loops can be nested (e.g. channels and their FFTs) without deadlocking.
+class ThreadPool {
+public:
+    // 'threads' includes the calling thread, which takes part in parallel loops
+    explicit ThreadPool(std::size_t threads=std::thread::hardware_concurrency()) {
+        threads = std::max<std::size_t>(1, threads);
+        for (std::size_t i = 0; i < threads; i++) {
+            queues.push_back(std::make_unique<Queue>());
+        }
+        for (std::size_t i = 1; i < threads; i++) {
+            workers.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    std::size_t size() const { return queues.size(); }
+
+    // True while the calling thread runs a chunk of a parallel loop split across the threads of any pool,
+    // when other chunks & tasks may be running on the other threads
+    static bool in_parallel_loop() { return loop_depth() > 0; }
+
+    // Calls fn(begin, end) for 'chunks' consecutive ranges covering [0, count)
+    // and returns when all of them are done. Rethrows the first exception thrown.
+    void parallel_for(std::size_t count, const std::function<void(std::size_t, std::size_t)>& fn, std::size_t chunks=0) {
+        if (count == 0) return;
+        chunks = std::min(count, chunks ? chunks : 4 * size());
+        if (chunks == 1 || size() == 1) {
+            fn(0, count);
+            return;
+        }
+
+        auto loop = std::make_shared<Loop>(count, chunks, fn);
+        const std::size_t helpers = std::min(chunks, size()) - 1;
+        const std::size_t self = current_pool() == this ? current_queue() : 0;
+        for (std::size_t i = 0; i < helpers; i++) {
+            push(self, [loop] { loop->run(); });
+        }
+        loop->run();
+
+        // Wait for the chunks other threads are still running
+        for (std::size_t done = loop->done; done < chunks; done = loop->done) {
+            loop->done.wait(done);
+        }
+        if (loop->error) std::rethrow_exception(loop->error);
+    }
+
+private:
+    struct Loop {
+        Loop(std::size_t count, std::size_t chunks, const std::function<void(std::size_t, std::size_t)>& fn)
+            : count(count), chunks(chunks), fn(&fn) {}
+
+        const std::size_t count, chunks;
+        const std::function<void(std::size_t, std::size_t)>* fn;  // Only used while chunks are left
+        std::atomic<std::size_t> next {0}, done {0};
+        std::exception_ptr error;
+        std::mutex error_mutex;
+
+        void run() {
+            for (std::size_t c = next++; c < chunks; c = next++) {
+                loop_depth()++;
+                try {
+                    (*fn)(count * c / chunks, count * (c + 1) / chunks);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    if (!error) error = std::current_exception();
+                }
+                loop_depth()--;
+                done++;
+                done.notify_all();
+            }
+        }
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;  // Index 0 is for threads outside the pool
+    std::vector<std::thread> workers;
+    std::atomic<std::size_t> pending {0};
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    static const ThreadPool*& current_pool() {
+        thread_local const ThreadPool* pool = nullptr;
+        return pool;
+    }
+    static std::size_t& current_queue() {
+        thread_local std::size_t index = 0;
+        return index;
+    }
+    static std::size_t& loop_depth() {
+        thread_local std::size_t depth = 0;
+        return depth;
+    }
+
+    void push(std::size_t self, std::function<void()> task) {
+        pending++;
+        {
+            std::lock_guard<std::mutex> lock(queues[self]->mutex);
+            queues[self]->tasks.push_back(std::move(task));
+        }
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        wake.notify_one();
+    }
+
+    // Runs the newest task of own queue or steals the oldest task of another queue
+    bool run_one(std::size_t self) {
+        std::function<void()> task;
+        for (std::size_t i = 0; i < queues.size() && !task; i++) {
+            auto& queue = *queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) continue;
+
+            if (i == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+        }
+        if (!task) return false;
+
+        pending--;
+        task();
+        return true;
+    }
+
+    void work(std::size_t self) {
+        current_pool() = this;
+        current_queue() = self;
+
+        while (true) {
+            if (run_one(self)) continue;
+
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [this] { return stopping || pending > 0; });
+            if (stopping) return;
+        }
+    }
+};
+
+// Bounded lock-free queue for any number of producers & consumers, a ring of slots with a sequence number each
+// (Vyukov's bounded MPMC queue). Producers & consumers claim positions with a compare-and-swap and hand
+// each slot over through its sequence number, so they never share a lock. Blocking push & pop wait on
+// the slot's sequence number while the queue is full or empty, which gives pipelines backpressure.
+template <typename V>
+class BoundedQueue {
+public:
+    // Capacity is rounded up to a power of 2
+    explicit BoundedQueue(std::size_t capacity)
+        : mask(std::bit_ceil(std::max<std::size_t>(2, capacity)) - 1), slots(mask + 1) {
+        for (std::size_t i = 0; i <= mask; i++) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    std::size_t capacity() const { return mask + 1; }
+
+    // Returns false if the queue is full
+    bool try_push(V value) {
+        return push_or_wait(value, false);
+    }
+
+    // Waits while the queue is full
+    void push(V value) {
+        push_or_wait(value, true);
+    }
+
+    // Returns false if the queue is empty
+    bool try_pop(V& value) {
+        return pop_or_wait(value, false);
+    }
+
+    // Waits while the queue is empty
+    V pop() {
+        V value;
+        pop_or_wait(value, true);
+        return value;
+    }
+
+private:
+    struct Slot {
+        std::atomic<std::size_t> sequence;
+        V value;
+    };
+
+    // Positions are only touched by their own side, on cache lines of their own
+    alignas(64) std::atomic<std::size_t> tail {0};
+    alignas(64) std::atomic<std::size_t> head {0};
+    alignas(64) const std::size_t mask;
+    std::vector<Slot> slots;
+
+    // A slot is free for position p when its sequence is p, and holds the value of position p when it's p+1
+    bool push_or_wait(V& value, bool wait) {
+        std::size_t pos = tail.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[pos & mask];
+            const std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            const auto diff = (std::ptrdiff_t)(sequence - pos);
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.value = std::move(value);
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    slot.sequence.notify_all();
+                    return true;
+                }
+            } else if (diff < 0) {
+                // Full until the consumer of the previous round frees the slot
+                if (!wait) return false;
+                slot.sequence.wait(sequence, std::memory_order_acquire);
+                pos = tail.load(std::memory_order_relaxed);
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop_or_wait(V& value, bool wait) {
+        std::size_t pos = head.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[pos & mask];
+            const std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            const auto diff = (std::ptrdiff_t)(sequence - (pos + 1));
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(slot.value);
+                    slot.sequence.store(pos + mask + 1, std::memory_order_release);
+                    slot.sequence.notify_all();
+                    return true;
+                }
+            } else if (diff < 0) {
+                // Empty until a producer fills the slot
+                if (!wait) return false;
+                slot.sequence.wait(sequence, std::memory_order_acquire);
+                pos = head.load(std::memory_order_relaxed);
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
+} // Namespace ctf
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <exception>
+#include <limits>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+
+#include "fft.hpp"
+#include "batchfft.hpp"
+#include "filter.hpp"
+#include "parallel.hpp"
+#include "stream.hpp"
+#include "wav.hpp"
+#include "stats.hpp"
+
+namespace ctf {
+
+// Filters every channel of a WAVE file in overlap-add blocks of 'fft_size' (see BasicBlockFilter)
+// with decoding, transforms & encoding running concurrently as a pipeline:
+// a reader thread decodes the next blocks of fft_size/2 samples of every channel into a free buffer,
+// 'workers' threads filter all blocks of a buffer at once with batched transforms (see BasicBatchRealFftPlan),
+// and the calling thread overlap-adds the blocks in order and encodes them into 'writer'.
+// The stages hand buffers to each other through bounded lock-free queues, a fixed set of 'depth' buffers
+// (0 for 4 per worker) circulates from the writer back to the reader, so a slow stage stalls the others
+// instead of letting blocks pile up. Output is the same as BasicBlockFilter's up to rounding.
+template <typename T>
+void filter_wav_pipelined(const WavReader& reader, WavWriter& writer, const std::vector<Band>& bands, int roll,
+                          std::size_t fft_size, std::size_t workers, std::size_t depth=0, Stats* stats=nullptr) {
+    if (fft_size < 4 || fft_size % 2) {
+        throw std::invalid_argument("Block FFT size must be even and at least 4");
+    }
+    if (writer.frames() != reader.frames() || writer.channels() != reader.channels()) {
+        throw std::invalid_argument("Output does not match the input");
+    }
+    workers = std::max<std::size_t>(1, workers);
+    depth = depth ? std::max<std::size_t>(2, depth) : 4 * workers;
+
+    // A buffer holds consecutive blocks of every channel, enough signals to fill the lanes of batched transforms.
+    // Signal s = block * channels + channel of a buffer is interleaved by batch, sample i at [i * lanes + s].
+    constexpr std::size_t min_lanes = 8;
+    const std::size_t frames = reader.frames(), channels = reader.channels();
+    const std::size_t hop = fft_size / 2, delay = fft_size / 4, bins = hop + 1;
+    const std::size_t group = (min_lanes + channels - 1) / channels, lanes = group * channels;
+    const std::size_t blocks = (frames + delay + hop - 1) / hop, groups = (blocks + group - 1) / group;
+    const auto plan = get_batch_real_plan<T>(fft_size);
+    std::vector<T> kernel_re(bins), kernel_im(bins);
+    {
+        const auto kernel = details::block_kernel<T>(reader.sample_rate(), bands, roll, fft_size);
+        for (std::size_t k = 0; k < bins; k++) {
+            kernel_re[k] = kernel[k].real();
+            kernel_im[k] = kernel[k].imag();
+        }
+    }
+
+    struct Buffer {
+        std::size_t group = 0;
+        T* samples = nullptr;
+    };
+    constexpr std::size_t end_of_input = std::numeric_limits<std::size_t>::max();
+    std::vector<T> buffers(depth * lanes * fft_size);
+    BoundedQueue<T*> free_buffers(depth);
+    BoundedQueue<Buffer> decoded(depth + workers), filtered(depth);
+    for (std::size_t i = 0; i < depth; i++) {
+        free_buffers.push(buffers.data() + i * lanes * fft_size);
+    }
+
+    // The first error of any stage, the stages keep passing buffers on so the others finish
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    const auto record_error = [&] {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) error = std::current_exception();
+    };
+
+    Stats::Scope scope(stats, "block_filter");
+    std::thread decoder([&] {
+        std::vector<T> block(hop);
+        for (std::size_t g = 0; g < groups; g++) {
+            T* samples = free_buffers.pop();
+            std::fill(samples, samples + lanes * fft_size, 0);
+            for (std::size_t s = 0; s < lanes; s++) {
+                const std::size_t first = std::min(frames, (g * group + s / channels) * hop);
+                const std::size_t count = std::min(hop, frames - first);
+                try {
+                    reader.read(s % channels, first, count, block.data());
+                } catch (...) {
+                    record_error();
+                    continue;
+                }
+                for (std::size_t i = 0; i < count; i++) {
+                    samples[i * lanes + s] = block[i];
+                }
+            }
+            decoded.push({g, samples});
+        }
+        for (std::size_t i = 0; i < workers; i++) {
+            decoded.push({end_of_input, nullptr});
+        }
+    });
+
+    std::vector<std::thread> transformers;
+    for (std::size_t i = 0; i < workers; i++) {
+        transformers.emplace_back([&] {
+            std::vector<T> spectrum_re(bins * lanes), spectrum_im(bins * lanes);
+            for (Buffer buffer = decoded.pop(); buffer.group != end_of_input; buffer = decoded.pop()) {
+                try {
+                    plan->forward(buffer.samples, spectrum_re.data(), spectrum_im.data(), lanes);
+                    for (std::size_t k = 0; k < bins; k++) {
+                        T* re = spectrum_re.data() + k * lanes;
+                        T* im = spectrum_im.data() + k * lanes;
+                        for (std::size_t s = 0; s < lanes; s++) {
+                            const T r = re[s];
+                            re[s] = r * kernel_re[k] - im[s] * kernel_im[k];
+                            im[s] = r * kernel_im[k] + im[s] * kernel_re[k];
+                        }
+                    }
+                    plan->inverse(spectrum_re.data(), spectrum_im.data(), buffer.samples, lanes);
+                } catch (...) {
+                    record_error();
+                }
+                filtered.push(buffer);
+            }
+        });
+    }
+
+    // Buffers finish out of order, each waits in the slot of its group until the groups before it are written.
+    // At most 'depth' buffers are in flight, so their slots never collide.
+    std::vector<T*> finished(depth, nullptr);
+    std::vector<T> block(fft_size), tails(channels * hop, 0);
+    for (std::size_t next = 0; next < groups;) {
+        const Buffer buffer = filtered.pop();
+        finished[buffer.group % depth] = buffer.samples;
+
+        while (next < groups && finished[next % depth]) {
+            T* samples = std::exchange(finished[next % depth], nullptr);
+            for (std::size_t b = next * group; b < std::min(blocks, (next + 1) * group); b++) {
+                // Block b covers output samples [b * hop - delay, b * hop - delay + hop)
+                const std::size_t drop = b * hop < delay ? delay - b * hop : 0;
+                const std::size_t first = std::min(frames, b * hop + drop - delay);
+                const std::size_t count = std::min(hop - drop, frames - first);
+                for (std::size_t c = 0; c < channels; c++) {
+                    const std::size_t s = (b - next * group) * channels + c;
+                    T* tail = tails.data() + c * hop;
+                    for (std::size_t i = 0; i < hop; i++) {
+                        block[i] = samples[i * lanes + s] + tail[i];
+                    }
+                    for (std::size_t i = hop; i < fft_size; i++) {
+                        tail[i - hop] = samples[i * lanes + s];
+                    }
+                    try {
+                        writer.write(c, first, count, block.data() + drop);
+                    } catch (...) {
+                        record_error();
+                    }
+                }
+            }
+            free_buffers.push(samples);
+            next++;
+        }
+    }
+
+    decoder.join();
+    for (auto& transformer : transformers) {
+        transformer.join();
+    }
+    if (error) std::rethrow_exception(error);
+}
+} // Namespace ctf
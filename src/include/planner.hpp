@@ -0,0 +1,240 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <istream>
+#include <ostream>
+#include <map>
+#include <set>
+#include <tuple>
+#include <optional>
+#include <bit>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+#include "fft.hpp"
+#include "parallel.hpp"
+
+namespace ctf {
+
+// How plans without wisdom are chosen: 'estimate' takes the defaults right away,
+// 'measure' times the candidates on first use of a size, which costs time once per size & machine
+enum class PlannerMode { estimate, measure };
+
+// Algorithm & thread count for real transforms of one size
+struct PlanChoice {
+    FftAlgorithm algorithm = FftAlgorithm::radix4;
+    std::size_t threads = 1;  // 1 runs transforms on the calling thread, otherwise on the whole pool
+};
+
+// Chooses how real transforms of each size are computed. Choices are kept as "wisdom",
+// which can be saved & loaded so later runs on the same machine don't measure again.
+// Wisdom is used in both modes, without it estimate mode picks radix4 on all threads of the pool.
+class Planner {
+public:
+    explicit Planner(PlannerMode mode=PlannerMode::estimate) : planner_mode(mode) {}
+
+    PlannerMode mode() const { return planner_mode; }
+    void set_mode(PlannerMode mode) { planner_mode = mode; }
+
+    // Choice for real transforms of 'size' samples of type T, transforms may be split across 'pool'.
+    // Sizes are measured outside the lock, so other sizes are looked up & measured meanwhile,
+    // concurrent calls for a size being measured wait for its result.
+    // Inside parallel loops (see ThreadPool::in_parallel_loop) the other threads are busy, so timings would
+    // be skewed and waiting would hold a thread of the pool: unknown sizes get the estimate there, which
+    // isn't kept as wisdom. Callers choose their sizes before starting the loops.
+    template <typename T>
+    PlanChoice choose(std::size_t size, ThreadPool* pool=nullptr) {
+        const std::size_t threads = pool ? pool->size() : 1;
+        const Key key {precision_name<T>(), size, threads};
+        const bool in_loop = ThreadPool::in_parallel_loop();
+
+        {
+            std::unique_lock<std::mutex> lock(wisdom_mutex);
+            if (!in_loop) measured_changed.wait(lock, [&] { return !measuring.count(key); });
+            if (const auto known = wisdom.find(key); known != wisdom.end()) {
+                return known->second;
+            }
+            if (planner_mode == PlannerMode::estimate || in_loop) {
+                return {FftAlgorithm::radix4, threads};
+            }
+            measuring.insert(key);
+        }
+
+        std::optional<PlanChoice> choice;
+        try {
+            choice = measure<T>(size, pool);
+        } catch (...) {
+            finish_measuring(key, choice);
+            throw;
+        }
+        finish_measuring(key, choice);
+        return *choice;
+    }
+
+    // Number of choices measured since the planner was created
+    std::size_t measured() const {
+        std::lock_guard<std::mutex> lock(wisdom_mutex);
+        return measured_count;
+    }
+
+    // Writes the wisdom, one choice per line: <float|double> <size> <threads available> <algorithm> <threads>
+    void save(std::ostream& out) const {
+        std::lock_guard<std::mutex> lock(wisdom_mutex);
+        out << "# ctf wisdom\n";
+        for (const auto& [key, choice] : wisdom) {
+            const auto& [precision, size, available] = key;
+            out << precision << " " << size << " " << available << " "
+                << algorithm_name(choice.algorithm) << " " << choice.threads << "\n";
+        }
+    }
+
+    // Reads wisdom written by save, choices already known are kept. Empty lines and lines starting
+    // with '#' are skipped. Throws std::invalid_argument on bad lines.
+    void load(std::istream& in) {
+        std::lock_guard<std::mutex> lock(wisdom_mutex);
+        std::string line;
+        for (std::size_t line_number = 1; std::getline(in, line); line_number++) {
+            std::istringstream tokens(line);
+            std::string precision, algorithm;
+            std::size_t size, available, threads;
+            if (!(tokens >> precision) || precision.starts_with("#")) continue;
+
+            const auto fail = [&](const std::string& msg) {
+                throw std::invalid_argument("Wisdom line " + std::to_string(line_number) + ": " + msg);
+            };
+            if (precision != "float" && precision != "double") fail("unknown precision '" + precision + "'");
+            if (!(tokens >> size >> available >> algorithm >> threads) || size == 0 || available == 0) {
+                fail("bad choice");
+            }
+            if (threads != 1 && threads != available) fail("bad thread count");
+            const auto parsed = parse_algorithm(algorithm);
+            if (!parsed) fail("unknown algorithm '" + algorithm + "'");
+            wisdom.try_emplace({precision, size, available}, PlanChoice {*parsed, threads});
+        }
+    }
+
+private:
+    using Key = std::tuple<std::string, std::size_t, std::size_t>;  // Precision, size, threads available
+
+    // Each candidate is repeated until this many seconds have passed
+    static constexpr double min_time = 0.01;
+
+    PlannerMode planner_mode;
+    std::map<Key, PlanChoice> wisdom;
+    std::set<Key> measuring;  // Keys some thread is measuring
+    std::size_t measured_count = 0;
+    mutable std::mutex wisdom_mutex;
+    std::condition_variable measured_changed;
+
+    // Keeps the measured choice, if any, and wakes the threads waiting for it
+    void finish_measuring(const Key& key, const std::optional<PlanChoice>& choice) {
+        {
+            std::lock_guard<std::mutex> lock(wisdom_mutex);
+            if (choice) {
+                wisdom[key] = *choice;
+                measured_count++;
+            }
+            measuring.erase(key);
+        }
+        measured_changed.notify_all();
+    }
+
+    template <typename T>
+    static std::string precision_name() {
+        return sizeof(T) == sizeof(float) ? "float" : "double";
+    }
+
+    static std::optional<FftAlgorithm> parse_algorithm(const std::string& name) {
+        for (auto algorithm : {FftAlgorithm::radix4, FftAlgorithm::radix2, FftAlgorithm::split_radix,
+                               FftAlgorithm::four_step}) {
+            if (name == algorithm_name(algorithm)) return algorithm;
+        }
+        return std::nullopt;
+    }
+
+    // Algorithms that compute transforms of 'half' differently, the others fall back to radix4
+    static std::vector<FftAlgorithm> candidates(std::size_t half) {
+        std::vector<FftAlgorithm> algorithms {FftAlgorithm::radix4};
+        std::size_t rest = half;
+        for (std::size_t factor : {2, 3, 5}) {
+            while (rest % factor == 0) rest /= factor;
+        }
+        if (rest != 1 || half <= details::max_codelet_size) return algorithms;
+
+        if (half % 4 == 0) algorithms.push_back(FftAlgorithm::radix2);
+        if (std::has_single_bit(half)) algorithms.push_back(FftAlgorithm::split_radix);
+        algorithms.push_back(FftAlgorithm::four_step);
+        return algorithms;
+    }
+
+    // Time of the fastest of forward transforms repeated until 'min_time' has passed
+    template <typename T>
+    static double time_forward(const BasicRealFftPlan<T>& plan, const std::vector<T>& samples,
+                               std::vector<std::complex<T>>& spectrum, ThreadPool* pool) {
+        double best = INFINITY, total = 0;
+        while (total < min_time) {
+            const auto start = std::chrono::steady_clock::now();
+            plan.forward(samples.data(), spectrum.data(), pool);
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            best = std::min(best, seconds);
+            total += seconds;
+        }
+        return best;
+    }
+
+    // Times forward transforms of every candidate algorithm on the pool, then the fastest one on a single thread.
+    // Long transforms run once per candidate, so measuring costs a handful of transforms. Candidates are
+    // built outside the plan cache one at a time, so long sizes hold a single plan's tables. Only the winner
+    // is cached for the filtering, rebuilt if a later candidate was timed after it.
+    template <typename T>
+    static PlanChoice measure(std::size_t size, ThreadPool* pool) {
+        std::vector<T> samples(size);
+        for (std::size_t i = 0; i < size; i++) {
+            samples[i] = (T)std::sin(0.1 * (double)i) + (T)(i % 7) / 7;
+        }
+        std::vector<std::complex<T>> spectrum(size / 2 + 1);
+        const std::size_t threads = pool ? pool->size() : 1;
+        if (threads == 1) pool = nullptr;
+
+        PlanChoice best {FftAlgorithm::radix4, threads};
+        std::shared_ptr<const BasicRealFftPlan<T>> plan;
+        double best_seconds = INFINITY;
+        for (auto algorithm : candidates(size / 2)) {
+            // Untimed first run, which grows the scratch memory all candidates share
+            const bool first = !plan;
+            plan.reset();
+            plan = std::make_shared<const BasicRealFftPlan<T>>(size, algorithm);
+            if (first) plan->forward(samples.data(), spectrum.data(), pool);
+
+            const double seconds = time_forward(*plan, samples, spectrum, pool);
+            if (seconds < best_seconds) {
+                best.algorithm = algorithm;
+                best_seconds = seconds;
+            }
+        }
+        if (plan->fft_algorithm() != best.algorithm) {
+            plan.reset();
+            plan = std::make_shared<const BasicRealFftPlan<T>>(size, best.algorithm);
+        }
+        if (pool && time_forward(*plan, samples, spectrum, nullptr) < best_seconds) {
+            best.threads = 1;
+        }
+        details::plan_cache<BasicRealFftPlan<T>, std::size_t, FftAlgorithm>()
+            .insert({size, best.algorithm}, plan, plan->bytes());
+        return best;
+    }
+};
+
+// Planner used by ctf::filter_padded and the programs built on it
+inline Planner& planner() {
+    static Planner shared;
+    return shared;
+}
+} // Namespace ctf
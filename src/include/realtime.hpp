@@ -0,0 +1,134 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <chrono>
+#include <optional>
+#include <algorithm>
+#include <stdexcept>
+
+#include "filter.hpp"
+#include "stream.hpp"
+#include "wav.hpp"
+#include "stats.hpp"
+#include "iir.hpp"
+
+namespace ctf {
+
+// Outcome of filtering a stream
+struct StreamReport {
+    std::size_t frames = 0;          // Input frames filtered
+    std::size_t block_frames = 0;    // Frames buffered before a block is filtered
+    std::size_t delay_frames = 0;    // Delay of the linear phase filter
+    double processing_seconds = 0;   // Time spent filtering, not waiting for input or output
+    double max_block_seconds = 0;    // Longest time to filter one block
+    std::optional<std::size_t> allocated_bytes; // Allocated while filtering, if allocations are counted
+
+    // Time from a sample arriving to its filtered sample being written
+    std::size_t latency_frames() const { return block_frames + delay_frames; }
+
+    // Processing time per second of audio, below 1 is faster than real time
+    double real_time_factor(uint32_t sample_rate) const {
+        return frames ? processing_seconds * sample_rate / frames : 0;
+    }
+};
+
+namespace details {
+
+// Reads interleaved samples of 'format' from 'in' 'block_size' frames at a time until the end of the input,
+// filters every channel of a block in place with filter(channel, samples) and writes & flushes it to 'out'.
+// Output is aligned with input and has the same length: the first 'delay' samples of output are dropped
+// and the last ones flushed at the end of the input.
+template <typename T, typename F>
+StreamReport stream_blocks(std::FILE* in, std::FILE* out, const WavFormat& format, std::size_t block_size,
+                           std::size_t delay, F filter) {
+    const std::size_t channels = format.channels;
+    const std::size_t sample_size = details::sample_bytes(format.encoding);
+    const std::size_t frame_bytes = channels * sample_size;
+    std::vector<uint8_t> in_bytes(block_size * frame_bytes), out_bytes(block_size * frame_bytes);
+    std::vector<T> samples(block_size);
+
+    StreamReport report;
+    report.block_frames = block_size;
+    report.delay_frames = delay;
+    std::size_t skip = report.delay_frames, produced = 0;
+    bool input_left = true;
+    const std::size_t allocated_start = details::allocated_bytes();
+
+    while (input_left || produced < report.frames) {
+        std::size_t frames = 0;
+        if (input_left) {
+            const std::size_t bytes = std::fread(in_bytes.data(), 1, in_bytes.size(), in);
+            frames = bytes / frame_bytes;
+            input_left = bytes == in_bytes.size();
+        }
+        report.frames += frames;
+
+        const auto start = std::chrono::steady_clock::now();
+        for (std::size_t c = 0; c < channels; c++) {
+            details::decode(in_bytes.data() + c * sample_size, frame_bytes, block_size, format.encoding, samples.data());
+            if (frames < block_size) {
+                // Zeros past the end of the input
+                std::fill(samples.begin() + frames, samples.end(), 0);
+            }
+            filter(c, samples.data());
+            details::encode(samples.data(), block_size, format.encoding, out_bytes.data() + c * sample_size, frame_bytes);
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        report.processing_seconds += seconds;
+        report.max_block_seconds = std::max(report.max_block_seconds, seconds);
+
+        // Drop the samples of the filter's delay from the start and stop at the input length
+        const std::size_t drop = std::min(skip, block_size);
+        skip -= drop;
+        const std::size_t count = std::min(block_size - drop, report.frames - produced);
+        if (std::fwrite(out_bytes.data() + drop * frame_bytes, 1, count * frame_bytes, out) != count * frame_bytes
+            || std::fflush(out) != 0) {
+            throw std::runtime_error("Failed to write the output stream");
+        }
+        produced += count;
+    }
+    if (details::allocations_counted()) report.allocated_bytes = details::allocated_bytes() - allocated_start;
+
+    return report;
+}
+} // Namespace details
+
+// Filters interleaved samples of 'format' from 'in' to 'out' until the end of the input.
+// Input is read 'block_size' frames at a time, every block is filtered with a partitioned
+// convolution (see ctf::BasicPartitionedFilter) and written & flushed right away.
+// Output is aligned with input and has the same length: the first samples of the filter's
+// delay are dropped and the last ones flushed at the end of the input.
+template <typename T>
+StreamReport filter_stream(std::FILE* in, std::FILE* out, const WavFormat& format, const std::vector<Band>& bands,
+                           int roll, std::size_t block_size=256, std::size_t design_size=4096) {
+    if (format.channels == 0) {
+        throw std::invalid_argument("Stream must have at least one channel");
+    }
+    std::vector<BasicPartitionedFilter<T>> filters;
+    for (std::size_t c = 0; c < format.channels; c++) {
+        filters.emplace_back(format.sample_rate, bands, roll, block_size, design_size);
+    }
+    return details::stream_blocks<T>(in, out, format, block_size, filters[0].delay(), [&](std::size_t c, T* samples) {
+        filters[c].process(samples, samples);
+    });
+}
+
+// Same with the causal sections of an IIR design (see ctf::causal_sections) instead of a partitioned convolution.
+// The sections add no delay beyond the block, but shift the phase where the FFT filters don't.
+template <typename T>
+StreamReport filter_stream_iir(std::FILE* in, std::FILE* out, const WavFormat& format, const IirDesign& design,
+                               std::size_t block_size=256) {
+    if (format.channels == 0) {
+        throw std::invalid_argument("Stream must have at least one channel");
+    }
+    if (block_size == 0) {
+        throw std::invalid_argument("Block size must be positive");
+    }
+    std::vector<BiquadCascade> cascades(format.channels, BiquadCascade(causal_sections(design)));
+    return details::stream_blocks<T>(in, out, format, block_size, 0, [&](std::size_t c, T* samples) {
+        cascades[c].process(samples, block_size);
+    });
+}
+} // Namespace ctf
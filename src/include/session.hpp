@@ -0,0 +1,138 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include "filter.hpp"
+#include "stream.hpp"
+
+namespace ctf {
+
+// Long-lived filter of interleaved clips for embedding in services: samples are pushed in buffers of any size
+// and filtered samples pulled as they become ready. Every channel runs through a partitioned convolution
+// (see ctf::BasicPartitionedFilter) in blocks of 'block_size' frames. Output is aligned with the input,
+// the filter's delay is dropped, and finish() flushes the rest of a clip so it comes out as long as it went in.
+// The filter spectra, transform plans & buffers are kept from clip to clip, once the buffers have grown
+// to the largest push & pull sizes filtering a clip doesn't allocate.
+template <typename T>
+class BasicFilterSession {
+public:
+    BasicFilterSession(uint32_t sample_rate, std::size_t channels, const std::vector<Band>& bands, int roll,
+                       std::size_t block_size=256, std::size_t design_size=4096)
+        : channel_count(channels), hop(block_size) {
+        if (channels == 0) {
+            throw std::invalid_argument("Session must have at least one channel");
+        }
+        for (const auto& band : bands) {
+            details::check_band(band, sample_rate, roll);
+        }
+        for (std::size_t c = 0; c < channels; c++) {
+            filters.emplace_back(sample_rate, bands, roll, block_size, design_size);
+        }
+        filter_delay = filters[0].delay();
+        skip = filter_delay;
+        input.resize(channels * hop);
+        block.resize(hop);
+        output.reserve(channels * hop);
+    }
+
+    std::size_t channels() const { return channel_count; }
+    std::size_t block_size() const { return hop; }
+
+    // Frames of a clip that must be pushed before its first filtered frame is ready
+    std::size_t latency() const { return filter_delay + hop; }
+
+    // Filters 'frames' interleaved frames, the filtered frames become ready block by block
+    template <typename S>
+    void push(const S* samples, std::size_t frames) {
+        while (frames > 0) {
+            const std::size_t count = std::min(frames, hop - pending);
+            for (std::size_t i = 0; i < count; i++) {
+                for (std::size_t c = 0; c < channel_count; c++) {
+                    input[c * hop + pending + i] = (T)samples[i * channel_count + c];
+                }
+            }
+            samples += count * channel_count;
+            frames -= count;
+            pending += count;
+            consumed += count;
+            if (pending == hop) run_block();
+        }
+    }
+
+    // Ends the clip: the rest of its frames become ready and the next push starts a new clip
+    void finish() {
+        while (produced < consumed) {
+            // Zeros past the end of the clip
+            for (std::size_t c = 0; c < channel_count; c++) {
+                std::fill(input.begin() + c * hop + pending, input.begin() + (c + 1) * hop, 0);
+            }
+            pending = hop;
+            run_block();
+        }
+        restart();
+    }
+
+    // Number of filtered frames ready to pull
+    std::size_t available() const { return (output.size() - read) / channel_count; }
+
+    // Moves up to 'frames' ready frames to 'samples', returns the number of frames moved
+    template <typename S>
+    std::size_t pull(S* samples, std::size_t frames) {
+        frames = std::min(frames, available());
+        const std::size_t count = frames * channel_count;
+        std::transform(output.begin() + read, output.begin() + read + count, samples, [](T v) { return (S)v; });
+        read += count;
+        if (read == output.size()) {
+            output.clear();
+            read = 0;
+        }
+        return frames;
+    }
+
+    // Drops the clip in progress and any frames not pulled yet
+    void reset() {
+        restart();
+        output.clear();
+        read = 0;
+    }
+
+private:
+    std::size_t channel_count, hop, filter_delay, skip;
+    std::vector<BasicPartitionedFilter<T>> filters;
+    std::vector<T> input, block;  // Input of the current block channel by channel, & one filtered channel
+    std::vector<T> output;        // Filtered interleaved samples, pulled from 'read' on
+    std::size_t read = 0, pending = 0, consumed = 0, produced = 0;
+
+    void restart() {
+        for (auto& filter : filters) filter.reset();
+        skip = filter_delay;
+        pending = consumed = produced = 0;
+    }
+
+    void run_block() {
+        // Drop the samples of the filter's delay from the start and stop at the input length
+        const std::size_t drop = std::min(skip, hop);
+        const std::size_t count = std::min(hop - drop, consumed - produced);
+        skip -= drop;
+
+        // Pulled samples are moved out of the way before the output grows
+        if (read > 0 && output.size() + count * channel_count > output.capacity()) {
+            output.erase(output.begin(), output.begin() + read);
+            read = 0;
+        }
+        const std::size_t first = output.size();
+        output.resize(first + count * channel_count);
+        for (std::size_t c = 0; c < channel_count; c++) {
+            filters[c].process(&input[c * hop], block.data());
+            for (std::size_t i = 0; i < count; i++) {
+                output[first + i * channel_count + c] = block[drop + i];
+            }
+        }
+        produced += count;
+        pending = 0;
+    }
+};
+using FilterSession = BasicFilterSession<double>;
+} // Namespace ctf
@@ -0,0 +1,458 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <algorithm>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CTF_SIMD_X86
+#endif
+
+// Vector types wider than the baseline instruction set are only used inside functions
+// compiled for the wider set, so the ABI notes about passing them are not relevant
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+namespace ctf {
+namespace simd {
+
+// Instruction sets the split complex butterflies are compiled for
+enum class Isa { scalar, sse2, avx2 };
+
+inline const char* isa_name(Isa isa) {
+    switch (isa) {
+        case Isa::avx2: return "avx2";
+        case Isa::sse2: return "sse2";
+        default: return "scalar";
+    }
+}
+
+// Best instruction set the CPU supports, detected with CPUID on first call
+inline Isa supported_isa() {
+#ifdef CTF_SIMD_X86
+    static const Isa best = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ? Isa::avx2
+                          : __builtin_cpu_supports("sse2") ? Isa::sse2
+                          : Isa::scalar;
+    return best;
+#else
+    return Isa::scalar;
+#endif
+}
+
+namespace details {
+
+inline Isa& selected_isa() {
+    static Isa isa = supported_isa();
+    return isa;
+}
+
+// GCC vector extension type of 'width' values of type T, a plain T when width is 1.
+// Operators on these compile to the widest instructions enabled for the calling function.
+template <typename T, int width>
+struct vector_of {
+    typedef T type __attribute__((vector_size(width * sizeof(T))));
+};
+template <typename T>
+struct vector_of<T, 1> {
+    using type = T;
+};
+
+template <typename V, typename T>
+[[gnu::always_inline]] inline V load(const T* p) {
+    V v;
+    std::memcpy(&v, p, sizeof(V));
+    return v;
+}
+
+template <typename T, typename V>
+[[gnu::always_inline]] inline void store(T* p, const V v) {
+    std::memcpy(p, &v, sizeof(V));
+}
+
+// Multiplies by -i in forward and by i in inverse transforms
+template <bool inverse, typename V>
+[[gnu::always_inline]] inline void rotate(V& re, V& im) {
+    const V r = re;
+    if (inverse) {
+        re = -im;
+        im = r;
+    } else {
+        re = im;
+        im = -r;
+    }
+}
+
+// DFT of 'radix' values in place, T is the element type of V
+template <bool inverse, std::size_t radix, typename T, typename V>
+[[gnu::always_inline]] inline void butterfly(V* re, V* im) {
+    if constexpr (radix == 2) {
+        const V r0 = re[0], i0 = im[0];
+        re[0] = r0 + re[1];
+        im[0] = i0 + im[1];
+        re[1] = r0 - re[1];
+        im[1] = i0 - im[1];
+    } else if constexpr (radix == 4) {
+        const V sr02 = re[0] + re[2], si02 = im[0] + im[2];
+        const V dr02 = re[0] - re[2], di02 = im[0] - im[2];
+        const V sr13 = re[1] + re[3], si13 = im[1] + im[3];
+        V dr13 = re[1] - re[3], di13 = im[1] - im[3];
+        rotate<inverse>(dr13, di13);
+        re[0] = sr02 + sr13;
+        im[0] = si02 + si13;
+        re[1] = dr02 + dr13;
+        im[1] = di02 + di13;
+        re[2] = sr02 - sr13;
+        im[2] = si02 - si13;
+        re[3] = dr02 - dr13;
+        im[3] = di02 - di13;
+    } else if constexpr (radix == 3) {
+        constexpr T s = 0.86602540378443864676;  // sin(2pi/3)
+        const V sr = re[1] + re[2], si = im[1] + im[2];
+        const V mr = re[0] - (T)0.5 * sr, mi = im[0] - (T)0.5 * si;
+        V rr = (re[1] - re[2]) * s, ri = (im[1] - im[2]) * s;
+        rotate<inverse>(rr, ri);
+        re[0] = re[0] + sr;
+        im[0] = im[0] + si;
+        re[1] = mr + rr;
+        im[1] = mi + ri;
+        re[2] = mr - rr;
+        im[2] = mi - ri;
+    } else {
+        constexpr T c1 = 0.30901699437494742410;   // cos(2pi/5)
+        constexpr T c2 = -0.80901699437494742410;  // cos(4pi/5)
+        constexpr T s1 = 0.95105651629515357212;   // sin(2pi/5)
+        constexpr T s2 = 0.58778525229247312917;   // sin(4pi/5)
+        const V sr14 = re[1] + re[4], si14 = im[1] + im[4];
+        const V dr14 = re[1] - re[4], di14 = im[1] - im[4];
+        const V sr23 = re[2] + re[3], si23 = im[2] + im[3];
+        const V dr23 = re[2] - re[3], di23 = im[2] - im[3];
+        const V r1r = re[0] + c1 * sr14 + c2 * sr23, r1i = im[0] + c1 * si14 + c2 * si23;
+        const V r2r = re[0] + c2 * sr14 + c1 * sr23, r2i = im[0] + c2 * si14 + c1 * si23;
+        V i1r = s1 * dr14 + s2 * dr23, i1i = s1 * di14 + s2 * di23;
+        V i2r = s2 * dr14 - s1 * dr23, i2i = s2 * di14 - s1 * di23;
+        rotate<inverse>(i1r, i1i);
+        rotate<inverse>(i2r, i2i);
+        re[0] = re[0] + sr14 + sr23;
+        im[0] = im[0] + si14 + si23;
+        re[1] = r1r + i1r;
+        im[1] = r1i + i1i;
+        re[4] = r1r - i1r;
+        im[4] = r1i - i1i;
+        re[2] = r2r + i2r;
+        im[2] = r2i + i2i;
+        re[3] = r2r - i2r;
+        im[3] = r2i - i2i;
+    }
+}
+
+// Butterflies of one mixed radix stage over split complex data for k in [k_begin, k_end),
+// 'width' butterflies at a time and the rest one by one.
+// Twiddles of input j (1 <= j < radix) are stored contiguously from (j - 1) * span.
+template <typename T, int width, bool inverse, std::size_t radix>
+[[gnu::always_inline]] inline void split_butterflies(T* re, T* im, std::size_t n, std::size_t span,
+                                                     std::size_t k_begin, std::size_t k_end,
+                                                     const T* wr, const T* wi) {
+    using V = typename vector_of<T, width>::type;
+
+    for (std::size_t base = 0; base < n; base += radix * span) {
+        T* xr = re + base;
+        T* xi = im + base;
+        for (std::size_t k = k_begin; k + width <= k_end; k += width) {
+            V ar[radix], ai[radix];
+            ar[0] = load<V>(xr + k);
+            ai[0] = load<V>(xi + k);
+            for (std::size_t j = 1; j < radix; j++) {
+                const V r = load<V>(xr + k + j * span);
+                const V i = load<V>(xi + k + j * span);
+                const V c = load<V>(wr + (j - 1) * span + k);
+                const V s = inverse ? -load<V>(wi + (j - 1) * span + k) : load<V>(wi + (j - 1) * span + k);
+                ar[j] = r * c - i * s;
+                ai[j] = r * s + i * c;
+            }
+
+            butterfly<inverse, radix, T>(ar, ai);
+
+            for (std::size_t j = 0; j < radix; j++) {
+                store(xr + k + j * span, ar[j]);
+                store(xi + k + j * span, ai[j]);
+            }
+        }
+    }
+}
+
+template <typename T, int width, bool inverse, std::size_t radix>
+[[gnu::always_inline]] inline void split_stage(T* re, T* im, std::size_t n, std::size_t span,
+                                               std::size_t k_begin, std::size_t k_end,
+                                               const T* wr, const T* wi) {
+    const std::size_t k_vector = k_end - (k_end - k_begin) % width;
+    split_butterflies<T, width, inverse, radix>(re, im, n, span, k_begin, k_vector, wr, wi);
+    if constexpr (width > 1) {
+        split_butterflies<T, 1, inverse, radix>(re, im, n, span, k_vector, k_end, wr, wi);
+    }
+}
+
+template <typename T, bool inverse, std::size_t radix>
+void stage_scalar(T* re, T* im, std::size_t n, std::size_t span, std::size_t k_begin, std::size_t k_end,
+                  const T* wr, const T* wi) {
+    split_stage<T, 1, inverse, radix>(re, im, n, span, k_begin, k_end, wr, wi);
+}
+
+#ifdef CTF_SIMD_X86
+template <typename T, bool inverse, std::size_t radix>
+void stage_sse2(T* re, T* im, std::size_t n, std::size_t span, std::size_t k_begin, std::size_t k_end,
+                const T* wr, const T* wi) {
+    split_stage<T, 16 / sizeof(T), inverse, radix>(re, im, n, span, k_begin, k_end, wr, wi);
+}
+
+template <typename T, bool inverse, std::size_t radix>
+__attribute__((target("avx2,fma")))
+void stage_avx2(T* re, T* im, std::size_t n, std::size_t span, std::size_t k_begin, std::size_t k_end,
+                const T* wr, const T* wi) {
+    split_stage<T, 32 / sizeof(T), inverse, radix>(re, im, n, span, k_begin, k_end, wr, wi);
+}
+#endif
+
+// Arguments: re, im, n, span, k_begin, k_end, twiddles re, twiddles im
+template <typename T>
+using StageKernel = void (*)(T*, T*, std::size_t, std::size_t, std::size_t, std::size_t, const T*, const T*);
+
+template <typename T, bool inverse, std::size_t radix>
+StageKernel<T> stage_kernel(Isa isa) {
+#ifdef CTF_SIMD_X86
+    if (isa == Isa::avx2) return stage_avx2<T, inverse, radix>;
+    if (isa == Isa::sse2) return stage_sse2<T, inverse, radix>;
+#endif
+    return stage_scalar<T, inverse, radix>;
+}
+
+// Butterflies of one mixed radix stage over 'batch' split complex transforms interleaved by batch,
+// for lanes [lane_begin, lane_end) of every position. All lanes of a position share its twiddles,
+// so 'width' transforms run at a time with one SIMD lane each and the rest one by one.
+// Twiddles are laid out as in split_butterflies.
+template <typename T, int width, bool inverse, std::size_t radix>
+[[gnu::always_inline]] inline void batch_butterflies(T* re, T* im, std::size_t n, std::size_t span, std::size_t batch,
+                                                     std::size_t lane_begin, std::size_t lane_end,
+                                                     const T* wr, const T* wi) {
+    using V = typename vector_of<T, width>::type;
+
+    for (std::size_t base = 0; base < n; base += radix * span) {
+        for (std::size_t k = 0; k < span; k++) {
+            T c[radix], s[radix];
+            for (std::size_t j = 1; j < radix; j++) {
+                c[j] = wr[(j - 1) * span + k];
+                s[j] = inverse ? -wi[(j - 1) * span + k] : wi[(j - 1) * span + k];
+            }
+            T* xr = re + (base + k) * batch;
+            T* xi = im + (base + k) * batch;
+            const std::size_t stride = span * batch;
+
+            for (std::size_t lane = lane_begin; lane + width <= lane_end; lane += width) {
+                V ar[radix], ai[radix];
+                ar[0] = load<V>(xr + lane);
+                ai[0] = load<V>(xi + lane);
+                for (std::size_t j = 1; j < radix; j++) {
+                    const V r = load<V>(xr + lane + j * stride);
+                    const V i = load<V>(xi + lane + j * stride);
+                    ar[j] = r * c[j] - i * s[j];
+                    ai[j] = r * s[j] + i * c[j];
+                }
+
+                butterfly<inverse, radix, T>(ar, ai);
+
+                for (std::size_t j = 0; j < radix; j++) {
+                    store(xr + lane + j * stride, ar[j]);
+                    store(xi + lane + j * stride, ai[j]);
+                }
+            }
+        }
+    }
+}
+
+template <typename T, int width, bool inverse, std::size_t radix>
+[[gnu::always_inline]] inline void batch_stage(T* re, T* im, std::size_t n, std::size_t span, std::size_t batch,
+                                               std::size_t lane_begin, std::size_t lane_end,
+                                               const T* wr, const T* wi) {
+    // The lanes left over run on narrower vectors, so small batches still use SIMD
+    const std::size_t lane_vector = lane_end - (lane_end - lane_begin) % width;
+    batch_butterflies<T, width, inverse, radix>(re, im, n, span, batch, lane_begin, lane_vector, wr, wi);
+    if constexpr (width > 1) {
+        if (lane_vector < lane_end) {
+            batch_stage<T, width / 2, inverse, radix>(re, im, n, span, batch, lane_vector, lane_end, wr, wi);
+        }
+    }
+}
+
+template <typename T, bool inverse, std::size_t radix>
+void batch_scalar(T* re, T* im, std::size_t n, std::size_t span, std::size_t batch,
+                  std::size_t lane_begin, std::size_t lane_end, const T* wr, const T* wi) {
+    batch_stage<T, 1, inverse, radix>(re, im, n, span, batch, lane_begin, lane_end, wr, wi);
+}
+
+#ifdef CTF_SIMD_X86
+template <typename T, bool inverse, std::size_t radix>
+void batch_sse2(T* re, T* im, std::size_t n, std::size_t span, std::size_t batch,
+                std::size_t lane_begin, std::size_t lane_end, const T* wr, const T* wi) {
+    batch_stage<T, 16 / sizeof(T), inverse, radix>(re, im, n, span, batch, lane_begin, lane_end, wr, wi);
+}
+
+template <typename T, bool inverse, std::size_t radix>
+__attribute__((target("avx2,fma")))
+void batch_avx2(T* re, T* im, std::size_t n, std::size_t span, std::size_t batch,
+                std::size_t lane_begin, std::size_t lane_end, const T* wr, const T* wi) {
+    batch_stage<T, 32 / sizeof(T), inverse, radix>(re, im, n, span, batch, lane_begin, lane_end, wr, wi);
+}
+#endif
+
+// Arguments: re, im, n, span, batch, first lane, end of lanes, twiddles re, twiddles im
+template <typename T>
+using BatchKernel = void (*)(T*, T*, std::size_t, std::size_t, std::size_t, std::size_t, std::size_t,
+                             const T*, const T*);
+
+template <typename T, bool inverse, std::size_t radix>
+BatchKernel<T> batch_kernel(Isa isa) {
+#ifdef CTF_SIMD_X86
+    if (isa == Isa::avx2) return batch_avx2<T, inverse, radix>;
+    if (isa == Isa::sse2) return batch_sse2<T, inverse, radix>;
+#endif
+    return batch_scalar<T, inverse, radix>;
+}
+
+// Bins k & h-k for k in [1, h/2] of 'batch' spectra of 2h real samples from the packed transforms of size h,
+// or the packed transforms from the spectra if 'pack' (see unpack_bins & pack_bins in fft.hpp),
+// for lanes [lane_begin, lane_end). Rows of 'in' & 'out' are 'batch' values apart and may be the same.
+// 'twiddles' holds exp(-2 pi i k / 2h) as pairs of real & imaginary parts.
+template <typename T, int width, bool pack>
+[[gnu::always_inline]] inline void batch_bins(const T* in_re, const T* in_im, T* out_re, T* out_im,
+                                              std::size_t h, std::size_t batch, std::size_t lane_begin,
+                                              std::size_t lane_end, const T* twiddles) {
+    using V = typename vector_of<T, width>::type;
+
+    for (std::size_t k = 1; k <= h / 2; k++) {
+        const T wr = twiddles[2 * k], wi = twiddles[2 * k + 1];
+        const std::size_t row = k * batch, mirror = (h - k) * batch;
+        for (std::size_t lane = lane_begin; lane + width <= lane_end; lane += width) {
+            const V a = load<V>(in_re + row + lane), b = load<V>(in_im + row + lane);
+            const V c = load<V>(in_re + mirror + lane), d = load<V>(in_im + mirror + lane);
+            const V even_r = (a + c) * (T)0.5, even_i = (b - d) * (T)0.5;
+            V rot_r, rot_i;
+            if (pack) {
+                // i (x_k - conj(x_h-k)) / 2 * conj(w)
+                const V t_r = (a - c) * (T)0.5, t_i = (b + d) * (T)0.5;
+                rot_r = t_r * wi - t_i * wr;
+                rot_i = t_r * wr + t_i * wi;
+            } else {
+                // w (z_k - conj(z_h-k)) / 2i
+                const V o_r = (b + d) * (T)0.5, o_i = (c - a) * (T)0.5;
+                rot_r = o_r * wr - o_i * wi;
+                rot_i = o_i * wr + o_r * wi;
+            }
+            store(out_re + row + lane, even_r + rot_r);
+            store(out_im + row + lane, even_i + rot_i);
+            store(out_re + mirror + lane, even_r - rot_r);
+            store(out_im + mirror + lane, rot_i - even_i);
+        }
+    }
+}
+
+template <typename T, int width, bool pack>
+[[gnu::always_inline]] inline void batch_bins_stage(const T* in_re, const T* in_im, T* out_re, T* out_im,
+                                                    std::size_t h, std::size_t batch, std::size_t lane_begin,
+                                                    std::size_t lane_end, const T* twiddles) {
+    const std::size_t lane_vector = lane_end - (lane_end - lane_begin) % width;
+    batch_bins<T, width, pack>(in_re, in_im, out_re, out_im, h, batch, lane_begin, lane_vector, twiddles);
+    if constexpr (width > 1) {
+        if (lane_vector < lane_end) {
+            batch_bins_stage<T, width / 2, pack>(in_re, in_im, out_re, out_im, h, batch, lane_vector, lane_end,
+                                                 twiddles);
+        }
+    }
+}
+
+template <typename T, bool pack>
+void bins_scalar(const T* in_re, const T* in_im, T* out_re, T* out_im, std::size_t h, std::size_t batch,
+                 std::size_t lane_begin, std::size_t lane_end, const T* twiddles) {
+    batch_bins_stage<T, 1, pack>(in_re, in_im, out_re, out_im, h, batch, lane_begin, lane_end, twiddles);
+}
+
+#ifdef CTF_SIMD_X86
+template <typename T, bool pack>
+void bins_sse2(const T* in_re, const T* in_im, T* out_re, T* out_im, std::size_t h, std::size_t batch,
+               std::size_t lane_begin, std::size_t lane_end, const T* twiddles) {
+    batch_bins_stage<T, 16 / sizeof(T), pack>(in_re, in_im, out_re, out_im, h, batch, lane_begin, lane_end,
+                                              twiddles);
+}
+
+template <typename T, bool pack>
+__attribute__((target("avx2,fma")))
+void bins_avx2(const T* in_re, const T* in_im, T* out_re, T* out_im, std::size_t h, std::size_t batch,
+               std::size_t lane_begin, std::size_t lane_end, const T* twiddles) {
+    batch_bins_stage<T, 32 / sizeof(T), pack>(in_re, in_im, out_re, out_im, h, batch, lane_begin, lane_end,
+                                              twiddles);
+}
+#endif
+
+// Arguments: in re, in im, out re, out im, h, batch, first lane, end of lanes, twiddles
+template <typename T>
+using BinsKernel = void (*)(const T*, const T*, T*, T*, std::size_t, std::size_t, std::size_t, std::size_t,
+                            const T*);
+
+template <typename T, bool pack>
+BinsKernel<T> bins_kernel(Isa isa) {
+#ifdef CTF_SIMD_X86
+    if (isa == Isa::avx2) return bins_avx2<T, pack>;
+    if (isa == Isa::sse2) return bins_sse2<T, pack>;
+#endif
+    return bins_scalar<T, pack>;
+}
+} // namespace details
+
+// Instruction set used by the split complex transforms
+inline Isa active_isa() {
+    return details::selected_isa();
+}
+
+// Selects the instruction set for split complex transforms, limited to what the CPU supports.
+// Meant for testing & benchmarking the kernels against each other.
+inline void set_isa(Isa isa) {
+    details::selected_isa() = std::min(isa, supported_isa());
+}
+
+// Returns the butterfly kernel of one split complex stage for the active instruction set.
+// A vector holds twice as many floats as doubles.
+template <typename T=double>
+details::StageKernel<T> stage_kernel(bool inverse, std::size_t radix) {
+    using namespace details;
+    const Isa isa = active_isa();
+    switch (radix) {
+        case 2: return inverse ? stage_kernel<T, true, 2>(isa) : stage_kernel<T, false, 2>(isa);
+        case 3: return inverse ? stage_kernel<T, true, 3>(isa) : stage_kernel<T, false, 3>(isa);
+        case 4: return inverse ? stage_kernel<T, true, 4>(isa) : stage_kernel<T, false, 4>(isa);
+        default: return inverse ? stage_kernel<T, true, 5>(isa) : stage_kernel<T, false, 5>(isa);
+    }
+}
+
+// Returns the butterfly kernel of one stage of batched transforms (see ctf::BasicBatchFftPlan)
+// for the active instruction set
+template <typename T=double>
+details::BatchKernel<T> batch_kernel(bool inverse, std::size_t radix) {
+    using namespace details;
+    const Isa isa = active_isa();
+    switch (radix) {
+        case 2: return inverse ? batch_kernel<T, true, 2>(isa) : batch_kernel<T, false, 2>(isa);
+        case 3: return inverse ? batch_kernel<T, true, 3>(isa) : batch_kernel<T, false, 3>(isa);
+        case 4: return inverse ? batch_kernel<T, true, 4>(isa) : batch_kernel<T, false, 4>(isa);
+        default: return inverse ? batch_kernel<T, true, 5>(isa) : batch_kernel<T, false, 5>(isa);
+    }
+}
+
+// Returns the kernel separating batched real spectra from their packed half size transforms,
+// or packing them if 'pack', for the active instruction set
+template <typename T=double>
+details::BinsKernel<T> bins_kernel(bool pack) {
+    return pack ? details::bins_kernel<T, true>(active_isa()) : details::bins_kernel<T, false>(active_isa());
+}
+} // namespace simd
+} // namespace ctf
+
+#pragma GCC diagnostic pop
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <vector>
+#include <complex>
+#include <string>
+#include <memory>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "fft.hpp"
+#include "filter.hpp"
+#include "planner.hpp"
+#include "parallel.hpp"
+#include "wav.hpp"
+#include "stats.hpp"
+#include "workspace.hpp"
+
+namespace ctf {
+namespace details {
+
+// 64-bit hash of a byte range, 8 bytes at a time. Not cryptographic, but any change to the bytes changes it.
+inline uint64_t content_hash(const uint8_t* bytes, std::size_t size, uint64_t seed=0) {
+    constexpr uint64_t k1 = 0x9e3779b97f4a7c15ull, k2 = 0xbf58476d1ce4e5b9ull;
+    uint64_t hash = (seed ^ size) * k1;
+    std::size_t pos = 0;
+    for (; pos + 8 <= size; pos += 8) {
+        uint64_t word;
+        std::memcpy(&word, bytes + pos, 8);
+        hash = ((hash ^ (word * k1)) << 27 | (hash ^ (word * k1)) >> 37) * k2;
+    }
+    for (; pos < size; pos++) {
+        hash = (hash ^ bytes[pos]) * k1;
+    }
+    hash ^= hash >> 31;
+    return hash * k2 ^ hash >> 29;
+}
+
+// Layout of spectrum cache files: a header of 'spectrum_header_size' bytes,
+// then the n/2+1 bins of every channel one channel after another
+constexpr char spectrum_magic[8] = {'C', 'T', 'F', 'S', 'P', 'E', 'C', '1'};
+constexpr std::size_t spectrum_header_size = 64;
+} // Namespace details
+
+// Forward spectra of every channel of a WAVE file, for filtering the same input many times
+// with different bands without transforming it again. Only the inverse transforms are left per filtering.
+// With a cache directory the spectra are kept in a file named after a hash of the input's format & samples,
+// the transform length & the precision, and later runs map the file instead of transforming the input.
+template <typename T>
+class BasicSpectra {
+public:
+    using C = std::complex<T>;
+
+    // Maps the spectra of 'reader' from 'cache_dir' or transforms the input, and writes the cache file
+    // if 'cache_dir' is given. A cache file that doesn't match the input is replaced.
+    BasicSpectra(const WavReader& reader, const std::string& cache_dir="", ThreadPool* pool=nullptr,
+                 Stats* stats=nullptr)
+        : n(fft_size(reader.frames())), bins(n / 2 + 1), frame_count(reader.frames()),
+          channel_count(reader.channels()), rate(reader.sample_rate()) {
+        const uint64_t format = (uint64_t)channel_count << 48 ^ (uint64_t)reader.wav_format().encoding << 40 ^ rate;
+        hash = details::content_hash(reader.raw_data(), reader.raw_size(), format);
+
+        if (cache_dir.empty()) {
+            memory.resize(channel_count * bins);
+            spectra = memory.data();
+            transform(reader, pool, stats);
+            return;
+        }
+
+        char name[64];
+        std::snprintf(name, sizeof(name), "/%016llx-%zu-%s.spectrum", (unsigned long long)hash, n,
+                      sizeof(T) == sizeof(float) ? "float" : "double");
+        cache_path = cache_dir + name;
+        if (::access(cache_path.c_str(), R_OK) == 0) {
+            Stats::Scope scope(stats, "load");
+            try {
+                file = std::make_unique<details::MappedFile>(cache_path);
+            } catch (const std::exception&) {
+                // Unreadable or empty, rebuilt below
+            }
+            if (file && valid(file->data(), file->size())) {
+                spectra = reinterpret_cast<C*>(file->data() + details::spectrum_header_size);
+                from_cache = true;
+                return;
+            }
+        }
+
+        // Built under a name of its own and renamed, so concurrent runs never map a partial file
+        const std::string temp_path = cache_path + "." + std::to_string(::getpid());
+        file = std::make_unique<details::MappedFile>(temp_path, details::spectrum_header_size
+                                                                + channel_count * bins * sizeof(C));
+        try {
+            write_header(file->data());
+            spectra = reinterpret_cast<C*>(file->data() + details::spectrum_header_size);
+            transform(reader, pool, stats);
+            if (::rename(temp_path.c_str(), cache_path.c_str()) != 0) {
+                throw std::runtime_error("Failed to write " + cache_path);
+            }
+        } catch (...) {
+            ::unlink(temp_path.c_str());
+            throw;
+        }
+    }
+
+    std::size_t size() const { return n; }
+    std::size_t channels() const { return channel_count; }
+    std::size_t frames() const { return frame_count; }
+
+    // True if the spectra were mapped from an earlier cache file
+    bool cached() const { return from_cache; }
+    const std::string& path() const { return cache_path; }
+
+    // The n/2+1 bins of a channel
+    const C* channel(std::size_t channel) const { return spectra + channel * bins; }
+
+    // Filters every channel into 'writer', which must have the frames & channels of the input.
+    // The result is the same as ctf::filter_wav without blocks.
+    void filter(WavWriter& writer, const std::vector<Band>& bands, int roll, ThreadPool& pool,
+                Stats* stats=nullptr) const {
+        if (writer.frames() != frame_count) {
+            throw std::invalid_argument("Output length does not match the spectra");
+        }
+        {
+            // Chosen before the channels keep the threads busy (see Planner::choose)
+            Stats::Scope scope(stats, "plan");
+            planner().choose<T>(n, &pool);
+        }
+        pool.parallel_for(channel_count, [&](std::size_t first, std::size_t last) {
+            thread_local Workspace workspace;
+            for (std::size_t c = first; c < last; c++) {
+                const auto [plan, response, transform_pool] = [&] {
+                    Stats::Scope scope(stats, "plan");
+                    const auto choice = planner().choose<T>(n, &pool);
+                    return std::tuple(get_real_plan<T>(n, choice.algorithm), get_filter_response(n, rate, bands, roll),
+                                      choice.threads == 1 ? nullptr : &pool);
+                }();
+                const auto series = workspace.get<C>(bins, Workspace::spectrum_slot);
+                const auto samples = workspace.get<T>(n, Workspace::transform_slot);
+                {
+                    Stats::Scope scope(stats, "band_application");
+                    response->apply(channel(c), series.data());
+                }
+                {
+                    Stats::Scope scope(stats, "inverse_fft");
+                    plan->inverse(series.data(), samples.data(), transform_pool);
+                }
+                Stats::Scope scope(stats, "save");
+                writer.write(c, 0, frame_count, samples.data());
+            }
+        }, channel_count);
+    }
+
+private:
+    std::size_t n, bins, frame_count, channel_count;
+    uint32_t rate;
+    uint64_t hash;
+    std::string cache_path;
+    std::unique_ptr<details::MappedFile> file;
+    std::vector<C> memory;
+    C* spectra = nullptr;
+    bool from_cache = false;
+
+    // Forward transforms of every channel zero padded to n samples
+    void transform(const WavReader& reader, ThreadPool* pool, Stats* stats) {
+        const auto plan = [&] {
+            Stats::Scope scope(stats, "plan");
+            return get_real_plan<T>(n, planner().choose<T>(n, pool).algorithm);
+        }();
+        std::vector<T> samples(n);
+        for (std::size_t c = 0; c < channel_count; c++) {
+            {
+                Stats::Scope scope(stats, "load");
+                reader.read(c, 0, frame_count, samples.data());
+                std::fill(samples.begin() + frame_count, samples.end(), 0);
+            }
+            Stats::Scope scope(stats, "forward_fft");
+            plan->forward(samples.data(), spectra + c * bins, pool);
+        }
+    }
+
+    void write_header(uint8_t* header) const {
+        std::memset(header, 0, details::spectrum_header_size);
+        std::memcpy(header, details::spectrum_magic, sizeof(details::spectrum_magic));
+        details::write_le<uint64_t>(header + 8, hash);
+        details::write_le<uint64_t>(header + 16, n);
+        details::write_le<uint64_t>(header + 24, frame_count);
+        details::write_le<uint32_t>(header + 32, channel_count);
+        details::write_le<uint32_t>(header + 36, rate);
+        details::write_le<uint32_t>(header + 40, sizeof(T));
+    }
+
+    bool valid(const uint8_t* bytes, std::size_t size) const {
+        uint8_t expected[details::spectrum_header_size];
+        write_header(expected);
+        return size == details::spectrum_header_size + channel_count * bins * sizeof(C)
+            && std::memcmp(bytes, expected, details::spectrum_header_size) == 0;
+    }
+};
+
+using Spectra = BasicSpectra<double>;
+} // Namespace ctf
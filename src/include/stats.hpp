@@ -0,0 +1,246 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <cstddef>
+#include <ctime>
+#include <sys/resource.h>
+
+namespace ctf {
+namespace details {
+
+// Bytes allocated with operator new, only counted when CTF_COUNT_ALLOCATIONS is defined
+inline std::atomic<std::size_t>& allocated_bytes() {
+    static std::atomic<std::size_t> bytes {0};
+    return bytes;
+}
+
+// True if the program counts allocations, set before main by the translation unit defining CTF_COUNT_ALLOCATIONS.
+// Otherwise allocated bytes are unknown, and reported as such rather than as 0.
+inline bool& allocations_counted() {
+    static bool counted = false;
+    return counted;
+}
+
+inline double process_cpu_seconds() {
+    timespec time;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+inline std::size_t peak_rss_bytes() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (std::size_t)usage.ru_maxrss * 1024;
+}
+} // Namespace details
+
+// Wall time, CPU time, allocated bytes & peak resident memory of the stages of a run.
+// CPU time & allocations are process wide, so stages running at the same time
+// (e.g. channels filtered concurrently) see each other's work. Allocated bytes stay 0 and are reported
+// as unknown unless the program counts allocations (see details::allocations_counted).
+class Stats {
+public:
+    struct Stage {
+        std::string name;
+        std::size_t calls = 0;
+        double wall_seconds = 0, cpu_seconds = 0;
+        std::size_t allocated_bytes = 0, peak_rss_bytes = 0;
+    };
+
+    // Measures a stage from construction to destruction, does nothing without stats
+    class Scope {
+    public:
+        Scope(Stats* stats, const char* name)
+            : stats(stats),
+              name(name),
+              wall_start(std::chrono::steady_clock::now()),
+              cpu_start(details::process_cpu_seconds()),
+              allocated_start(details::allocated_bytes()) {}
+
+        ~Scope() {
+            if (!stats) return;
+            const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+            stats->add(name, wall, details::process_cpu_seconds() - cpu_start,
+                       details::allocated_bytes() - allocated_start);
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        friend class Stats;
+
+        Stats* stats;
+        const char* name;
+        std::chrono::steady_clock::time_point wall_start;
+        double cpu_start;
+        std::size_t allocated_start;
+    };
+
+    Stats() : total(nullptr, "total") {}
+
+    // Stages in the order they first ran
+    std::vector<Stage> stages() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stage_list;
+    }
+
+    // Stages & the whole run since construction as JSON
+    std::string json() const {
+        std::ostringstream out;
+        out << std::setprecision(6) << "{\"stages\": [";
+        const auto list = stages();
+        for (std::size_t i = 0; i < list.size(); i++) {
+            out << (i ? ", " : "") << stage_json(list[i]);
+        }
+        out << "], \"total\": " << stage_json(run_total()) << "}";
+        return out.str();
+    }
+
+    // Stages & the whole run as an aligned table
+    std::string table() const {
+        std::ostringstream out;
+        out << std::left << std::setw(18) << "stage" << std::right << std::setw(7) << "calls" << std::setw(12) << "wall (s)"
+            << std::setw(12) << "cpu (s)" << std::setw(16) << "allocated (MB)" << std::setw(15) << "peak rss (MB)" << "\n";
+        auto list = stages();
+        list.push_back(run_total());
+        for (const auto& stage : list) {
+            out << std::left << std::setw(18) << stage.name << std::right << std::setw(7) << stage.calls
+                << std::fixed << std::setprecision(4) << std::setw(12) << stage.wall_seconds
+                << std::setw(12) << stage.cpu_seconds << std::setprecision(1) << std::setw(16);
+            if (details::allocations_counted()) {
+                out << stage.allocated_bytes / 1048576.0;
+            } else {
+                out << "n/a";
+            }
+            out << std::setw(15) << stage.peak_rss_bytes / 1048576.0 << "\n";
+        }
+        return out.str();
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::vector<Stage> stage_list;
+    Scope total;
+
+    void add(const char* name, double wall, double cpu, std::size_t allocated) {
+        const std::size_t peak = details::peak_rss_bytes();
+        std::lock_guard<std::mutex> lock(mutex);
+        auto stage = std::find_if(stage_list.begin(), stage_list.end(), [&](const Stage& s) { return s.name == name; });
+        if (stage == stage_list.end()) {
+            stage = stage_list.insert(stage_list.end(), Stage {name});
+        }
+        stage->calls++;
+        stage->wall_seconds += wall;
+        stage->cpu_seconds += cpu;
+        stage->allocated_bytes += allocated;
+        stage->peak_rss_bytes = std::max(stage->peak_rss_bytes, peak);
+    }
+
+    Stage run_total() const {
+        Stage stage {"total", 1};
+        stage.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - total.wall_start).count();
+        stage.cpu_seconds = details::process_cpu_seconds() - total.cpu_start;
+        stage.allocated_bytes = details::allocated_bytes() - total.allocated_start;
+        stage.peak_rss_bytes = details::peak_rss_bytes();
+        return stage;
+    }
+
+    static std::string stage_json(const Stage& stage) {
+        std::ostringstream out;
+        out << std::setprecision(6) << "{\"name\": \"" << stage.name << "\", \"calls\": " << stage.calls
+            << ", \"wall_seconds\": " << stage.wall_seconds << ", \"cpu_seconds\": " << stage.cpu_seconds
+            << ", \"allocated_bytes\": ";
+        if (details::allocations_counted()) {
+            out << stage.allocated_bytes;
+        } else {
+            out << "null";
+        }
+        out << ", \"peak_rss_bytes\": " << stage.peak_rss_bytes << "}";
+        return out.str();
+    }
+};
+} // Namespace ctf
+
+// Counts the bytes allocated with operator new for ctf::Stats, every form of it including the aligned ones.
+// Define CTF_COUNT_ALLOCATIONS in exactly one translation unit before including this header, or for a program
+// of one translation unit on its command line (CMake option COUNT_ALLOCATIONS). Without it nothing is replaced
+// and ctf::Stats reports allocated bytes as unknown.
+#ifdef CTF_COUNT_ALLOCATIONS
+// Replacing the global operators pairs malloc with free, which GCC can't see through
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+namespace ctf {
+namespace details {
+
+inline void* counted_alloc(std::size_t size, std::size_t alignment=0) noexcept {
+    // Only the total matters, so the counter doesn't order other memory accesses
+    allocated_bytes().fetch_add(size, std::memory_order_relaxed);
+    if (size == 0) size = 1;
+    if (alignment <= alignof(std::max_align_t)) return std::malloc(size);
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+// Marks the program as counting before main runs
+inline const bool counting_allocations = (allocations_counted() = true);
+} // Namespace details
+} // Namespace ctf
+
+void* operator new(std::size_t size) {
+    if (void* p = ctf::details::counted_alloc(size)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    if (void* p = ctf::details::counted_alloc(size, (std::size_t)alignment)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return ctf::details::counted_alloc(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return ctf::details::counted_alloc(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return ctf::details::counted_alloc(size, (std::size_t)alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return ctf::details::counted_alloc(size, (std::size_t)alignment);
+}
+
+// Every form of delete frees, malloc & aligned_alloc memory alike
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+#pragma GCC diagnostic pop
+#endif
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <vector>
+#include <complex>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+
+#include "fft.hpp"
+#include "filter.hpp"
+
+namespace ctf {
+namespace details {
+
+// Linear phase FIR filter of the band response of a transform of 'design_size', design_size/2+1 taps long.
+// The impulse response is centered at time 0, so it's shifted by design_size/4 samples
+// to make the filter causal and windowed to its length.
+template <typename T>
+std::vector<T> band_fir(uint32_t sample_rate, const std::vector<Band>& bands, int roll, std::size_t design_size) {
+    const auto plan = get_real_plan<T>(design_size);
+    const auto& gains = get_filter_response(design_size, sample_rate, bands, roll)->gains();
+    std::vector<std::complex<T>> spectrum(gains.size());
+    std::transform(gains.begin(), gains.end(), spectrum.begin(), [](double g) { return std::complex<T>(g, 0); });
+    std::vector<T> response(design_size);
+    plan->inverse(spectrum.data(), response.data());
+
+    const std::size_t taps = design_size / 2 + 1, delay = design_size / 4;
+    std::vector<T> impulse(taps);
+    for (std::size_t j = 0; j < taps; j++) {
+        const T window = 0.5 - 0.5 * std::cos(2 * M_PI * j / (taps - 1));
+        impulse[j] = response[(j + design_size - delay) % design_size] * window;
+    }
+    return impulse;
+}
+
+// Spectrum of the band FIR filter (see band_fir) zero padded to 'fft_size', for overlap-add blocks of fft_size/2
+template <typename T>
+std::vector<std::complex<T>> block_kernel(uint32_t sample_rate, const std::vector<Band>& bands, int roll,
+                                          std::size_t fft_size) {
+    auto impulse = band_fir<T>(sample_rate, bands, roll, fft_size);
+    impulse.resize(fft_size, 0);
+    std::vector<std::complex<T>> kernel(fft_size / 2 + 1);
+    get_real_plan<T>(fft_size)->forward(impulse.data(), kernel.data());
+    return kernel;
+}
+} // Namespace details
+
+// Filters a signal of any length in fixed size blocks using overlap-add.
+// The band response is turned into a linear phase FIR filter of fft_size/2+1 taps (see details::band_fir),
+// every block of fft_size/2 input samples is convolved with it in frequency domain
+// and the overlapping block tails are summed. Memory use does not depend on input length.
+template <typename T>
+class BasicBlockFilter {
+public:
+    BasicBlockFilter(uint32_t sample_rate, const std::vector<Band>& bands, int roll, std::size_t fft_size=8192)
+        : plan(get_real_plan<T>(fft_size)),
+          hop(fft_size / 2),
+          taps(fft_size / 2 + 1),
+          delay(fft_size / 4),
+          skip(fft_size / 4),
+          spectrum(fft_size / 2 + 1),
+          block(fft_size),
+          tail(fft_size / 2, 0) {
+        if (fft_size < 4) {
+            throw std::invalid_argument("Block FFT size must be at least 4");
+        }
+        input.reserve(hop);
+        kernel = details::block_kernel<T>(sample_rate, bands, roll, fft_size);
+    }
+
+    // Number of new input samples in each transformed block
+    std::size_t block_size() const { return hop; }
+
+    // Filters 'count' samples and appends the filtered samples that are ready to 'out'.
+    // Output lags behind input, call flush() after the last input to get the rest.
+    void process(const T* in, std::size_t count, std::vector<T>& out) {
+        while (count > 0) {
+            const std::size_t n = std::min(count, hop - input.size());
+            input.insert(input.end(), in, in + n);
+            in += n;
+            count -= n;
+            consumed += n;
+
+            if (input.size() == hop) run_block(out);
+        }
+    }
+
+    // Pushes the remaining samples through the filter, output length will equal input length
+    void flush(std::vector<T>& out) {
+        const std::size_t total = consumed;
+        const std::vector<T> zeros(hop, 0);
+        while (produced < total) {
+            process(zeros.data(), hop - input.size(), out);
+        }
+        out.resize(out.size() - (produced - total));
+        reset();
+    }
+
+    // Clears the filter state for a new signal
+    void reset() {
+        input.clear();
+        std::fill(tail.begin(), tail.end(), 0);
+        skip = delay;
+        consumed = 0;
+        produced = 0;
+    }
+
+private:
+    std::shared_ptr<const BasicRealFftPlan<T>> plan;
+    std::size_t hop, taps, delay, skip;
+    std::size_t consumed = 0, produced = 0;
+    std::vector<std::complex<T>> kernel, spectrum;
+    std::vector<T> block, input, tail;
+
+    void run_block(std::vector<T>& out) {
+        std::copy(input.begin(), input.end(), block.begin());
+        std::fill(block.begin() + hop, block.end(), 0);
+        input.clear();
+
+        plan->forward(block.data(), spectrum.data());
+        for (std::size_t i = 0; i < spectrum.size(); i++) {
+            spectrum[i] = details::mul(spectrum[i], kernel[i]);
+        }
+        plan->inverse(spectrum.data(), block.data());
+
+        // First half overlaps the previous block's tail, second half is the new tail
+        for (std::size_t i = 0; i < hop; i++) {
+            block[i] += tail[i];
+        }
+        std::copy(block.begin() + hop, block.end(), tail.begin());
+
+        // Drop the samples of the filter's delay from the start of the signal
+        const std::size_t drop = std::min(skip, hop);
+        skip -= drop;
+        out.insert(out.end(), block.begin() + drop, block.begin() + hop);
+        produced += hop - drop;
+    }
+};
+using BlockFilter = BasicBlockFilter<double>;
+
+// Filters a stream in blocks of a fixed size with uniformly partitioned overlap-save convolution,
+// for real-time use where the output of a block is needed as soon as the block has arrived.
+// The FIR filter of the band response (see details::band_fir) is split into partitions of the block size,
+// their spectra are multiplied with a delay line of the spectra of past input blocks. A long filter thus adds
+// only its linear phase delay to the latency of one block, not its length.
+// Nothing is allocated after construction, as long as process() runs on the constructing thread.
+template <typename T>
+class BasicPartitionedFilter {
+public:
+    BasicPartitionedFilter(uint32_t sample_rate, const std::vector<Band>& bands, int roll,
+                           std::size_t block_size=256, std::size_t design_size=4096)
+        : plan(block_size > 0 ? get_real_plan<T>(2 * block_size) : nullptr),
+          hop(block_size),
+          filter_delay(design_size / 4),
+          bins(block_size + 1) {
+        if (block_size == 0) {
+            throw std::invalid_argument("Block size must be positive");
+        }
+        if (design_size < 4) {
+            throw std::invalid_argument("Filter design size must be at least 4");
+        }
+
+        auto impulse = details::band_fir<T>(sample_rate, bands, roll, design_size);
+        partition_count = (impulse.size() + hop - 1) / hop;
+        impulse.resize(partition_count * hop, 0);
+
+        kernels.resize(partition_count * bins);
+        history.resize(partition_count * bins);
+        sum.resize(bins);
+        window.resize(2 * hop);
+        time.resize(2 * hop);
+        for (std::size_t p = 0; p < partition_count; p++) {
+            std::fill(window.begin(), window.end(), 0);
+            std::copy_n(impulse.begin() + p * hop, hop, window.begin());
+            plan->forward(window.data(), &kernels[p * bins]);
+        }
+
+        // Grows the per thread transform scratch memory before the first real block
+        std::vector<T> zeros(hop, 0);
+        process(zeros.data(), zeros.data());
+        reset();
+    }
+
+    std::size_t block_size() const { return hop; }
+
+    // Delay of the linear phase filter in samples, output lags input by this much
+    std::size_t delay() const { return filter_delay; }
+
+    // Number of block sized parts the filter is split into
+    std::size_t partitions() const { return partition_count; }
+
+    // Filters one block of block_size() samples, 'in' & 'out' may be the same
+    void process(const T* in, T* out) {
+        // Overlap-save: the transform sees the previous block followed by the new one
+        std::copy(window.begin() + hop, window.end(), window.begin());
+        std::copy_n(in, hop, window.begin() + hop);
+        plan->forward(window.data(), &history[current * bins]);
+
+        std::fill(sum.begin(), sum.end(), std::complex<T>(0, 0));
+        for (std::size_t p = 0; p < partition_count; p++) {
+            const auto* x = &history[((current + partition_count - p) % partition_count) * bins];
+            const auto* h = &kernels[p * bins];
+            for (std::size_t k = 0; k < bins; k++) {
+                sum[k] += details::mul(x[k], h[k]);
+            }
+        }
+        current = (current + 1) % partition_count;
+
+        // Only the second half is free of circular wrap-around
+        plan->inverse(sum.data(), time.data());
+        std::copy(time.begin() + hop, time.end(), out);
+    }
+
+    // Clears the filter state for a new signal
+    void reset() {
+        std::fill(history.begin(), history.end(), std::complex<T>(0, 0));
+        std::fill(window.begin(), window.end(), 0);
+        current = 0;
+    }
+
+private:
+    std::shared_ptr<const BasicRealFftPlan<T>> plan;
+    std::size_t hop, filter_delay, bins, partition_count = 0, current = 0;
+    std::vector<std::complex<T>> kernels, history;  // Spectra of the filter parts & past input blocks
+    std::vector<std::complex<T>> sum;
+    std::vector<T> window, time;
+};
+using PartitionedFilter = BasicPartitionedFilter<double>;
+} // Namespace ctf
@@ -0,0 +1,405 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <vector>
+#include <optional>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ctf {
+
+// Sample formats of WAVE files
+enum class WavEncoding { pcm8, pcm16, pcm24, pcm32, float32, float64 };
+
+struct WavFormat {
+    uint16_t channels;
+    uint32_t sample_rate;
+    WavEncoding encoding;
+};
+
+namespace details {
+
+inline std::size_t sample_bytes(WavEncoding encoding) {
+    switch (encoding) {
+        case WavEncoding::pcm8: return 1;
+        case WavEncoding::pcm16: return 2;
+        case WavEncoding::pcm24: return 3;
+        case WavEncoding::pcm32: case WavEncoding::float32: return 4;
+        default: return 8;
+    }
+}
+
+// Memory mapping of a whole file, unmapped on destruction
+class MappedFile {
+public:
+    MappedFile(const std::string& path, std::size_t create_size=0) {
+        const bool create = create_size > 0;
+        fd = create ? ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) : ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open " + path);
+        }
+
+        // Created files get their disk space up front, a full disk would otherwise only show up
+        // as SIGBUS when a page of the mapping is written
+        struct stat info;
+        if (create && ::posix_fallocate(fd, 0, create_size) != 0) {
+            ::close(fd);
+            ::unlink(path.c_str());
+            throw std::runtime_error("Failed to allocate " + std::to_string(create_size) + " bytes for " + path);
+        }
+        if (!create && ::fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Failed to size " + path);
+        }
+        length = create ? create_size : info.st_size;
+        if (length == 0) {
+            ::close(fd);
+            throw std::invalid_argument(path + " is empty");
+        }
+
+        void* mapping = ::mmap(nullptr, length, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Failed to map " + path);
+        }
+        bytes = static_cast<uint8_t*>(mapping);
+    }
+
+    ~MappedFile() {
+        ::munmap(bytes, length);
+        ::close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    uint8_t* data() const { return bytes; }
+    std::size_t size() const { return length; }
+
+    // Writes the pages of a byte range back to the file and drops them from memory,
+    // they are read back when used again. Pages partly outside the range are included.
+    void release(std::size_t offset, std::size_t size) const {
+        const std::size_t page = ::sysconf(_SC_PAGESIZE);
+        const std::size_t begin = offset / page * page, end = std::min(length, offset + size);
+        if (begin >= end) return;
+        ::msync(bytes + begin, end - begin, MS_SYNC);
+        ::madvise(bytes + begin, end - begin, MADV_DONTNEED);
+        ::posix_fadvise(fd, begin, end - begin, POSIX_FADV_DONTNEED);
+    }
+
+    // Drops the pages of a byte range from the process's memory without waiting for them to be written,
+    // the operating system keeps them cached & writes them back. Pages partly outside the range are included.
+    void drop(std::size_t offset, std::size_t size) const {
+        const std::size_t page = ::sysconf(_SC_PAGESIZE);
+        const std::size_t begin = offset / page * page, end = std::min(length, offset + size);
+        if (begin >= end) return;
+        ::madvise(bytes + begin, end - begin, MADV_DONTNEED);
+    }
+
+private:
+    int fd;
+    uint8_t* bytes;
+    std::size_t length;
+};
+
+template <typename I>
+I read_le(const uint8_t* p) {
+    I value;
+    std::memcpy(&value, p, sizeof(I));
+    return value;
+}
+
+template <typename I>
+void write_le(uint8_t* p, I value) {
+    std::memcpy(p, &value, sizeof(I));
+}
+
+inline int32_t read_int24(const uint8_t* p) {
+    return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8;
+}
+
+// Converts 'count' samples 'stride' bytes apart to the range [-1, 1)
+template <typename T>
+void decode(const uint8_t* src, std::size_t stride, std::size_t count, WavEncoding encoding, T* out) {
+    switch (encoding) {
+        case WavEncoding::pcm8:
+            for (std::size_t i = 0; i < count; i++) out[i] = ((int)src[i * stride] - 128) / (T)128;
+            break;
+        case WavEncoding::pcm16:
+            for (std::size_t i = 0; i < count; i++) out[i] = read_le<int16_t>(src + i * stride) / (T)32768;
+            break;
+        case WavEncoding::pcm24:
+            for (std::size_t i = 0; i < count; i++) out[i] = read_int24(src + i * stride) / (T)8388608;
+            break;
+        case WavEncoding::pcm32:
+            for (std::size_t i = 0; i < count; i++) out[i] = (T)(read_le<int32_t>(src + i * stride) / 2147483648.0);
+            break;
+        case WavEncoding::float32:
+            for (std::size_t i = 0; i < count; i++) out[i] = read_le<float>(src + i * stride);
+            break;
+        case WavEncoding::float64:
+            for (std::size_t i = 0; i < count; i++) out[i] = read_le<double>(src + i * stride);
+            break;
+    }
+}
+
+// Rounds a sample in [-1, 1] to an integer of 'bits' bits, values outside the range are clipped
+template <typename T>
+int32_t quantize(T sample, int bits) {
+    const double scale = (double)(1u << (bits - 1));
+    return (int32_t)std::clamp(std::round(sample * scale), -scale, scale - 1);
+}
+
+template <typename T>
+void encode(const T* in, std::size_t count, WavEncoding encoding, uint8_t* dst, std::size_t stride) {
+    switch (encoding) {
+        case WavEncoding::pcm8:
+            for (std::size_t i = 0; i < count; i++) dst[i * stride] = (uint8_t)(quantize(in[i], 8) + 128);
+            break;
+        case WavEncoding::pcm16:
+            for (std::size_t i = 0; i < count; i++) write_le<int16_t>(dst + i * stride, quantize(in[i], 16));
+            break;
+        case WavEncoding::pcm24:
+            for (std::size_t i = 0; i < count; i++) {
+                const uint32_t value = quantize(in[i], 24);
+                dst[i * stride] = value & 0xff;
+                dst[i * stride + 1] = (value >> 8) & 0xff;
+                dst[i * stride + 2] = (value >> 16) & 0xff;
+            }
+            break;
+        case WavEncoding::pcm32:
+            for (std::size_t i = 0; i < count; i++) write_le<int32_t>(dst + i * stride, quantize(in[i], 32));
+            break;
+        case WavEncoding::float32:
+            for (std::size_t i = 0; i < count; i++) write_le<float>(dst + i * stride, in[i]);
+            break;
+        case WavEncoding::float64:
+            for (std::size_t i = 0; i < count; i++) write_le<double>(dst + i * stride, in[i]);
+            break;
+    }
+}
+
+inline WavEncoding encoding_of(uint16_t tag, uint16_t bits, const std::string& name) {
+    if (tag == 1) {
+        switch (bits) {
+            case 8: return WavEncoding::pcm8;
+            case 16: return WavEncoding::pcm16;
+            case 24: return WavEncoding::pcm24;
+            case 32: return WavEncoding::pcm32;
+        }
+    } else if (tag == 3) {
+        if (bits == 32) return WavEncoding::float32;
+        if (bits == 64) return WavEncoding::float64;
+    }
+    throw std::invalid_argument(name + " has an unsupported sample format");
+}
+
+// Format from the contents of a 'fmt ' chunk of at least 16 bytes
+inline WavFormat parse_format(const uint8_t* chunk, uint32_t chunk_size, const std::string& name) {
+    uint16_t tag = read_le<uint16_t>(chunk);
+    const uint16_t bits = read_le<uint16_t>(chunk + 14);
+    if (tag == 0xfffe && chunk_size >= 26) {
+        tag = read_le<uint16_t>(chunk + 24);  // WAVE_FORMAT_EXTENSIBLE sub format
+    }
+    return {read_le<uint16_t>(chunk + 2), read_le<uint32_t>(chunk + 4), encoding_of(tag, bits, name)};
+}
+
+constexpr std::size_t header_size = 44;
+
+// Writes a canonical 44 byte header
+inline void write_header(uint8_t* h, const WavFormat& format, uint32_t data_size) {
+    const uint16_t frame_bytes = format.channels * sample_bytes(format.encoding);
+    const bool floating = format.encoding == WavEncoding::float32 || format.encoding == WavEncoding::float64;
+
+    std::memcpy(h, "RIFF", 4);
+    write_le<uint32_t>(h + 4, data_size == UINT32_MAX ? UINT32_MAX : header_size - 8 + data_size);
+    std::memcpy(h + 8, "WAVEfmt ", 8);
+    write_le<uint32_t>(h + 16, 16);
+    write_le<uint16_t>(h + 20, floating ? 3 : 1);
+    write_le<uint16_t>(h + 22, format.channels);
+    write_le<uint32_t>(h + 24, format.sample_rate);
+    write_le<uint32_t>(h + 28, format.sample_rate * frame_bytes);
+    write_le<uint16_t>(h + 32, frame_bytes);
+    write_le<uint16_t>(h + 34, 8 * sample_bytes(format.encoding));
+    std::memcpy(h + 36, "data", 4);
+    write_le<uint32_t>(h + 40, data_size);
+}
+} // Namespace details
+
+// Reads the header of a WAVE stream up to the start of its samples, the stream
+// doesn't need to be seekable. Throws std::invalid_argument if it isn't a supported WAVE stream.
+inline WavFormat read_wav_header(std::FILE* in) {
+    uint8_t bytes[12];
+    if (std::fread(bytes, 1, 12, in) != 12 || std::memcmp(bytes, "RIFF", 4) || std::memcmp(bytes + 8, "WAVE", 4)) {
+        throw std::invalid_argument("Input is not a WAVE stream");
+    }
+
+    std::optional<WavFormat> format;
+    std::vector<uint8_t> chunk;
+    while (std::fread(bytes, 1, 8, in) == 8) {
+        const uint32_t chunk_size = details::read_le<uint32_t>(bytes + 4);
+        if (!std::memcmp(bytes, "data", 4)) {
+            if (!format || format->channels == 0) {
+                throw std::invalid_argument("Input has no valid format before its data");
+            }
+            return *format;
+        }
+
+        // Other chunks are read to skip them, the format chunk is parsed
+        chunk.resize(chunk_size + chunk_size % 2);
+        if (std::fread(chunk.data(), 1, chunk.size(), in) != chunk.size()) break;
+        if (!std::memcmp(bytes, "fmt ", 4)) {
+            if (chunk_size < 16) {
+                throw std::invalid_argument("Input has a format chunk too short to be valid");
+            }
+            format = details::parse_format(chunk.data(), chunk_size, "Input");
+        }
+    }
+    throw std::invalid_argument("Input has no audio data");
+}
+
+// Writes the header of a WAVE stream of unknown length
+inline void write_wav_header(std::FILE* out, const WavFormat& format) {
+    uint8_t header[details::header_size];
+    details::write_header(header, format, UINT32_MAX);
+    if (std::fwrite(header, 1, sizeof(header), out) != sizeof(header)) {
+        throw std::runtime_error("Failed to write the output header");
+    }
+}
+
+// Reads the samples of a WAVE file straight from a memory mapping of the file.
+// Samples are converted to [-1, 1) as they are read, any range of frames can be read at a time.
+class WavReader {
+public:
+    explicit WavReader(const std::string& path) : file(path) {
+        const uint8_t* bytes = file.data();
+        const std::size_t size = file.size();
+        if (size < 12 || std::memcmp(bytes, "RIFF", 4) || std::memcmp(bytes + 8, "WAVE", 4)) {
+            throw std::invalid_argument(path + " is not a WAVE file");
+        }
+
+        bool has_format = false;
+        for (std::size_t pos = 12; pos + 8 <= size; ) {
+            const uint32_t chunk_size = details::read_le<uint32_t>(bytes + pos + 4);
+            const uint8_t* chunk = bytes + pos + 8;
+            const bool is_data = !std::memcmp(bytes + pos, "data", 4);
+
+            // Only the data chunk of a streamed file may claim more bytes than the file has
+            if (!is_data && pos + 8 + chunk_size > size) {
+                throw std::invalid_argument(path + " is truncated");
+            }
+            if (!std::memcmp(bytes + pos, "fmt ", 4)) {
+                if (chunk_size < 16) {
+                    throw std::invalid_argument(path + " has a format chunk too short to be valid");
+                }
+                format = details::parse_format(chunk, chunk_size, path);
+                has_format = true;
+            } else if (is_data) {
+                if (!has_format || format.channels == 0) {
+                    throw std::invalid_argument(path + " has no valid format before its data");
+                }
+                samples = chunk;
+                frame_bytes = format.channels * details::sample_bytes(format.encoding);
+                // Streamed files may not know their data size, the file size limits it anyway
+                frame_count = std::min<std::size_t>(chunk_size, size - (pos + 8)) / frame_bytes;
+                return;
+            }
+            pos += 8 + chunk_size + chunk_size % 2;
+        }
+        throw std::invalid_argument(path + " has no audio data");
+    }
+
+    const WavFormat& wav_format() const { return format; }
+    uint16_t channels() const { return format.channels; }
+    uint32_t sample_rate() const { return format.sample_rate; }
+    std::size_t frames() const { return frame_count; }
+
+    // Encoded sample data as stored in the file, frames of interleaved channels
+    const uint8_t* raw_data() const { return samples; }
+    std::size_t raw_size() const { return frame_count * frame_bytes; }
+
+    // Reads 'count' samples of a channel starting from frame 'first'
+    template <typename T>
+    void read(std::size_t channel, std::size_t first, std::size_t count, T* out) const {
+        if (channel >= format.channels || first + count > frame_count) {
+            throw std::invalid_argument("Read outside of the WAVE data");
+        }
+        const auto* src = samples + first * frame_bytes + channel * details::sample_bytes(format.encoding);
+        details::decode(src, frame_bytes, count, format.encoding, out);
+    }
+
+private:
+    details::MappedFile file;
+    WavFormat format {};
+    const uint8_t* samples = nullptr;
+    std::size_t frame_bytes = 0, frame_count = 0;
+};
+
+// Writes a WAVE file of known size through a memory mapping, any range of frames at a time.
+// The file is built next to the target and renamed over it by finish(), so the target
+// can be the file being read. Without finish() the partial file is removed.
+class WavWriter {
+public:
+    WavWriter(const std::string& path, const WavFormat& format, std::size_t frames)
+        : path(path),
+          temp_path(path + ".part"),
+          format(format),
+          frame_bytes(format.channels * details::sample_bytes(format.encoding)),
+          frame_count(frames),
+          file(temp_path, details::header_size + data_size(path, frames * frame_bytes)) {
+        details::write_header(file.data(), format, frames * frame_bytes);
+    }
+
+    ~WavWriter() {
+        if (!finished) ::unlink(temp_path.c_str());
+    }
+
+    WavWriter(const WavWriter&) = delete;
+    WavWriter& operator=(const WavWriter&) = delete;
+
+    uint16_t channels() const { return format.channels; }
+    std::size_t frames() const { return frame_count; }
+
+    // Writes 'count' samples of a channel starting from frame 'first', samples are clipped to [-1, 1]
+    template <typename T>
+    void write(std::size_t channel, std::size_t first, std::size_t count, const T* in) {
+        if (channel >= format.channels || first + count > frame_count) {
+            throw std::invalid_argument("Write outside of the WAVE data");
+        }
+        auto* dst = file.data() + details::header_size + first * frame_bytes + channel * details::sample_bytes(format.encoding);
+        details::encode(in, count, format.encoding, dst, frame_bytes);
+    }
+
+    // Moves the written file to its final path
+    void finish() {
+        if (::rename(temp_path.c_str(), path.c_str()) != 0) {
+            throw std::runtime_error("Failed to write " + path);
+        }
+        finished = true;
+    }
+
+private:
+    std::string path, temp_path;
+    WavFormat format;
+    std::size_t frame_bytes, frame_count;
+    details::MappedFile file;
+    bool finished = false;
+
+    // WAVE headers store sizes in 32 bits, larger outputs would get a wrapped size
+    static std::size_t data_size(const std::string& path, std::size_t bytes) {
+        if (bytes > UINT32_MAX - (details::header_size - 8)) {
+            throw std::invalid_argument(path + " would have " + std::to_string(bytes)
+                                        + " bytes of samples, more than a WAVE file can hold (4 GiB)");
+        }
+        return bytes;
+    }
+};
+} // Namespace ctf
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <span>
+#include <memory>
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+
+namespace ctf {
+
+// Caller owned aligned memory for transforms & filtering without allocations.
+// Every slot grows to the largest size requested from it and is then reused,
+// so after a first call of each size the calls using the workspace don't allocate.
+// Slots don't overlap, spans of a slot stay valid until the slot is requested larger.
+class Workspace {
+public:
+    enum Slot { spectrum_slot, transform_slot, slots };
+
+    // Buffers start on cache line boundaries, which is enough for any SIMD load
+    static constexpr std::size_t alignment = 64;
+
+    Workspace() = default;
+
+    // Memory of 'count' values of type V from a slot, contents are left from earlier use
+    template <typename V>
+    std::span<V> get(std::size_t count, Slot slot) {
+        auto& buffer = buffers[slot];
+        const std::size_t bytes = (count * sizeof(V) + alignment - 1) / alignment * alignment;
+        if (buffer.size < bytes) {
+            buffer.memory.reset(static_cast<std::byte*>(std::aligned_alloc(alignment, bytes)));
+            if (!buffer.memory) throw std::bad_alloc();
+            buffer.size = bytes;
+        }
+        return {reinterpret_cast<V*>(buffer.memory.get()), count};
+    }
+
+    // Total bytes held by the slots
+    std::size_t size() const {
+        std::size_t total = 0;
+        for (const auto& buffer : buffers) total += buffer.size;
+        return total;
+    }
+
+private:
+    struct Free {
+        void operator()(std::byte* p) const { std::free(p); }
+    };
+    struct Buffer {
+        std::unique_ptr<std::byte, Free> memory;
+        std::size_t size = 0;
+    };
+
+    Buffer buffers[slots];
+};
+} // Namespace ctf
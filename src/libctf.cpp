@@ -0,0 +1,154 @@
+// C interface of libctf (see include/ctf.h) over ctf::BasicFilterSession
+
+#include <string>
+#include <vector>
+#include <variant>
+#include <new>
+#include <stdexcept>
+
+#include "./include/ctf.h"
+#include "./include/filter.hpp"
+#include "./include/session.hpp"
+
+struct ctf_session {
+    std::variant<ctf::BasicFilterSession<float>, ctf::BasicFilterSession<double>> filter;
+};
+
+namespace {
+
+thread_local std::string last_error;
+
+// Runs 'fn', turning exceptions into error codes & messages, none may escape to C callers
+template <typename F>
+int guarded(F fn) {
+    last_error.clear();
+    try {
+        fn();
+        return CTF_OK;
+    } catch (const std::invalid_argument& e) {
+        last_error = e.what();
+        return CTF_INVALID_ARGUMENT;
+    } catch (const std::bad_alloc&) {
+        last_error = "Out of memory";
+        return CTF_OUT_OF_MEMORY;
+    } catch (const std::exception& e) {
+        last_error = e.what();
+        return CTF_ERROR;
+    } catch (...) {
+        last_error = "Unknown error";
+        return CTF_ERROR;
+    }
+}
+
+void check_session(const ctf_session* session) {
+    if (!session) {
+        throw std::invalid_argument("Session is null");
+    }
+}
+} // Namespace
+
+extern "C" {
+
+int ctf_api_version(void) {
+    return CTF_API_VERSION;
+}
+
+const char* ctf_last_error(void) {
+    return last_error.c_str();
+}
+
+void ctf_session_config_init(ctf_session_config* config) {
+    if (!config) return;
+    *config = ctf_session_config {};
+    config->size = sizeof(ctf_session_config);
+    config->sample_rate = 44100;
+    config->channels = 1;
+    config->roll = 50;
+    config->block_size = 256;
+    config->design_size = 4096;
+}
+
+int ctf_session_create(const ctf_session_config* config, ctf_session** session) {
+    return guarded([&] {
+        if (!config || !session || config->size < sizeof(ctf_session_config)) {
+            throw std::invalid_argument("Session config or output missing, or config size not set");
+        }
+        if (config->band_count > 0 && !config->bands) {
+            throw std::invalid_argument("Bands missing");
+        }
+        if (config->design_size < 4) {
+            throw std::invalid_argument("Filter design size must be at least 4");
+        }
+        *session = nullptr;
+
+        std::vector<ctf::Band> bands;
+        for (std::size_t i = 0; i < config->band_count; i++) {
+            const auto& band = config->bands[i];
+            bands.push_back({band.freq1, band.freq2, band.gain1, band.gain2});
+        }
+        if (config->double_precision) {
+            *session = new ctf_session {ctf::BasicFilterSession<double>(config->sample_rate, config->channels, bands,
+                                                                         config->roll, config->block_size,
+                                                                         config->design_size)};
+        } else {
+            *session = new ctf_session {ctf::BasicFilterSession<float>(config->sample_rate, config->channels, bands,
+                                                                        config->roll, config->block_size,
+                                                                        config->design_size)};
+        }
+    });
+}
+
+void ctf_session_destroy(ctf_session* session) {
+    delete session;
+}
+
+size_t ctf_session_latency(const ctf_session* session) {
+    return session ? std::visit([](const auto& filter) { return filter.latency(); }, session->filter) : 0;
+}
+
+int ctf_session_push(ctf_session* session, const float* samples, size_t frames) {
+    return guarded([&] {
+        check_session(session);
+        if (frames > 0 && !samples) {
+            throw std::invalid_argument("Samples missing");
+        }
+        std::visit([&](auto& filter) { filter.push(samples, frames); }, session->filter);
+    });
+}
+
+int ctf_session_finish(ctf_session* session) {
+    return guarded([&] {
+        check_session(session);
+        std::visit([](auto& filter) { filter.finish(); }, session->filter);
+    });
+}
+
+size_t ctf_session_available(const ctf_session* session) {
+    return session ? std::visit([](const auto& filter) { return filter.available(); }, session->filter) : 0;
+}
+
+size_t ctf_session_pull(ctf_session* session, float* samples, size_t frames) {
+    if (!session || !samples) return 0;
+    return std::visit([&](auto& filter) { return filter.pull(samples, frames); }, session->filter);
+}
+
+void ctf_session_reset(ctf_session* session) {
+    if (!session) return;
+    std::visit([](auto& filter) { filter.reset(); }, session->filter);
+}
+
+int ctf_filter_clip(ctf_session* session, const float* in, float* out, size_t frames) {
+    return guarded([&] {
+        check_session(session);
+        if (frames > 0 && (!in || !out)) {
+            throw std::invalid_argument("Samples missing");
+        }
+        std::visit([&](auto& filter) {
+            filter.reset();
+            filter.push(in, frames);
+            filter.finish();
+            filter.pull(out, frames);
+        }, session->filter);
+    });
+}
+} // extern "C"
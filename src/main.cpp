@@ -4,12 +4,35 @@
 #include <complex>
 #include <cmath>
 #include <algorithm>
-
-#include "AudioFile.h"
+#include <thread>
+#include <fstream>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <map>
+#include <set>
+#include <memory>
+#include <iomanip>
+#include <sstream>
+#include <filesystem>
+#include <system_error>
+#include <cstdlib>
+#include <unistd.h>
 
 #include "./include/fft.hpp"
 #include "./include/filter.hpp"
 #include "./include/io.hpp"
+#include "./include/stream.hpp"
+#include "./include/parallel.hpp"
+#include "./include/batch.hpp"
+#include "./include/wav.hpp"
+#include "./include/stats.hpp"
+#include "./include/realtime.hpp"
+#include "./include/outofcore.hpp"
+#include "./include/planner.hpp"
+#include "./include/spectrum.hpp"
+#include "./include/analysis.hpp"
+#include "./include/iir.hpp"
 
 #define comp(a, b) std::complex<double>(a, b)
 
@@ -19,6 +42,9 @@ void verbose_msg(const bool verbose, const std::string msg) {
 
 void print_usage() {
     std::cout << "Usage: ctf <infile.wav> [freq bands] [options]\n"
+        "       ctf batch <manifest.txt | 'pattern*.wav'> [freq bands] [options]\n"
+        "       ctf stream [freq bands] [options] < input > output\n"
+        "       ctf analyze <infile.wav> [options]\n"
         "\nFreq bands:\n"
         "\tIn non-interactive mode (default), give frequency bands to be filtered out\n"
         "\tin the following format: <band low-frequency low-gain high-frequency high-gain>\n"
@@ -27,9 +53,630 @@ void print_usage() {
         "\nOptions:\n"
         "\t-o <filename.wav> for user defined output filename (defaults to out.wav)\n"
         "\t-r <amount> to set frequency cut roll off amount in hertz (defaults to 50)\n"
+        "\t-b <fft size> to filter in blocks of given 2^n FFT size with constant memory use\n"
+        "\t-m <megabytes> to transform whole files in scratch files using about this much memory\n"
+        "\t--scratch <directory> to set where the scratch files of -m & the IIR engine are kept\n"
+        "\t\t(defaults to the output's directory)\n"
+        "\t-j <threads> to set the number of threads (defaults to all cores)\n"
+        "\t--precision <float|double> to set the sample precision of the filtering (defaults to double)\n"
+        "\t--stats <json|text> to print the time & memory used by each processing stage\n"
+        "\t--planner <measure|estimate> to time the transform algorithms on first use of a size,\n"
+        "\t\tor to skip timing and use the defaults (defaults to measure)\n"
+        "\t--wisdom <filename> to set where measured choices are kept for later runs (defaults to ~/.cache/ctf/wisdom)\n"
+        "\t--cache <directory> to keep the input's spectrum there, so filtering it again skips the forward FFT\n"
+        "\t--engine <auto|fft|iir> to filter whole files with FFTs or, for notches & low/high cuts with roll offs,\n"
+        "\t\twith biquad filters run forward & backward; auto picks the cheaper one (defaults to auto).\n"
+        "\t\tWith -b, iir runs the biquads in one causal pass over blocks of the given size\n"
         "\t-i to run in interactive mode\n"
         "\t-v to run in verbose mode\n"
-        "\t-h print this help message"<< std::endl;
+        "\t-h print this help message\n"
+        "\nBatch mode:\n"
+        "\tFilters many files in one process, see docs/user-manual.md for the manifest format.\n"
+        "\tWith a file pattern, the freq bands & -r apply to all files and -o <directory> is required\n"
+        "\t-j, --precision, --stats, --planner, --wisdom & --engine as above, the engine is chosen per file\n"
+        "\nStream mode:\n"
+        "\tFilters WAVE or raw PCM from stdin to stdout in real time, the output has the format of the input\n"
+        "\t-b <samples> to set the block size, the latency of buffering input (defaults to 256)\n"
+        "\t-f <fft size> to set the filter design size, the filter delay is a quarter of it (defaults to 4096)\n"
+        "\t--engine <fft|iir> to filter with a partitioned convolution or, for the bands the IIR engine fits,\n"
+        "\t\twith biquad filters in one causal pass without the filter delay (defaults to fft)\n"
+        "\t--raw <u8|s16|s24|s32|f32|f64> to read raw interleaved PCM instead of WAVE\n"
+        "\t--rate <hertz> & --channels <count> to describe raw PCM (default to 44100 & 1)\n"
+        "\nAnalyze mode:\n"
+        "\tWrites the magnitude spectrogram of every channel to a binary file, see docs/user-manual.md for the format\n"
+        "\t-o <filename> for the output file (defaults to out.spectrogram)\n"
+        "\t-f <fft size> to set the even transform size of each frame (defaults to 2048)\n"
+        "\t-w <samples> to set the window length, at most the fft size (defaults to the fft size)\n"
+        "\t--hop <samples> to set the distance between frames (defaults to a quarter of the window)\n"
+        "\t--window <hann|hamming|blackman|rectangular> to set the window function (defaults to hann)\n"
+        "\t--decimate <bins> <frames> to keep the largest magnitude of each group of bins & frames (defaults to 1 1)\n"
+        "\t-j, --precision & --stats as above"<< std::endl;
+}
+
+void print_stats(const ctf::Stats& stats, const std::string& format) {
+    if (format == "json") {
+        std::cout << stats.json() << std::endl;
+    } else if (format == "text") {
+        std::cout << stats.table();
+    }
+}
+
+// Wisdom of earlier runs in $XDG_CACHE_HOME/ctf/wisdom or ~/.cache/ctf/wisdom, empty if neither is set
+std::string default_wisdom_path() {
+    if (const char* cache = std::getenv("XDG_CACHE_HOME"); cache && *cache) {
+        return std::string(cache) + "/ctf/wisdom";
+    }
+    if (const char* home = std::getenv("HOME"); home && *home) {
+        return std::string(home) + "/.cache/ctf/wisdom";
+    }
+    return "";
+}
+
+// Sets the planner mode and loads wisdom of earlier runs, a bad wisdom file is ignored with a warning
+void start_planner(const std::string& mode, const std::string& wisdom_path) {
+    ctf::planner().set_mode(mode == "estimate" ? ctf::PlannerMode::estimate : ctf::PlannerMode::measure);
+    std::ifstream wisdom(wisdom_path);
+    if (wisdom_path.empty() || !wisdom) return;
+    try {
+        ctf::planner().load(wisdom);
+    } catch (const std::invalid_argument& e) {
+        std::cerr << "Ignoring wisdom in " << wisdom_path << ": " << e.what() << std::endl;
+    }
+}
+
+// Saves newly measured choices, failing to save is only warned about
+void save_wisdom(const std::string& wisdom_path) {
+    if (wisdom_path.empty() || ctf::planner().measured() == 0) return;
+
+    // Keeps choices other runs saved meanwhile, a bad file is overwritten
+    if (std::ifstream saved(wisdom_path); saved) {
+        try {
+            ctf::planner().load(saved);
+        } catch (const std::invalid_argument&) {}
+    }
+
+    // Written to a temporary file first, so concurrent runs never read a partial file
+    const std::string temporary = wisdom_path + "." + std::to_string(::getpid());
+    std::error_code error;
+    const auto directory = std::filesystem::path(wisdom_path).parent_path();
+    if (!directory.empty()) std::filesystem::create_directories(directory, error);
+    {
+        std::ofstream wisdom(temporary);
+        ctf::planner().save(wisdom);
+        if (!wisdom.flush()) error = std::make_error_code(std::errc::io_error);
+    }
+    if (!error) std::filesystem::rename(temporary, wisdom_path, error);
+    if (error) {
+        std::filesystem::remove(temporary, error);
+        std::cerr << "Failed to save wisdom to " << wisdom_path << std::endl;
+    }
+}
+
+// Readers of options shared by the modes, each complains about a bad value and returns false
+
+bool parse_roll(const std::string& value, int& roll) {
+    const int roll_input = std::stoi(value);
+    if (roll_input < 0) {
+        std::cerr << "Roll off value should be non-negative" << std::endl;
+        return false;
+    }
+    roll = roll_input;
+    return true;
+}
+
+bool parse_threads(const std::string& value, int& threads) {
+    const int threads_input = std::stoi(value);
+    if (threads_input < 1) {
+        std::cerr << "Thread count should be at least 1" << std::endl;
+        return false;
+    }
+    threads = threads_input;
+    return true;
+}
+
+bool parse_precision(const std::string& value, bool& single_precision) {
+    if (value != "float" && value != "double") {
+        std::cerr << "Precision should be float or double" << std::endl;
+        return false;
+    }
+    single_precision = value == "float";
+    return true;
+}
+
+bool parse_stats(const std::string& value, std::string& format) {
+    if (value != "json" && value != "text") {
+        std::cerr << "Stats format should be json or text" << std::endl;
+        return false;
+    }
+    format = value;
+    return true;
+}
+
+bool parse_planner(const std::string& value, std::string& mode) {
+    if (value != "measure" && value != "estimate") {
+        std::cerr << "Planner should be measure or estimate" << std::endl;
+        return false;
+    }
+    mode = value;
+    return true;
+}
+
+// Reads an --engine value, complains about others
+bool parse_engine(const std::string& name, ctf::Engine& engine) {
+    for (auto candidate : {ctf::Engine::automatic, ctf::Engine::fft, ctf::Engine::iir}) {
+        if (name == ctf::engine_name(candidate)) {
+            engine = candidate;
+            return true;
+        }
+    }
+    std::cerr << "Engine should be auto, fft or iir" << std::endl;
+    return false;
+}
+
+// Filters one file of a batch with the requested engine, sets the engine used.
+// Returns an error message on failure.
+template <typename T>
+std::string filter_batch_job(const ctf::BatchJob& job, ctf::Engine& engine, ctf::ThreadPool& pool,
+                             std::size_t& samples, ctf::Stats* stats) {
+    try {
+        const auto reader = [&] {
+            ctf::Stats::Scope scope(stats, "load");
+            return ctf::WavReader(job.in_name);
+        }();
+        const auto choice = ctf::choose_engine(reader.frames(), reader.channels(), reader.sample_rate(), job.bands,
+                                               job.roll, pool.size(), engine);
+        engine = choice.engine;
+        ctf::WavWriter writer(job.out_name, reader.wav_format(), reader.frames());
+        if (choice.engine == ctf::Engine::iir) {
+            const auto out_dir = std::filesystem::path(job.out_name).parent_path().string();
+            ctf::filter_wav_iir<T>(reader, writer, *choice.design, out_dir.empty() ? "." : out_dir, pool, stats);
+        } else {
+            ctf::filter_wav<T>(reader, writer, job.bands, job.roll, 0, pool, stats);
+        }
+
+        ctf::Stats::Scope scope(stats, "save");
+        writer.finish();
+        samples = reader.channels() * reader.frames();
+    } catch (const std::exception& e) {
+        return e.what();
+    }
+    return "";
+}
+
+// Chooses the transforms of the files filtered with the FFT engine while the pool is idle, before the files
+// keep its threads busy (see ctf::Planner::choose)
+template <typename T>
+void plan_batch(const std::vector<ctf::BatchJob>& jobs, ctf::Engine engine, ctf::ThreadPool& pool,
+                ctf::Stats* stats) {
+    if (ctf::planner().mode() == ctf::PlannerMode::estimate) return;
+
+    std::set<std::size_t> sizes;
+    for (const auto& job : jobs) {
+        try {
+            const ctf::WavReader reader(job.in_name);
+            const auto choice = ctf::choose_engine(reader.frames(), reader.channels(), reader.sample_rate(),
+                                                   job.bands, job.roll, pool.size(), engine);
+            if (choice.engine == ctf::Engine::fft) sizes.insert(ctf::fft_size(reader.frames()));
+        } catch (const std::exception&) {
+            // Reported when the job runs
+        }
+    }
+    ctf::Stats::Scope scope(stats, "plan");
+    for (std::size_t size : sizes) {
+        ctf::planner().choose<T>(size, &pool);
+    }
+}
+
+// Filters every file of a manifest or file pattern on a shared thread pool
+int run_batch(int argc, char* argv[]) {
+    if (argc <= 2) {
+        print_usage();
+        return 1;
+    }
+
+    std::string source = argv[2];
+    std::string out_dir;
+    bool verbose = false;
+    int roll_amount = 50;
+    int threads = std::thread::hardware_concurrency();
+    bool single_precision = false;
+    std::string stats_format;
+    std::string planner_mode = "measure";
+    std::string wisdom_path = default_wisdom_path();
+    ctf::Engine engine = ctf::Engine::automatic;
+    std::vector<ctf::Band> freq_bands;
+
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "-o") {
+            out_dir = argv[++i];
+        } else if (arg == "-v") {
+            verbose = true;
+        } else if (arg == "-r") {
+            if (!parse_roll(argv[++i], roll_amount)) return 1;
+        } else if (arg == "-j") {
+            if (!parse_threads(argv[++i], threads)) return 1;
+        } else if (arg == "--precision") {
+            if (!parse_precision(argv[++i], single_precision)) return 1;
+        } else if (arg == "--stats") {
+            if (!parse_stats(argv[++i], stats_format)) return 1;
+        } else if (arg == "--planner") {
+            if (!parse_planner(argv[++i], planner_mode)) return 1;
+        } else if (arg == "--wisdom") {
+            wisdom_path = argv[++i];
+        } else if (arg == "--engine") {
+            if (!parse_engine(argv[++i], engine)) return 1;
+        } else if (arg == "band") {
+            ctf::Band band;
+            band.freq1 = std::stoi(argv[++i]);
+            band.gain1 = std::stod(argv[++i]);
+            band.freq2 = std::stoi(argv[++i]);
+            band.gain2 = std::stod(argv[++i]);
+            freq_bands.push_back(band);
+        }
+    }
+
+    std::vector<ctf::BatchJob> jobs;
+    try {
+        if (source.find_first_of("*?[") != std::string::npos) {
+            if (out_dir.empty() || freq_bands.empty()) {
+                std::cerr << "File patterns need frequency bands and an output directory (-o)" << std::endl;
+                return 1;
+            }
+            jobs = ctf::glob_jobs(source, out_dir, freq_bands, roll_amount);
+        } else {
+            std::ifstream manifest(source);
+            if (!manifest) {
+                std::cerr << "Failed to open " << source << std::endl;
+                return 1;
+            }
+            jobs = ctf::parse_manifest(manifest);
+        }
+    } catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    start_planner(planner_mode, wisdom_path);
+    ctf::ThreadPool pool(threads);
+    ctf::Stats stats;
+    ctf::Stats* recorder = stats_format.empty() ? nullptr : &stats;
+    std::atomic<std::size_t> files = 0, samples = 0, failed = 0;
+    std::mutex msg_mutex;
+    const auto start = std::chrono::steady_clock::now();
+    if (single_precision) {
+        plan_batch<float>(jobs, engine, pool, recorder);
+    } else {
+        plan_batch<double>(jobs, engine, pool, recorder);
+    }
+
+    // One chunk per file, channels & transforms of a file share the pool with other files
+    pool.parallel_for(jobs.size(), [&](std::size_t first, std::size_t last) {
+        for (std::size_t j = first; j < last; j++) {
+            const auto& job = jobs[j];
+            std::size_t job_samples = 0;
+            ctf::Engine job_engine = engine;
+            const auto error = single_precision ? filter_batch_job<float>(job, job_engine, pool, job_samples, recorder)
+                                                : filter_batch_job<double>(job, job_engine, pool, job_samples, recorder);
+
+            std::lock_guard<std::mutex> lock(msg_mutex);
+            if (!error.empty()) {
+                std::cerr << job.in_name << ": " << error << std::endl;
+                failed++;
+                continue;
+            }
+            files++;
+            samples += job_samples;
+            verbose_msg(verbose, job.in_name + " -> " + job.out_name + " (" + ctf::engine_name(job_engine) + ")");
+        }
+    }, jobs.size());
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Filtered " << files << " file(s), " << samples << " samples in " << seconds << " s: "
+              << files / seconds << " files/s, " << samples / seconds << " samples/s";
+    if (failed) std::cout << ", " << failed << " failed";
+    std::cout << std::endl;
+    print_stats(stats, stats_format);
+    save_wisdom(wisdom_path);
+
+    return failed ? 1 : 0;
+}
+
+// Filters PCM from stdin to stdout in blocks as it arrives, reports latency & speed to stderr
+int run_stream(int argc, char* argv[]) {
+    const std::map<std::string, ctf::WavEncoding> raw_encodings {
+        {"u8", ctf::WavEncoding::pcm8}, {"s16", ctf::WavEncoding::pcm16}, {"s24", ctf::WavEncoding::pcm24},
+        {"s32", ctf::WavEncoding::pcm32}, {"f32", ctf::WavEncoding::float32}, {"f64", ctf::WavEncoding::float64}};
+
+    std::string raw;
+    ctf::WavFormat format {1, 44100, ctf::WavEncoding::pcm16};
+    int roll_amount = 50;
+    int block_size = 256;
+    int design_size = 4096;
+    bool verbose = false;
+    bool single_precision = false;
+    ctf::Engine engine = ctf::Engine::fft;
+    std::vector<ctf::Band> freq_bands;
+
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "-r") {
+            if (!parse_roll(argv[++i], roll_amount)) return 1;
+        } else if (arg == "--engine") {
+            if (!parse_engine(argv[++i], engine)) return 1;
+            if (engine == ctf::Engine::automatic) {
+                std::cerr << "Stream mode engine should be fft or iir" << std::endl;
+                return 1;
+            }
+        } else if (arg == "-b") {
+            block_size = std::stoi(argv[++i]);
+        } else if (arg == "-f") {
+            design_size = std::stoi(argv[++i]);
+        } else if (arg == "-v") {
+            verbose = true;
+        } else if (arg == "--precision") {
+            if (!parse_precision(argv[++i], single_precision)) return 1;
+        } else if (arg == "--raw") {
+            raw = argv[++i];
+        } else if (arg == "--rate") {
+            format.sample_rate = std::stoi(argv[++i]);
+        } else if (arg == "--channels") {
+            format.channels = std::stoi(argv[++i]);
+        } else if (arg == "band") {
+            ctf::Band band;
+            band.freq1 = std::stoi(argv[++i]);
+            band.gain1 = std::stod(argv[++i]);
+            band.freq2 = std::stoi(argv[++i]);
+            band.gain2 = std::stod(argv[++i]);
+            freq_bands.push_back(band);
+        }
+    }
+
+    if (block_size < 1 || design_size < 4 || (design_size & (design_size - 1))) {
+        std::cerr << "Block size should be positive and filter size a power of 2 of at least 4" << std::endl;
+        return 1;
+    }
+    if (freq_bands.empty()) {
+        std::cerr << "Give frequency bands as parameters" << std::endl;
+        return 1;
+    }
+
+    try {
+        if (raw.empty()) {
+            format = ctf::read_wav_header(stdin);
+        } else if (raw_encodings.count(raw)) {
+            format.encoding = raw_encodings.at(raw);
+        } else {
+            std::cerr << "Unknown raw sample format " << raw << std::endl;
+            return 1;
+        }
+        if (ctf::validate_input(freq_bands, format.sample_rate, roll_amount)) {
+            return 1;
+        }
+        std::shared_ptr<const ctf::IirDesign> design;
+        if (engine == ctf::Engine::iir) {
+            design = ctf::get_iir_design(format.sample_rate, freq_bands, roll_amount);
+            if (!design) {
+                std::cerr << "The bands can't be filtered with IIR filters, only notches, "
+                             "low & high cuts with roll offs are" << std::endl;
+                return 1;
+            }
+        }
+        if (raw.empty()) {
+            ctf::write_wav_header(stdout, format);
+        }
+
+        const auto report = design
+            ? (single_precision ? ctf::filter_stream_iir<float>(stdin, stdout, format, *design, block_size)
+                                : ctf::filter_stream_iir<double>(stdin, stdout, format, *design, block_size))
+            : (single_precision
+                ? ctf::filter_stream<float>(stdin, stdout, format, freq_bands, roll_amount, block_size, design_size)
+                : ctf::filter_stream<double>(stdin, stdout, format, freq_bands, roll_amount, block_size, design_size));
+
+        const auto ms = [&](std::size_t frames) { return 1000.0 * frames / format.sample_rate; };
+        std::cerr << std::fixed << std::setprecision(2)
+                  << "Latency: " << report.latency_frames() << " samples (" << ms(report.latency_frames())
+                  << " ms), block " << report.block_frames << " + filter delay " << report.delay_frames << "\n"
+                  << "Real-time factor: " << std::setprecision(4) << report.real_time_factor(format.sample_rate)
+                  << ", slowest block " << 1000 * report.max_block_seconds << " ms of "
+                  << ms(report.block_frames) << " ms" << std::endl;
+        if (verbose) {
+            std::cerr << "Filtered " << report.frames << " frames of " << format.channels << " channel(s), "
+                      << (report.allocated_bytes ? std::to_string(*report.allocated_bytes) : "n/a")
+                      << " bytes allocated while filtering" << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Writes the spectrogram of a file for checking filter results
+int run_analyze(int argc, char* argv[]) {
+    if (argc <= 2) {
+        print_usage();
+        return 1;
+    }
+
+    const std::string in_name = argv[2];
+    std::string out_name = "out.spectrogram";
+    ctf::StftSettings settings;
+    int threads = std::thread::hardware_concurrency();
+    bool single_precision = false;
+    bool verbose = false;
+    std::string stats_format;
+
+    try {
+        for (int i = 3; i < argc; i++) {
+            std::string arg = argv[i];
+
+            if (arg == "-o") {
+                out_name = argv[++i];
+            } else if (arg == "-f") {
+                settings.fft_size = std::stoul(argv[++i]);
+            } else if (arg == "-w") {
+                settings.window_size = std::stoul(argv[++i]);
+            } else if (arg == "--hop") {
+                settings.hop = std::stoul(argv[++i]);
+            } else if (arg == "--window") {
+                const std::string name = argv[++i];
+                bool known = false;
+                for (auto window : {ctf::Window::hann, ctf::Window::hamming, ctf::Window::blackman,
+                                    ctf::Window::rectangular}) {
+                    if (name == ctf::window_name(window)) {
+                        settings.window = window;
+                        known = true;
+                    }
+                }
+                if (!known) {
+                    std::cerr << "Unknown window " << name << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--decimate") {
+                settings.bin_decimation = std::stoul(argv[++i]);
+                settings.frame_decimation = std::stoul(argv[++i]);
+            } else if (arg == "-j") {
+                if (!parse_threads(argv[++i], threads)) return 1;
+            } else if (arg == "--precision") {
+                if (!parse_precision(argv[++i], single_precision)) return 1;
+            } else if (arg == "--stats") {
+                if (!parse_stats(argv[++i], stats_format)) return 1;
+            } else if (arg == "-v") {
+                verbose = true;
+            }
+        }
+    } catch (const std::logic_error&) {
+        std::cerr << "Bad option value" << std::endl;
+        return 1;
+    }
+
+    ctf::Stats stats;
+    ctf::Stats* recorder = stats_format.empty() ? nullptr : &stats;
+    try {
+        const auto reader = [&] {
+            ctf::Stats::Scope scope(recorder, "load");
+            return ctf::WavReader(in_name);
+        }();
+        ctf::ThreadPool pool(threads);
+        const auto shape = single_precision
+            ? ctf::write_spectrogram<float>(reader, out_name, settings, pool, recorder)
+            : ctf::write_spectrogram<double>(reader, out_name, settings, pool, recorder);
+        verbose_msg(verbose, "Wrote " + std::to_string(shape.frames) + " frames of " + std::to_string(shape.bins) +
+                    " bins for " + std::to_string(shape.channels) + " channel(s) to " + out_name);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    print_stats(stats, stats_format);
+
+    return 0;
+}
+
+struct Options {
+    std::string in_name, out_name, stats_format;
+    bool verbose, interactive;
+    int roll_amount, block_fft_size, threads;
+    std::vector<ctf::Band> freq_bands;
+    std::size_t memory_budget;
+    std::string scratch_dir, wisdom_path, cache_dir;
+    ctf::Engine engine;
+};
+
+// Filters one file with samples of type T, float halves the memory & doubles the SIMD width
+template <typename T>
+int filter_file(const Options& options) {
+    const auto& [in_name, out_name, stats_format, verbose, interactive, roll_amount, block_fft_size, threads,
+                 given_bands, memory_budget, scratch_dir, wisdom_path, cache_dir, engine] = options;
+    ctf::Stats stats;
+    ctf::Stats* recorder = stats_format.empty() ? nullptr : &stats;
+
+    try {
+        const auto reader = [&] {
+            ctf::Stats::Scope scope(recorder, "load");
+            return ctf::WavReader(in_name);
+        }();
+
+        auto freq_bands = given_bands;
+        if (ctf::validate_input(freq_bands, reader.sample_rate(), roll_amount)) {
+            return 1;
+        }
+
+        if (interactive) {
+            freq_bands = ctf::get_user_input(reader.sample_rate());
+        }
+        verbose_msg(verbose, "Processing..");
+
+        ctf::ThreadPool pool(threads);
+        const auto write_output = [&](const auto& filter, const std::string& how) {
+            ctf::WavWriter writer(out_name, reader.wav_format(), reader.frames());
+            filter(writer);
+            verbose_msg(verbose, "Filter applied to " + std::to_string(reader.channels()) + " channel(s) with " +
+                        std::to_string(pool.size()) + " thread(s)" + how);
+            {
+                ctf::Stats::Scope scope(recorder, "save");
+                writer.finish();
+            }
+            verbose_msg(verbose, "Outfile written");
+        };
+
+        // Only whole files filtered once have a choice of engine, blocks use the IIR engine only when asked to
+        const bool whole_file = !memory_budget && !block_fft_size && !interactive && cache_dir.empty();
+        const bool causal = block_fft_size && engine == ctf::Engine::iir;
+        const auto choice = whole_file || causal
+                          ? ctf::choose_engine(reader.frames(), reader.channels(), reader.sample_rate(), freq_bands,
+                                               roll_amount, pool.size(), engine)
+                          : ctf::EngineChoice();
+        if (whole_file || causal) {
+            std::ostringstream how;
+            how << "Engine: " << ctf::engine_name(choice.engine);
+            if (choice.design) {
+                how << " (costs estimated from operation counts, not timed: fft " << choice.fft_cost
+                    << ", iir " << choice.iir_cost << ", gain error " << choice.design->max_error << ")";
+            } else if (engine == ctf::Engine::automatic) {
+                how << " (no IIR design for these bands)";
+            }
+            verbose_msg(verbose, how.str());
+        }
+
+        if (causal) {
+            write_output([&](ctf::WavWriter& writer) {
+                ctf::filter_wav_iir_causal<T>(reader, writer, *choice.design, block_fft_size, pool, recorder);
+            }, " in blocks through " + std::to_string(2 * choice.design->sections.size()) + " causal biquad section(s)..");
+        } else if (choice.engine == ctf::Engine::iir) {
+            write_output([&](ctf::WavWriter& writer) {
+                ctf::filter_wav_iir<T>(reader, writer, *choice.design, scratch_dir, pool, recorder);
+            }, " through " + std::to_string(choice.design->sections.size()) + " biquad section(s)..");
+        } else if (memory_budget) {
+            write_output([&](ctf::WavWriter& writer) {
+                ctf::filter_out_of_core<T>(reader, writer, freq_bands, roll_amount, memory_budget, scratch_dir, &pool,
+                                           recorder);
+            }, " out of core..");
+        } else if (block_fft_size || (!interactive && cache_dir.empty())) {
+            write_output([&](ctf::WavWriter& writer) {
+                ctf::filter_wav<T>(reader, writer, freq_bands, roll_amount, block_fft_size, pool, recorder);
+            }, block_fft_size ? " in blocks.." : "..");
+        } else {
+            // The input is transformed once, filtering again with more bands only runs the inverse transforms
+            const ctf::BasicSpectra<T> spectra(reader, cache_dir, &pool, recorder);
+            verbose_msg(verbose && spectra.cached(), "Spectrum read from " + spectra.path());
+            do {
+                write_output([&](ctf::WavWriter& writer) {
+                    spectra.filter(writer, freq_bands, roll_amount, pool, recorder);
+                }, "..");
+            } while (interactive && ctf::add_user_band(freq_bands, reader.sample_rate()));
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    print_stats(stats, stats_format);
+    save_wisdom(wisdom_path);
+
+    return 0;
 }
 
 int main(int argc, char* argv[]) {
@@ -38,13 +685,33 @@ int main(int argc, char* argv[]) {
         return 0;
     }
 
+    if (std::string(argv[1]) == "batch") {
+        return run_batch(argc, argv);
+    }
+    if (std::string(argv[1]) == "stream") {
+        return run_stream(argc, argv);
+    }
+    if (std::string(argv[1]) == "analyze") {
+        return run_analyze(argc, argv);
+    }
+
     std::string in_name = argv[1];
     std::string out_name = "out.wav";
 
     bool verbose = false;
     bool interactive = false;
+    bool single_precision = false;
+    std::string stats_format;
     int roll_amount = 50;
+    int block_fft_size = 0;
+    int threads = std::thread::hardware_concurrency();
     std::vector<ctf::Band> freq_bands;
+    std::size_t memory_budget = 0;
+    std::string scratch_dir;
+    std::string planner_mode = "measure";
+    std::string wisdom_path = default_wisdom_path();
+    std::string cache_dir;
+    ctf::Engine engine = ctf::Engine::automatic;
 
     for (int i = 2; i < argc; i++) {
         std::string arg = argv[i];
@@ -59,12 +726,37 @@ int main(int argc, char* argv[]) {
         } else if (arg == "-i") {
             interactive = true;
         } else if (arg == "-r") {
-            int roll_input = std::stoi(argv[++i]);
-            if (roll_input < 0) {
-                std::cerr << "Roll off value should be non-negative" << std::endl;
+            if (!parse_roll(argv[++i], roll_amount)) return 1;
+        } else if (arg == "-b") {
+            int size_input = std::stoi(argv[++i]);
+            if (size_input < 4 || (size_input & (size_input - 1))) {
+                std::cerr << "Block FFT size should be a power of 2 and at least 4" << std::endl;
+                return 1;
+            }
+            block_fft_size = size_input;
+        } else if (arg == "-m") {
+            int memory_input = std::stoi(argv[++i]);
+            if (memory_input < 1) {
+                std::cerr << "Memory budget should be at least 1 megabyte" << std::endl;
                 return 1;
             }
-            roll_amount = roll_input;
+            memory_budget = (std::size_t)memory_input << 20;
+        } else if (arg == "--scratch") {
+            scratch_dir = argv[++i];
+        } else if (arg == "-j") {
+            if (!parse_threads(argv[++i], threads)) return 1;
+        } else if (arg == "--precision") {
+            if (!parse_precision(argv[++i], single_precision)) return 1;
+        } else if (arg == "--stats") {
+            if (!parse_stats(argv[++i], stats_format)) return 1;
+        } else if (arg == "--planner") {
+            if (!parse_planner(argv[++i], planner_mode)) return 1;
+        } else if (arg == "--wisdom") {
+            wisdom_path = argv[++i];
+        } else if (arg == "--cache") {
+            cache_dir = argv[++i];
+        } else if (arg == "--engine") {
+            if (!parse_engine(argv[++i], engine)) return 1;
         } else if (arg == "band") {
             ctf::Band band;
             band.freq1 = std::stoi(argv[++i]);
@@ -81,46 +773,30 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    AudioFile<double> audio;
-    if(!audio.load(argv[1])) {
-        std::cerr << "Failed to load " << in_name << "\n";
+    if (freq_bands.size() == 0 && interactive == false) {
+        std::cerr << "Give frequency bands as parameters or run in interactive mode" << std::endl;
         return 1;
     }
 
-    if (audio.getNumChannels() != 1) {
-        std::cerr << "This program supports only mono audio" << std::endl;
+    if (block_fft_size && memory_budget) {
+        std::cerr << "Block filtering & out-of-core transforms can't be used together" << std::endl;
         return 1;
     }
-
-    if (freq_bands.size() == 0 && interactive == false) {
-        std::cerr << "Give frequency bands as parameters or run in interactive mode" << std::endl;
+    if (!cache_dir.empty() && (block_fft_size || memory_budget)) {
+        std::cerr << "Spectrum caching only works with whole file filtering, not with -b or -m" << std::endl;
         return 1;
     }
-
-    if (ctf::validate_input(freq_bands, audio.getSampleRate(), roll_amount)) {
+    if (engine == ctf::Engine::iir && (memory_budget || interactive || !cache_dir.empty())) {
+        std::cerr << "The IIR engine only filters whole files or blocks, not with -m, -i or --cache" << std::endl;
         return 1;
     }
-
-    if (interactive) {
-        freq_bands = ctf::get_user_input(audio.getSampleRate());
+    if (scratch_dir.empty()) {
+        scratch_dir = std::filesystem::path(out_name).parent_path().string();
+        if (scratch_dir.empty()) scratch_dir = ".";
     }
-    verbose_msg(verbose, "Processing..");
-
-    auto fourier_series = ctf::radix2fft(audio.samples[0]);
-    verbose_msg(verbose, "Audio transformed to Fourier series..");
 
-    for (const auto& band : freq_bands) {
-        ctf::band_cut(fourier_series, audio.getSampleRate(), band, roll_amount);
-    }
-    verbose_msg(verbose, "Filter applied..");
-
-    auto output = ctf::radix2fft_inverse(fourier_series);
-    verbose_msg(verbose, "Fourier series transformed back to audio samples..");
-
-    output.resize(audio.getNumSamplesPerChannel());
-    audio.samples[0] = output;
-    audio.save("./" + out_name, AudioFileFormat::Wave);
-    verbose_msg(verbose, "Outfile written");
-
-    return 0;
+    start_planner(planner_mode, wisdom_path);
+    const Options options {in_name, out_name, stats_format, verbose, interactive, roll_amount, block_fft_size, threads,
+                           freq_bands, memory_budget, scratch_dir, wisdom_path, cache_dir, engine};
+    return single_precision ? filter_file<float>(options) : filter_file<double>(options);
 }
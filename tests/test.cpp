@@ -1,8 +1,18 @@
+// Count allocations to check the allocation free paths, defined before the headers include stats.hpp
+#define CTF_COUNT_ALLOCATIONS
+
 #include <vector>
+#include <array>
 #include <complex>
 #include <cstdlib>
 #include <random>
 #include <cmath>
+#include <atomic>
+#include <stdexcept>
+#include <sstream>
+#include <fstream>
+#include <filesystem>
+#include <thread>
 
 // Testing framework
 #define CATCH_CONFIG_MAIN
@@ -10,12 +20,30 @@
 
 #include "../src/include/filter.hpp"
 #include "../src/include/fft.hpp"
+#include "../src/include/stream.hpp"
+#include "../src/include/parallel.hpp"
+#include "../src/include/batch.hpp"
+#include "../src/include/wav.hpp"
+#include "../src/include/stats.hpp"
+#include "../src/include/codelet.hpp"
+#include "../src/include/realtime.hpp"
+#include "../src/include/workspace.hpp"
+#include "../src/include/outofcore.hpp"
+#include "../src/include/planner.hpp"
+#include "../src/include/spectrum.hpp"
+#include "../src/include/analysis.hpp"
+#include "../src/include/pipeline.hpp"
+#include "../src/include/batchfft.hpp"
+#include "../src/include/iir.hpp"
+#include "../src/include/session.hpp"
+#include "../src/include/cache.hpp"
+#include "../src/include/ctf.h"
 
 #define comp(a, b) std::complex<double>(a, b)
 
 // Utility functions
 bool close_enough(double d1, double d2, double e=1e-9) {
-    return abs(d1 - d2) < e;
+    return std::abs(d1 - d2) < e;
 }
 
 bool close_enough(std::complex<double> c1, std::complex<double> c2) {
@@ -24,9 +52,9 @@ bool close_enough(std::complex<double> c1, std::complex<double> c2) {
 
 // --------------------- TEST FILTER --------------------
 
-// Generate a complex vector for testing
+// Generate a half Fourier series for testing, one bin per hertz
 constexpr const uint16_t sample_rate = 44100;
-std::vector<std::complex<double>> test_vector(sample_rate, comp(1.0,1.0));
+std::vector<std::complex<double>> test_vector(sample_rate / 2 + 1, comp(1.0,1.0));
 
 constexpr const ctf::Band cut_band (100, 10000, 0, 0);
 constexpr const ctf::Band partial_cut_band (100, 10000, 0.1, 0.1);
@@ -40,21 +68,12 @@ TEST_CASE("Input freqs are cut" "[ctf::rm_freqs]") {
     }
 }
 
-TEST_CASE("Mirrored freqs are cut" "[ctf::rm_freqs]") {
-    auto filtered(test_vector);
-    ctf::rm_freqs(filtered, sample_rate, cut_band);
-
-    for (uint32_t i = sample_rate - cut_band.freq2; i <= sample_rate - cut_band.freq1; i++) {
-        REQUIRE(close_enough(filtered[i], comp(0,0)));
-    }
-}
-
 TEST_CASE("Outside freqs are untouched" "[ctf::rm_freqs]") {
     auto filtered(test_vector);
     ctf::rm_freqs(filtered, sample_rate, cut_band);
 
     for (uint32_t i = 0; i < filtered.size(); i++) {
-        if ((i < cut_band.freq1 && i > cut_band.freq2) && (i < sample_rate - cut_band.freq2 && i > sample_rate - cut_band.freq1)) {
+        if (i < cut_band.freq1 || i > cut_band.freq2) {
             REQUIRE(close_enough(filtered[i], comp(1,1)));
         }
     }
@@ -78,41 +97,26 @@ TEST_CASE("Roll-off works" "[ctf::roll_off]") {
     ctf::roll_off(rolled, sample_rate, band, roll);
 
     // Before 1st roll
-    for (int i = 1; i < f1 - roll; i++) {
-        const auto corr = comp(1, 1);
-
-        REQUIRE(close_enough(rolled[i], corr));
-        REQUIRE(close_enough(rolled[sample_rate - i], corr));
+    for (int i = 0; i < f1 - roll; i++) {
+        REQUIRE(close_enough(rolled[i], comp(1, 1)));
     }
-    // 1st roll
-    for (int i = f1 - roll + 1; i < f1; i++) {
-        const double correct_gain = 1 - (f1 - i) / roll;
-        const auto corr = comp(correct_gain, correct_gain);
-
-        REQUIRE(close_enough(rolled[i], corr));
-        REQUIRE(close_enough(rolled[sample_rate - i], corr));
+    // 1st roll, linear from 1 down to g1
+    for (int i = f1 - roll; i <= f1; i++) {
+        const double correct_gain = 1 + (g1 - 1) * (i - (f1 - roll)) / roll;
+        REQUIRE(close_enough(rolled[i], comp(correct_gain, correct_gain)));
     }
-    // Before 2nd roll
+    // Band itself is not affected
     for (int i = f1 + 1; i < f2; i++) {
-        const auto corr = comp(1, 1);
-
-        REQUIRE(close_enough(rolled[i], corr));
-        REQUIRE(close_enough(rolled[sample_rate - i], corr));
+        REQUIRE(close_enough(rolled[i], comp(1, 1)));
     }
-    // 2nd roll
-    for (int i = f2; i < f2 + roll; i++) {
-        const double correct_gain =  1 - g2 * (f2 - i) / roll;
-        const auto corr = comp(correct_gain, correct_gain);
-
-        REQUIRE(close_enough(rolled[i], corr));
-        REQUIRE(close_enough(rolled[sample_rate - i], corr));
+    // 2nd roll, linear from g2 up to 1
+    for (int i = f2; i <= f2 + roll; i++) {
+        const double correct_gain = g2 + (1 - g2) * (i - f2) / roll;
+        REQUIRE(close_enough(rolled[i], comp(correct_gain, correct_gain)));
     }
     // After 2nd roll
-    for (int i = f2 + roll; i < sample_rate / 2; i++) {
-        const auto corr = comp(1, 1);
-
-        REQUIRE(close_enough(rolled[i], corr));
-        REQUIRE(close_enough(rolled[sample_rate - i], corr));
+    for (int i = f2 + roll + 1; i < rolled.size(); i++) {
+        REQUIRE(close_enough(rolled[i], comp(1, 1)));
     }
 }
 
@@ -161,7 +165,7 @@ TEST_CASE("Input vectors are expanded to the next 2^n size" "[ctf::radix2fft]")
     }
 }
 
-TEST_CASE("FFT recursion works as expected" "[ctf::radix2fft_rec]") {
+TEST_CASE("FFT plan matches naive DFT" "[ctf::FftPlan]") {
     constexpr const uint32_t test_size = 1024;
 
     std::vector<std::complex<double>> in (test_size);
@@ -174,7 +178,7 @@ TEST_CASE("FFT recursion works as expected" "[ctf::radix2fft_rec]") {
     }
 
     std::vector<std::complex<double>> out_ctf (in);
-    ctf::details::radix2fft_rec(out_ctf, out_ctf.size());
+    ctf::FftPlan(test_size).forward(out_ctf);
 
     auto out_correct = in;
     ctf::details::dft_naive(out_correct);
@@ -184,6 +188,355 @@ TEST_CASE("FFT recursion works as expected" "[ctf::radix2fft_rec]") {
     }
 }
 
+TEST_CASE("FFT plan inverse undoes forward" "[ctf::FftPlan]") {
+    std::uniform_real_distribution<double> unif(-1,1);
+    std::default_random_engine re;
+
+    for (uint32_t size = 1; size <= 4096; size *= 2) {
+        std::vector<std::complex<double>> original (size);
+        for (auto& c : original) {
+            c = comp(unif(re), unif(re));
+        }
+
+        auto transformed = original;
+        const auto plan = ctf::get_plan(size);
+        plan->forward(transformed);
+        plan->inverse(transformed);
+
+        for (int i = 0; i < size; i++) {
+            REQUIRE(close_enough(transformed[i], original[i]));
+        }
+    }
+}
+
+TEST_CASE("FFT plan handles any size" "[ctf::FftPlan]") {
+    std::uniform_real_distribution<double> unif(-1,1);
+    std::default_random_engine re;
+
+    // Mixed radix sizes and sizes with large prime factors (Bluestein)
+    for (uint32_t size : {1, 2, 3, 5, 6, 7, 9, 12, 15, 17, 30, 45, 97, 100, 194, 243, 360, 625, 1000, 1009}) {
+        std::vector<std::complex<double>> in (size);
+        for (auto& c : in) {
+            c = comp(unif(re), unif(re));
+        }
+
+        auto out_ctf = in;
+        const auto plan = ctf::get_plan(size);
+        plan->forward(out_ctf);
+
+        auto out_correct = in;
+        ctf::details::dft_naive(out_correct);
+
+        for (int i = 0; i < size; i++) {
+            REQUIRE(close_enough(out_ctf[i], out_correct[i]));
+        }
+
+        plan->inverse(out_ctf);
+        for (int i = 0; i < size; i++) {
+            REQUIRE(close_enough(out_ctf[i], in[i]));
+        }
+    }
+}
+
+TEST_CASE("Every FFT algorithm matches naive DFT" "[ctf::FftPlan][ctf::FftAlgorithm]") {
+    std::uniform_real_distribution<double> unif(-1,1);
+    std::default_random_engine re;
+
+    for (auto algorithm : {ctf::FftAlgorithm::radix4, ctf::FftAlgorithm::radix2, ctf::FftAlgorithm::split_radix,
+                           ctf::FftAlgorithm::four_step}) {
+        // Powers of 2 on both sides of the codelet size and sizes falling back to other stages
+        for (uint32_t size : {1, 2, 16, 64, 128, 256, 2048, 4096, 96, 1000, 97}) {
+            std::vector<std::complex<double>> in (size);
+            for (auto& c : in) {
+                c = comp(unif(re), unif(re));
+            }
+
+            const auto plan = ctf::get_plan(size, algorithm);
+            REQUIRE(plan->fft_algorithm() == algorithm);
+            auto out_ctf = in;
+            plan->forward(out_ctf);
+            std::vector<double> out_re (size), out_im (size);
+            plan->forward(reinterpret_cast<const double*>(in.data()), out_re.data(), out_im.data());
+
+            auto out_correct = in;
+            ctf::details::dft_naive(out_correct);
+
+            for (int i = 0; i < size; i++) {
+                REQUIRE(close_enough(out_ctf[i], out_correct[i]));
+                REQUIRE(close_enough(comp(out_re[i], out_im[i]), out_correct[i]));
+            }
+
+            std::vector<double> real (size);
+            plan->inverse_real(out_ctf.data(), real.data());
+            plan->inverse(out_ctf);
+            plan->inverse(out_re.data(), out_im.data());
+            for (int i = 0; i < size; i++) {
+                REQUIRE(close_enough(out_ctf[i], in[i]));
+                REQUIRE(close_enough(comp(out_re[i], out_im[i]), in[i]));
+                REQUIRE(close_enough(real[i], in[i].real()));
+            }
+        }
+    }
+
+    // Selectable behind radix2fft
+    std::vector<double> samples (1000);
+    for (auto& s : samples) {
+        s = unif(re);
+    }
+    const auto series = ctf::radix2fft(samples);
+    const auto split_series = ctf::radix2fft(samples, ctf::FftAlgorithm::split_radix);
+    for (int i = 0; i < series.size(); i++) {
+        REQUIRE(close_enough(series[i], split_series[i]));
+    }
+    REQUIRE(ctf::get_plan(1024) != ctf::get_plan(1024, ctf::FftAlgorithm::split_radix));
+}
+
+TEST_CASE("Split complex SIMD kernels match naive DFT" "[ctf::FftPlan][ctf::simd]") {
+    std::uniform_real_distribution<double> unif(-1,1);
+    std::default_random_engine re;
+
+    const auto supported = ctf::simd::supported_isa();
+    for (auto isa : {ctf::simd::Isa::scalar, ctf::simd::Isa::sse2, ctf::simd::Isa::avx2}) {
+        if (isa > supported) continue;
+        ctf::simd::set_isa(isa);
+        REQUIRE(ctf::simd::active_isa() == isa);
+
+        for (uint32_t size : {1, 2, 4, 8, 12, 15, 16, 60, 64, 97, 128, 360, 1000, 1024}) {
+            std::vector<std::complex<double>> in (size);
+            for (auto& c : in) {
+                c = comp(unif(re), unif(re));
+            }
+
+            auto out_correct = in;
+            ctf::details::dft_naive(out_correct);
+
+            // In place from split input
+            std::vector<double> in_re (size), in_im (size);
+            for (int i = 0; i < size; i++) {
+                in_re[i] = in[i].real();
+                in_im[i] = in[i].imag();
+            }
+            const auto plan = ctf::get_plan(size);
+            auto out_re = in_re, out_im = in_im;
+            plan->forward(out_re.data(), out_im.data());
+            for (int i = 0; i < size; i++) {
+                REQUIRE(close_enough(comp(out_re[i], out_im[i]), out_correct[i]));
+            }
+
+            plan->inverse(out_re.data(), out_im.data());
+            for (int i = 0; i < size; i++) {
+                REQUIRE(close_enough(comp(out_re[i], out_im[i]), in[i]));
+            }
+
+            // Out of place from interleaved input
+            plan->forward(reinterpret_cast<const double*>(in.data()), out_re.data(), out_im.data());
+            for (int i = 0; i < size; i++) {
+                REQUIRE(close_enough(comp(out_re[i], out_im[i]), out_correct[i]));
+            }
+        }
+
+        // Real transforms run on the split kernels
+        std::vector<double> samples (4096);
+        for (auto& s : samples) {
+            s = unif(re);
+        }
+        auto series = ctf::rfft(samples);
+        std::vector<std::complex<double>> full (samples.begin(), samples.end());
+        ctf::details::dft_naive(full);
+        for (int i = 0; i < series.size(); i++) {
+            REQUIRE(close_enough(series[i], full[i]));
+        }
+        const auto transformed = ctf::irfft(series);
+        for (int i = 0; i < samples.size(); i++) {
+            REQUIRE(close_enough(transformed[i], samples[i]));
+        }
+    }
+    ctf::simd::set_isa(supported);
+}
+
+TEST_CASE("Transform length is the cheapest even length" "[ctf::fft_size]") {
+    REQUIRE(ctf::fft_size(0) == 2);
+    REQUIRE(ctf::fft_size(1024) == 1024);
+    REQUIRE(ctf::fft_size(1001) == 1024);
+    REQUIRE(ctf::fft_size(102400) == 102400);
+
+    // Just past a power of 2 doesn't double the length
+    REQUIRE(ctf::fft_size(65537) < 80000);
+
+    for (std::size_t size = 1; size < 5000; size += 37) {
+        const auto length = ctf::fft_size(size);
+        REQUIRE(length >= size);
+        REQUIRE(length % 2 == 0);
+        REQUIRE(ctf::fft_cost(length / 2) <= ctf::fft_cost(std::bit_ceil(size)));
+    }
+}
+
+// Documented error bounds for signals in [-1, 1]:
+// spectrum error is the relative RMS error against the naive DFT in double precision,
+// round trip error is the largest absolute error of rfft followed by irfft.
+//   double: spectrum 1e-12 (mostly error of the naive DFT itself), round trip 1e-13
+//   float:  spectrum 1e-6, round trip 2e-6
+template <typename T>
+void check_error_bounds(double spectrum_bound, double round_trip_bound) {
+    std::uniform_real_distribution<double> unif(-1,1);
+    std::default_random_engine re;
+
+    for (uint32_t size : {16, 64, 360, 1000, 1024, 2310}) {
+        std::vector<T> samples (size);
+        for (auto& s : samples) {
+            s = unif(re);
+        }
+        // rfft zero pads to its transform length
+        const auto series = ctf::rfft(samples);
+        std::vector<std::complex<double>> reference (2 * (series.size() - 1));
+        std::copy(samples.begin(), samples.end(), reference.begin());
+        ctf::details::dft_naive(reference);
+
+        double error = 0, total = 0;
+        for (int i = 0; i < series.size(); i++) {
+            error += std::norm(std::complex<double>(series[i]) - reference[i]);
+            total += std::norm(reference[i]);
+        }
+        REQUIRE(std::sqrt(error / total) < spectrum_bound);
+
+        const auto transformed = ctf::irfft(series);
+        for (int i = 0; i < size; i++) {
+            REQUIRE(std::abs(transformed[i] - samples[i]) < round_trip_bound);
+        }
+    }
+}
+
+TEST_CASE("Transforms stay within error bounds of their precision" "[ctf::rfft][ctf::irfft]") {
+    const auto supported = ctf::simd::supported_isa();
+    for (auto isa : {ctf::simd::Isa::scalar, ctf::simd::Isa::sse2, ctf::simd::Isa::avx2}) {
+        if (isa > supported) continue;
+        ctf::simd::set_isa(isa);
+        check_error_bounds<double>(1e-12, 1e-13);
+        check_error_bounds<float>(1e-6, 2e-6);
+    }
+    ctf::simd::set_isa(supported);
+
+    // Float filtering agrees with double filtering to the float bound
+    const std::vector<ctf::Band> bands {{0, 2000, 0, 0.5}};
+    std::vector<double> samples (4000);
+    for (int i = 0; i < samples.size(); i++) {
+        samples[i] = std::sin(i * 0.01) + 0.5 * std::sin(i * 1.3);
+    }
+    std::vector<float> samples_float (samples.begin(), samples.end());
+    ctf::filter_samples(samples, 44100, bands, 50);
+    ctf::filter_samples(samples_float, 44100, bands, 50);
+    for (int i = 0; i < samples.size(); i++) {
+        REQUIRE(std::abs(samples[i] - samples_float[i]) < 2e-6);
+    }
+}
+
+// Checks a codelet against the naive DFT and its inverse against the input
+template <std::size_t N>
+void check_codelet() {
+    std::uniform_real_distribution<double> unif(-1,1);
+    std::default_random_engine re;
+
+    std::array<std::complex<double>, N> in;
+    for (auto& c : in) {
+        c = comp(unif(re), unif(re));
+    }
+
+    // Strided codelets read every other value
+    std::vector<std::complex<double>> strided (2 * N);
+    for (int i = 0; i < N; i++) {
+        strided[2 * i] = in[i];
+    }
+    std::array<std::complex<double>, N> out_ctf;
+    ctf::details::strided_codelet<false, N, double>(strided.data(), 2, out_ctf.data());
+
+    std::vector<std::complex<double>> out_correct (in.begin(), in.end());
+    ctf::details::dft_naive(out_correct);
+
+    for (int i = 0; i < N; i++) {
+        REQUIRE(close_enough(out_ctf[i], out_correct[i]));
+    }
+
+    auto inverse = out_ctf;
+    ctf::details::strided_codelet<true, N, double>(out_ctf.data(), 1, inverse.data());
+    for (int i = 0; i < N; i++) {
+        REQUIRE(close_enough(inverse[i] / (double)N, in[i]));
+    }
+}
+
+TEST_CASE("Codelets match naive DFT" "[ctf::details::strided_codelet]") {
+    // Compile time twiddles are as accurate as the runtime ones
+    for (std::size_t m = 0; m < 64; m++) {
+        const auto w = ctf::details::const_twiddle<double>(m, 64);
+        REQUIRE(std::abs(w - std::polar(1.0, -2 * M_PI * m / 64)) < 1e-15);
+    }
+
+    check_codelet<2>();
+    check_codelet<4>();
+    check_codelet<8>();
+    check_codelet<16>();
+    check_codelet<32>();
+    check_codelet<64>();
+    REQUIRE(ctf::details::get_codelet<false, double>(64) == ctf::details::codelet<false, 64, double>);
+    REQUIRE(ctf::details::get_split_codelet<true, float>(64) == ctf::details::split_codelet<true, 64, float>);
+    for (std::size_t size : {0, 3, 48, 128}) {
+        REQUIRE_THROWS_AS((ctf::details::get_codelet<false, double>(size)), std::invalid_argument);
+        REQUIRE_THROWS_AS((ctf::details::get_strided_codelet<false, double>(size)), std::invalid_argument);
+        REQUIRE_THROWS_AS((ctf::details::get_split_codelet<false, double>(size)), std::invalid_argument);
+    }
+
+    // Plans use the codelets as leaves for the leading stages, split & interleaved
+    for (uint32_t size : {8, 32, 64, 96, 128, 320, 2048}) {
+        std::vector<std::complex<double>> in (size);
+        for (int i = 0; i < size; i++) {
+            in[i] = comp(std::sin(i * 0.7), std::cos(i * 0.3));
+        }
+
+        auto out_ctf = in;
+        ctf::get_plan(size)->forward(out_ctf);
+        std::vector<double> out_re (size), out_im (size);
+        ctf::get_plan(size)->forward(reinterpret_cast<const double*>(in.data()), out_re.data(), out_im.data());
+
+        auto out_correct = in;
+        ctf::details::dft_naive(out_correct);
+
+        for (int i = 0; i < size; i++) {
+            REQUIRE(close_enough(out_ctf[i], out_correct[i]));
+            REQUIRE(close_enough(comp(out_re[i], out_im[i]), out_correct[i]));
+        }
+    }
+}
+
+TEST_CASE("FFT plans are shared and validate sizes" "[ctf::get_plan]") {
+    REQUIRE(ctf::get_plan(256) == ctf::get_plan(256));
+    REQUIRE_THROWS(ctf::FftPlan(0));
+
+    std::vector<std::complex<double>> wrong_size (128);
+    REQUIRE_THROWS(ctf::get_plan(256)->forward(wrong_size));
+}
+
+TEST_CASE("Caches drop the least recently used values past their limit" "[ctf::details::LruCache]") {
+    ctf::details::LruCache<int, int> cache(100);
+    auto first = cache.insert(1, std::make_shared<const int>(1), 40);
+    cache.insert(2, std::make_shared<const int>(2), 40);
+    REQUIRE(cache.find(1) == first);
+
+    // 2 is the least recently used
+    cache.insert(3, std::make_shared<const int>(3), 40);
+    REQUIRE(cache.size() == 2);
+    REQUIRE(cache.bytes() == 80);
+    REQUIRE(cache.find(2) == nullptr);
+    REQUIRE(*cache.find(1) == 1);
+
+    // The earlier value wins & a value over the limit alone is kept
+    REQUIRE(*cache.insert(3, std::make_shared<const int>(4), 40) == 3);
+    cache.insert(5, std::make_shared<const int>(5), 500);
+    REQUIRE(cache.size() == 1);
+    REQUIRE(*cache.find(5) == 5);
+    REQUIRE(*first == 1);
+
+    REQUIRE(ctf::get_real_plan(1 << 12)->bytes() > (1 << 12) * sizeof(double));
+}
+
 TEST_CASE("FFT goes around" "[ctf::radix2fft][ctf::radix2fft_inverse]") {
     constexpr const uint32_t test_size = 131072;
 
@@ -204,7 +557,127 @@ TEST_CASE("FFT goes around" "[ctf::radix2fft][ctf::radix2fft_inverse]") {
     }
 }
 
-TEST_CASE("Frequency removal" "[ctf::radix2fft][ctf::radix2fft_inverse][ctf::band_cut]") {
+TEST_CASE("Real FFT matches complex FFT" "[ctf::rfft]") {
+    std::uniform_real_distribution<double> unif(-1,1);
+    std::default_random_engine re;
+
+    for (uint32_t size : {2, 4, 8, 1000, 1001, 4096, 2 * 1009}) {
+        std::vector<double> samples (size);
+        for (auto& s : samples) {
+            s = unif(re);
+        }
+
+        std::vector<std::complex<double>> full (ctf::fft_size(size), comp(0, 0));
+        std::copy(samples.begin(), samples.end(), full.begin());
+        ctf::get_plan(full.size())->forward(full);
+
+        const auto half = ctf::rfft(samples);
+
+        REQUIRE(half.size() == full.size() / 2 + 1);
+        for (int i = 0; i < half.size(); i++) {
+            REQUIRE(close_enough(half[i], full[i]));
+        }
+    }
+}
+
+TEST_CASE("Real FFT goes around" "[ctf::rfft][ctf::irfft]") {
+    constexpr const uint32_t test_size = 131072;
+
+    std::vector<double> original (test_size);
+
+    std::uniform_real_distribution<double> unif(0,1);
+    std::default_random_engine re;
+
+    for (int i = 0; i < test_size; i++) {
+        original[i] = unif(re);
+    }
+
+    auto series = ctf::rfft(original);
+    auto transformed = ctf::irfft(series);
+
+    REQUIRE(transformed.size() == test_size);
+    for (int i = 0; i < test_size; i++) {
+        REQUIRE(close_enough(original[i], transformed[i]));
+    }
+
+    std::vector<std::complex<double>> bad_size (1);
+    REQUIRE_THROWS(ctf::irfft(bad_size));
+}
+
+TEST_CASE("Batched transforms match one transform at a time" "[ctf::BatchFftPlan][ctf::BatchRealFftPlan]") {
+    std::uniform_real_distribution<double> unif(-1,1);
+    std::default_random_engine re;
+    ctf::ThreadPool pool(3);
+
+    for (std::size_t size : {2, 6, 8, 60, 64, 250, 1024, 2 * 1009}) {
+        for (std::size_t batch : {1, 3, 8, 13, 40}) {
+            const auto plan = ctf::get_batch_plan(size);
+            const auto real_plan = ctf::get_batch_real_plan(size);
+            std::vector<double> in_re (size * batch), in_im (size * batch), out_re (size * batch), out_im (size * batch);
+            for (std::size_t i = 0; i < size * batch; i++) {
+                in_re[i] = unif(re);
+                in_im[i] = unif(re);
+            }
+
+            // Complex batches, every signal against its own transform
+            plan->forward(in_re.data(), in_im.data(), out_re.data(), out_im.data(), batch, &pool);
+            for (std::size_t b = 0; b < batch; b++) {
+                std::vector<std::complex<double>> signal (size);
+                for (std::size_t i = 0; i < size; i++) {
+                    signal[i] = comp(in_re[i * batch + b], in_im[i * batch + b]);
+                }
+                ctf::get_plan(size)->forward(signal);
+                for (std::size_t i = 0; i < size; i++) {
+                    REQUIRE(close_enough(comp(out_re[i * batch + b], out_im[i * batch + b]), signal[i]));
+                }
+            }
+            std::vector<double> back_re (size * batch), back_im (size * batch);
+            plan->inverse(out_re.data(), out_im.data(), back_re.data(), back_im.data(), batch);
+            for (std::size_t i = 0; i < size * batch; i++) {
+                REQUIRE(close_enough(back_re[i], in_re[i]));
+                REQUIRE(close_enough(back_im[i], in_im[i]));
+            }
+
+            // Real batches
+            const std::size_t bins = size / 2 + 1;
+            std::vector<double> spectrum_re (bins * batch), spectrum_im (bins * batch), samples (size * batch);
+            real_plan->forward(in_re.data(), spectrum_re.data(), spectrum_im.data(), batch, &pool);
+            for (std::size_t b = 0; b < batch; b++) {
+                std::vector<double> signal (size);
+                for (std::size_t i = 0; i < size; i++) {
+                    signal[i] = in_re[i * batch + b];
+                }
+                std::vector<std::complex<double>> spectrum (bins);
+                ctf::get_real_plan(size)->forward(signal.data(), spectrum.data());
+                for (std::size_t k = 0; k < bins; k++) {
+                    REQUIRE(close_enough(comp(spectrum_re[k * batch + b], spectrum_im[k * batch + b]), spectrum[k]));
+                }
+            }
+            real_plan->inverse(spectrum_re.data(), spectrum_im.data(), samples.data(), batch, &pool);
+            for (std::size_t i = 0; i < size * batch; i++) {
+                REQUIRE(close_enough(samples[i], in_re[i]));
+            }
+        }
+    }
+
+    // Lanes are the same with any instruction set
+    const auto isa = ctf::simd::active_isa();
+    std::vector<double> in (64 * 5, 0.5), vector_re (33 * 5), vector_im (33 * 5), scalar_re (33 * 5), scalar_im (33 * 5);
+    in[7] = -1;
+    ctf::get_batch_real_plan(64)->forward(in.data(), vector_re.data(), vector_im.data(), 5);
+    ctf::simd::set_isa(ctf::simd::Isa::scalar);
+    ctf::get_batch_real_plan(64)->forward(in.data(), scalar_re.data(), scalar_im.data(), 5);
+    ctf::simd::set_isa(isa);
+    for (std::size_t i = 0; i < vector_re.size(); i++) {
+        REQUIRE(close_enough(vector_re[i], scalar_re[i], 1e-12));
+        REQUIRE(close_enough(vector_im[i], scalar_im[i], 1e-12));
+    }
+
+    REQUIRE_THROWS_AS(ctf::BatchFftPlan(0), std::invalid_argument);
+    REQUIRE_THROWS_AS(ctf::BatchRealFftPlan(7), std::invalid_argument);
+}
+
+TEST_CASE("Frequency removal" "[ctf::rfft][ctf::irfft][ctf::band_cut]") {
     std::vector<double> sine440(sample_rate);
     std::vector<double> sine1000(sample_rate);
     
@@ -216,13 +689,1163 @@ TEST_CASE("Frequency removal" "[ctf::radix2fft][ctf::radix2fft_inverse][ctf::ban
     std::vector<double> sine_sum(sample_rate);
     std::transform(sine440.begin(), sine440.end(), sine1000.begin(), sine_sum.begin(), std::plus<double>());
 
-    auto transform = ctf::radix2fft(sine_sum);
+    auto transform = ctf::rfft(sine_sum);
     ctf::Band cut_1000(900, 1100, 0, 0);
     ctf::band_cut(transform, sample_rate, cut_1000, 100);
-    auto result = ctf::radix2fft_inverse(transform);
+    auto result = ctf::irfft(transform);
 
     // Skip the first 50 000 samples since there are some artefacts
     for (int i = 50000; i < sample_rate - 50000; i++) {
         REQUIRE(close_enough(result[i], sine440[i]));
     }
-}
\ No newline at end of file
+}
+
+// --------------------- TEST BLOCK FILTER --------------------
+
+TEST_CASE("Band gains match band cut" "[ctf::band_gains]") {
+    const std::vector<ctf::Band> bands {{100, 200, 0, 0.5}, {5000, 8000, 0.2, 0.2}};
+    auto series(test_vector);
+    for (const auto& band : bands) {
+        ctf::band_cut(series, sample_rate, band, 50);
+    }
+
+    const auto gains = ctf::band_gains(sample_rate, sample_rate, bands, 50);
+
+    REQUIRE(gains.size() == series.size());
+    for (int i = 0; i < gains.size(); i++) {
+        REQUIRE(close_enough(series[i], comp(gains[i], gains[i])));
+    }
+}
+
+TEST_CASE("Filter response is applied in one pass" "[ctf::FilterResponse]") {
+    std::vector<ctf::Band> bands;
+    for (uint32_t freq = 1000; freq < 20000; freq += 1000) {
+        bands.push_back({freq, freq + 300, 0.1, 0.9});
+    }
+    auto expected(test_vector);
+    for (const auto& band : bands) {
+        ctf::band_cut(expected, sample_rate, band, 100);
+    }
+
+    const ctf::FilterResponse response(sample_rate, sample_rate, bands, 100);
+    REQUIRE(response.size() == test_vector.size());
+    auto series(test_vector);
+    response.apply(series);
+    for (int i = 0; i < series.size(); i++) {
+        REQUIRE(close_enough(series[i], expected[i]));
+    }
+
+    std::vector<std::complex<double>> wrong_size (10);
+    REQUIRE_THROWS_AS(response.apply(wrong_size), std::invalid_argument);
+    REQUIRE_THROWS_AS(ctf::FilterResponse(sample_rate, sample_rate, {{100, 50, 0, 0}}, 100), std::invalid_argument);
+}
+
+TEST_CASE("Block filter without bands passes input through" "[ctf::BlockFilter]") {
+    std::vector<double> in (10000);
+    std::uniform_real_distribution<double> unif(-1,1);
+    std::default_random_engine re;
+    for (auto& s : in) {
+        s = unif(re);
+    }
+
+    ctf::BlockFilter filter(sample_rate, {}, 0, 256);
+    std::vector<double> out;
+    filter.process(in.data(), in.size(), out);
+    filter.flush(out);
+
+    REQUIRE(out.size() == in.size());
+    for (int i = 0; i < in.size(); i++) {
+        REQUIRE(close_enough(out[i], in[i]));
+    }
+}
+
+TEST_CASE("Block filter output does not depend on chunking" "[ctf::BlockFilter]") {
+    std::vector<double> in (20000);
+    for (int i = 0; i < in.size(); i++) {
+        in[i] = sin(2 * M_PI * 1000.0 * i / sample_rate) + sin(2 * M_PI * 5000.0 * i / sample_rate);
+    }
+    const std::vector<ctf::Band> bands {{900, 1100, 0, 0}};
+
+    ctf::BlockFilter whole(sample_rate, bands, 100, 1024);
+    std::vector<double> out_whole;
+    whole.process(in.data(), in.size(), out_whole);
+    whole.flush(out_whole);
+
+    ctf::BlockFilter chunked(sample_rate, bands, 100, 1024);
+    std::vector<double> out_chunked;
+    for (int pos = 0; pos < in.size(); pos += 77) {
+        chunked.process(&in[pos], std::min<std::size_t>(77, in.size() - pos), out_chunked);
+    }
+    chunked.flush(out_chunked);
+
+    REQUIRE(out_whole.size() == in.size());
+    REQUIRE(out_chunked == out_whole);
+}
+
+TEST_CASE("Block filter removes frequencies" "[ctf::BlockFilter]") {
+    std::vector<double> in (sample_rate);
+    for (int i = 0; i < sample_rate; i++) {
+        in[i] = sin(2 * M_PI * 440.0 * i / sample_rate) + sin(2 * M_PI * 3000.0 * i / sample_rate);
+    }
+
+    ctf::BlockFilter filter(sample_rate, {{2500, 3500, 0, 0}}, 200, 4096);
+    std::vector<double> out;
+    filter.process(in.data(), in.size(), out);
+    filter.flush(out);
+
+    // Skip the filter's transients at both ends
+    for (int i = 4096; i < sample_rate - 4096; i++) {
+        REQUIRE(close_enough(out[i], sin(2 * M_PI * 440.0 * i / sample_rate), 1e-2));
+    }
+}
+
+TEST_CASE("Block filter cuts bands narrower than a bin" "[ctf::BlockFilter]") {
+    std::vector<double> in (20000);
+    for (int i = 0; i < in.size(); i++) {
+        in[i] = sin(2 * M_PI * 50.0 * i / sample_rate);
+    }
+
+    // 49 & 51 Hz fall in the same bin of a 4096 point design
+    ctf::BlockFilter filter(sample_rate, {{49, 51, 0, 0}}, 50, 4096);
+    std::vector<double> out;
+    filter.process(in.data(), in.size(), out);
+    filter.flush(out);
+
+    REQUIRE(out.size() == in.size());
+    REQUIRE(std::none_of(out.begin(), out.end(), [](double v) { return std::isnan(v); }));
+    // Cut as far as the design's resolution allows, away from the transients
+    for (int i = 4096; i < in.size() - 4096; i++) {
+        REQUIRE(std::abs(out[i]) < 0.3);
+    }
+}
+
+TEST_CASE("Streams are filtered like blocks" "[ctf::filter_stream][ctf::PartitionedFilter]") {
+    std::vector<double> in (10000);
+    for (int i = 0; i < in.size(); i++) {
+        in[i] = sin(2 * M_PI * 440.0 * i / sample_rate) + sin(2 * M_PI * 3000.0 * i / sample_rate);
+    }
+    const std::vector<ctf::Band> bands {{2500, 3500, 0, 0}};
+
+    // Same filter as the block filter, with output of the same length & alignment
+    ctf::BlockFilter filter(sample_rate, bands, 200, 4096);
+    std::vector<double> expected;
+    filter.process(in.data(), in.size(), expected);
+    filter.flush(expected);
+
+    for (std::size_t block_size : {64, 1000, 8192}) {
+        std::FILE* raw_in = std::tmpfile();
+        std::FILE* raw_out = std::tmpfile();
+        std::fwrite(in.data(), sizeof(double), in.size(), raw_in);
+        std::rewind(raw_in);
+
+        const ctf::WavFormat format {1, sample_rate, ctf::WavEncoding::float64};
+        const auto report = ctf::filter_stream<double>(raw_in, raw_out, format, bands, 200, block_size, 4096);
+        REQUIRE(report.frames == in.size());
+        REQUIRE(report.latency_frames() == block_size + 1024);
+
+        std::vector<double> out (in.size() + 1);
+        std::rewind(raw_out);
+        REQUIRE(std::fread(out.data(), sizeof(double), out.size(), raw_out) == in.size());
+        for (int i = 0; i < in.size(); i++) {
+            REQUIRE(close_enough(out[i], expected[i]));
+        }
+        std::fclose(raw_in);
+        std::fclose(raw_out);
+    }
+
+    // Headers of streamed WAVE files are read without seeking
+    std::FILE* wav = std::tmpfile();
+    ctf::write_wav_header(wav, {2, 48000, ctf::WavEncoding::pcm24});
+    std::rewind(wav);
+    const auto format = ctf::read_wav_header(wav);
+    REQUIRE(format.channels == 2);
+    REQUIRE(format.sample_rate == 48000);
+    REQUIRE(format.encoding == ctf::WavEncoding::pcm24);
+    std::fclose(wav);
+
+    REQUIRE_THROWS(ctf::PartitionedFilter(sample_rate, bands, 200, 0));
+}
+
+TEST_CASE("Thread pool runs nested loops" "[ctf::ThreadPool]") {
+    ctf::ThreadPool pool(4);
+    REQUIRE(pool.size() == 4);
+
+    std::vector<std::atomic<int>> visits (1000);
+    pool.parallel_for(10, [&](std::size_t first, std::size_t last) {
+        for (std::size_t outer = first; outer < last; outer++) {
+            pool.parallel_for(100, [&](std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i < end; i++) {
+                    visits[outer * 100 + i]++;
+                }
+            });
+        }
+    }, 10);
+    for (const auto& v : visits) {
+        REQUIRE(v == 1);
+    }
+
+    REQUIRE_THROWS_AS(pool.parallel_for(100, [](std::size_t begin, std::size_t) {
+        if (begin > 0) throw std::runtime_error("chunk failed");
+    }), std::runtime_error);
+}
+
+TEST_CASE("Bounded queue hands every value to one consumer" "[ctf::BoundedQueue]") {
+    ctf::BoundedQueue<int> queue(3);
+    REQUIRE(queue.capacity() == 4);
+    for (int i = 0; i < 4; i++) {
+        REQUIRE(queue.try_push(i));
+    }
+    REQUIRE(!queue.try_push(4));
+    int value;
+    REQUIRE(queue.try_pop(value));
+    REQUIRE(value == 0);
+
+    // Producers block while the queue is full, consumers while it's empty
+    constexpr int producers = 3, consumers = 2, count = 20000;
+    ctf::BoundedQueue<int> shared(8);
+    std::vector<std::atomic<int>> seen (producers * count);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&, p] {
+            for (int i = 0; i < count; i++) shared.push(p * count + i);
+        });
+    }
+    for (int c = 0; c < consumers; c++) {
+        threads.emplace_back([&] {
+            for (int v = shared.pop(); v >= 0; v = shared.pop()) seen[v]++;
+        });
+    }
+    for (int p = 0; p < producers; p++) {
+        threads[p].join();
+    }
+    for (int c = 0; c < consumers; c++) {
+        shared.push(-1);
+    }
+    for (int c = 0; c < consumers; c++) {
+        threads[producers + c].join();
+    }
+    for (const auto& s : seen) {
+        REQUIRE(s == 1);
+    }
+}
+
+TEST_CASE("Parallel transforms are identical to serial ones" "[ctf::FftPlan][ctf::rfft][ctf::ThreadPool]") {
+    std::uniform_real_distribution<double> unif(-1,1);
+    std::default_random_engine re;
+    ctf::ThreadPool pool(4);
+
+    for (uint32_t size : {1 << 15, 1 << 17, 3 << 15, 5 << 14, 1 << 20}) {
+        std::vector<std::complex<double>> in (size);
+        for (auto& c : in) {
+            c = comp(unif(re), unif(re));
+        }
+        const auto plan = ctf::get_plan(size);
+
+        auto serial = in, parallel = in;
+        plan->forward(serial.data());
+        plan->forward(parallel.data(), &pool);
+        REQUIRE(serial == parallel);
+
+        const auto four_step = ctf::get_plan(size, ctf::FftAlgorithm::four_step);
+        serial = parallel = in;
+        four_step->forward(serial.data());
+        four_step->forward(parallel.data(), &pool);
+        REQUIRE(serial == parallel);
+
+        std::vector<double> serial_re (size), serial_im (size), parallel_re (size), parallel_im (size);
+        plan->forward(reinterpret_cast<const double*>(in.data()), serial_re.data(), serial_im.data());
+        plan->forward(reinterpret_cast<const double*>(in.data()), parallel_re.data(), parallel_im.data(), &pool);
+        REQUIRE(serial_re == parallel_re);
+        REQUIRE(serial_im == parallel_im);
+
+        plan->inverse(serial_re.data(), serial_im.data());
+        plan->inverse(parallel_re.data(), parallel_im.data(), &pool);
+        REQUIRE(serial_re == parallel_re);
+        REQUIRE(serial_im == parallel_im);
+
+        std::vector<double> samples (2 * size);
+        for (auto& s : samples) {
+            s = unif(re);
+        }
+        const auto series = ctf::rfft(samples);
+        REQUIRE(series == ctf::rfft(samples, &pool));
+        REQUIRE(ctf::irfft(series) == ctf::irfft(series, &pool));
+    }
+}
+
+TEST_CASE("Batch manifest is parsed" "[ctf::parse_manifest]") {
+    std::istringstream manifest("# comment\n"
+                                "a.wav out/a.wav band 0 0 100 0\n"
+                                "\n"
+                                "b.wav out/b.wav band 100 1 200 0.5 band 1000 0 2000 0 -r 10\n");
+    const auto jobs = ctf::parse_manifest(manifest);
+    REQUIRE(jobs.size() == 2);
+    REQUIRE(jobs[0].in_name == "a.wav");
+    REQUIRE(jobs[0].out_name == "out/a.wav");
+    REQUIRE(jobs[0].roll == 50);
+    REQUIRE(jobs[0].bands == std::vector<ctf::Band> {{0, 100, 0, 0}});
+    REQUIRE(jobs[1].bands.size() == 2);
+    REQUIRE(jobs[1].bands[0] == ctf::Band {100, 200, 1, 0.5});
+    REQUIRE(jobs[1].roll == 10);
+
+    for (auto bad : {"a.wav\n", "a.wav b.wav\n", "a.wav b.wav band 0 0 100\n", "a.wav b.wav band 0 0 100 0 -x\n"}) {
+        std::istringstream bad_manifest(bad);
+        REQUIRE_THROWS_AS(ctf::parse_manifest(bad_manifest), std::invalid_argument);
+    }
+}
+
+TEST_CASE("Filtering samples matches band cut" "[ctf::filter_samples][ctf::get_filter_response]") {
+    const std::vector<ctf::Band> bands {{0, 2000, 0, 0.5}, {5000, 6000, 1, 0}};
+    const auto response = ctf::get_filter_response(4096, 44100, bands, 50);
+    REQUIRE(response == ctf::get_filter_response(4096, 44100, bands, 50));
+    REQUIRE(response != ctf::get_filter_response(4096, 44100, bands, 40));
+    REQUIRE(response != ctf::get_filter_response(8192, 44100, bands, 50));
+
+    std::uniform_real_distribution<double> unif(-1,1);
+    std::default_random_engine re;
+    std::vector<double> samples (4000);
+    for (auto& s : samples) {
+        s = unif(re);
+    }
+
+    auto series = ctf::rfft(samples);
+    for (const auto& band : bands) {
+        ctf::band_cut(series, 44100, band, 50);
+    }
+    auto expected = ctf::irfft(series);
+
+    ctf::filter_samples(samples, 44100, bands, 50);
+    REQUIRE(samples.size() == 4000);
+    for (int i = 0; i < samples.size(); i++) {
+        REQUIRE(close_enough(samples[i], expected[i]));
+    }
+}
+
+TEST_CASE("WAVE files go around" "[ctf::WavReader][ctf::WavWriter]") {
+    const auto path = (std::filesystem::temp_directory_path() / "ctf_test.wav").string();
+    std::vector<double> left (1000), right (1000);
+    for (int i = 0; i < left.size(); i++) {
+        left[i] = std::sin(i * 0.05) * 0.9;
+        right[i] = -left[i] * 0.5;
+    }
+
+    using ctf::WavEncoding;
+    const std::pair<WavEncoding, double> encodings[] {{WavEncoding::pcm8, 1.0 / 128}, {WavEncoding::pcm16, 1.0 / 32768},
+                                                      {WavEncoding::pcm24, 1.0 / 8388608}, {WavEncoding::pcm32, 1e-9},
+                                                      {WavEncoding::float32, 1e-7}, {WavEncoding::float64, 0}};
+    for (auto [encoding, lsb] : encodings) {
+        {
+            ctf::WavWriter writer(path, {2, 48000, encoding}, left.size());
+            writer.write(0, 0, left.size(), left.data());
+            writer.write(1, 0, 600, right.data());
+            writer.write(1, 600, 400, right.data() + 600);
+            writer.finish();
+        }
+
+        const ctf::WavReader reader(path);
+        REQUIRE(reader.channels() == 2);
+        REQUIRE(reader.sample_rate() == 48000);
+        REQUIRE(reader.frames() == left.size());
+        REQUIRE(reader.wav_format().encoding == encoding);
+
+        std::vector<double> read (left.size());
+        reader.read(0, 0, left.size(), read.data());
+        for (int i = 0; i < left.size(); i++) {
+            REQUIRE(std::abs(read[i] - left[i]) <= lsb);
+        }
+        std::vector<float> chunk (100);
+        reader.read(1, 500, 100, chunk.data());
+        for (int i = 0; i < chunk.size(); i++) {
+            REQUIRE(std::abs(chunk[i] - right[500 + i]) <= lsb + 1e-7);
+        }
+        REQUIRE_THROWS_AS(reader.read(2, 0, 1, read.data()), std::invalid_argument);
+        REQUIRE_THROWS_AS(reader.read(0, 900, 101, read.data()), std::invalid_argument);
+    }
+
+    // Samples outside [-1, 1] are clipped
+    {
+        const std::vector<double> loud {2, -2};
+        ctf::WavWriter writer(path, {1, 8000, WavEncoding::pcm16}, 2);
+        writer.write(0, 0, 2, loud.data());
+        writer.finish();
+    }
+    std::vector<double> clipped (2);
+    ctf::WavReader(path).read(0, 0, 2, clipped.data());
+    REQUIRE(clipped[0] == 32767.0 / 32768);
+    REQUIRE(clipped[1] == -1);
+
+    std::ofstream(path) << "not a wave file";
+    REQUIRE_THROWS_AS(ctf::WavReader(path), std::invalid_argument);
+
+    // Format chunks cut short by the end of the file or by their size are rejected
+    std::ofstream(path, std::ios::binary) << std::string("RIFF\0\0\0\0WAVEfmt \x10\0\0\0\1\0", 22);
+    REQUIRE_THROWS_AS(ctf::WavReader(path), std::invalid_argument);
+    std::ofstream(path, std::ios::binary) << std::string("RIFF\0\0\0\0WAVEfmt \4\0\0\0\1\0\1\0data\0\0\0\0", 32);
+    REQUIRE_THROWS_AS(ctf::WavReader(path), std::invalid_argument);
+
+    // Sizes past 4 GiB don't fit the header
+    REQUIRE_THROWS_AS(ctf::WavWriter(path, {2, 48000, WavEncoding::float64}, std::size_t(1) << 28),
+                      std::invalid_argument);
+    REQUIRE(!std::filesystem::exists(path + ".part"));
+    std::filesystem::remove(path);
+    REQUIRE_THROWS_AS(ctf::WavReader(path), std::runtime_error);
+}
+
+TEST_CASE("Stats record stages" "[ctf::Stats]") {
+    ctf::Stats stats;
+    for (int i = 0; i < 3; i++) {
+        ctf::Stats::Scope scope(&stats, "first");
+    }
+    {
+        ctf::Stats::Scope scope(&stats, "second");
+        ctf::Stats::Scope ignored(nullptr, "ignored");
+        std::vector<double> samples (1 << 16, 1);
+        ctf::filter_samples(samples, 44100, {{0, 1000, 0, 0}}, 50, nullptr, &stats);
+    }
+
+    const auto stages = stats.stages();
+    REQUIRE(stages.size() == 6);
+    REQUIRE(stages[0].name == "first");
+    REQUIRE(stages[0].calls == 3);
+    REQUIRE(stages[1].name == "plan");
+    REQUIRE(stages[2].name == "forward_fft");
+    REQUIRE(stages[3].name == "band_application");
+    REQUIRE(stages[4].name == "inverse_fft");
+    REQUIRE(stages[5].name == "second");
+    REQUIRE(stages[5].wall_seconds >= stages[2].wall_seconds + stages[4].wall_seconds);
+    for (const auto& stage : stages) {
+        REQUIRE(stage.wall_seconds >= 0);
+        REQUIRE(stage.peak_rss_bytes > 0);
+    }
+
+    const auto json = stats.json();
+    REQUIRE(json.starts_with("{\"stages\": [{\"name\": \"first\", \"calls\": 3"));
+    REQUIRE(json.find("\"total\": {\"name\": \"total\"") != std::string::npos);
+
+    // Allocations are counted in this program, without counting they are unknown rather than 0
+    REQUIRE(ctf::details::allocations_counted());
+    REQUIRE(json.find("\"allocated_bytes\": null") == std::string::npos);
+    ctf::details::allocations_counted() = false;
+    const auto uncounted_json = stats.json(), uncounted_table = stats.table();
+    ctf::details::allocations_counted() = true;
+    REQUIRE(uncounted_json.find("\"allocated_bytes\": null, \"peak_rss_bytes\"") != std::string::npos);
+    REQUIRE(uncounted_table.find("n/a") != std::string::npos);
+
+    // Aligned & nothrow allocations are counted too
+    const std::size_t before = ctf::details::allocated_bytes();
+    ::operator delete(::operator new(64, std::align_val_t(64)), std::align_val_t(64));
+    ::operator delete[](::operator new[](100, std::nothrow));
+    REQUIRE(ctf::details::allocated_bytes() - before >= 164);
+}
+
+TEST_CASE("Workspace transforms & filtering don't allocate after warm-up" "[ctf::Workspace][ctf::filter_padded]") {
+    const std::vector<ctf::Band> bands {{0, 1000, 0, 0}, {5000, 8000, 0, 0}};
+    std::mt19937 rng(16);
+    std::uniform_real_distribution<double> dist(-1, 1);
+    std::vector<double> samples(3000), padded(ctf::fft_size(samples.size()));
+    for (auto& s : samples) s = dist(rng);
+
+    ctf::Workspace workspace;
+    std::vector<std::complex<double>> series(4096), half_series(samples.size() / 2 + 1);
+    std::vector<double> restored(series.size()), real_restored(samples.size());
+    const auto run = [&] {
+        std::copy(samples.begin(), samples.end(), padded.begin());
+        std::fill(padded.begin() + samples.size(), padded.end(), 0);
+        ctf::filter_padded(std::span<double>(padded), 44100, bands, 50, workspace);
+
+        ctf::radix2fft(samples, series);
+        ctf::radix2fft_inverse(series, restored, workspace);
+        ctf::rfft<double>(samples, half_series);
+        ctf::irfft<double>(half_series, real_restored);
+    };
+    run();
+
+    const std::size_t allocated = ctf::details::allocated_bytes();
+    run();
+    REQUIRE(ctf::details::allocated_bytes() == allocated);
+
+    // Same results as the allocating overloads
+    auto expected = samples;
+    ctf::filter_samples(expected, 44100, bands, 50);
+    for (std::size_t i = 0; i < samples.size(); i++) {
+        REQUIRE(padded[i] == expected[i]);
+        REQUIRE(close_enough(restored[i], samples[i]));
+        REQUIRE(close_enough(real_restored[i], samples[i]));
+    }
+    REQUIRE(ctf::radix2fft_inverse(series) == restored);
+    REQUIRE_THROWS_AS(ctf::radix2fft(samples, std::span(series).first(2048)), std::invalid_argument);
+    REQUIRE_THROWS_AS(ctf::irfft<double>(half_series, std::span(restored)), std::invalid_argument);
+}
+
+TEST_CASE("Out-of-core filtering matches whole file filtering" "[ctf::OutOfCoreFft][ctf::filter_out_of_core]") {
+    std::uniform_real_distribution<double> unif(-1,1);
+    std::default_random_engine re;
+    const auto dir = std::filesystem::temp_directory_path().string();
+
+    // A small budget splits the transform into many blocks
+    const std::size_t size = 3 << 12;
+    ctf::details::ScratchFile<std::complex<double>> data(dir, size), work(dir, size);
+    std::vector<std::complex<double>> in (size);
+    for (auto& c : in) {
+        c = comp(unif(re), unif(re));
+    }
+    std::copy(in.begin(), in.end(), data.data());
+    auto expected = in;
+    ctf::get_plan(size)->forward(expected);
+
+    const ctf::OutOfCoreFft fft(size, 1 << 16);
+    fft.forward(data, work);
+    for (std::size_t i = 0; i < size; i++) {
+        REQUIRE(close_enough(data.data()[i], expected[i]));
+    }
+    fft.inverse(data, work);
+    for (std::size_t i = 0; i < size; i++) {
+        REQUIRE(close_enough(data.data()[i], in[i]));
+    }
+    REQUIRE_THROWS_AS(ctf::OutOfCoreFft(7 << 6, 1 << 16), std::invalid_argument);
+    REQUIRE_THROWS_AS(ctf::OutOfCoreFft(1 << 20, 1 << 10), std::invalid_argument);
+
+    const auto in_path = dir + "/ctf_ooc_in.wav", whole_path = dir + "/ctf_ooc_whole.wav";
+    const auto out_path = dir + "/ctf_ooc_out.wav";
+    std::vector<double> samples (30011);
+    for (auto& s : samples) {
+        s = unif(re) * 0.5;
+    }
+    {
+        ctf::WavWriter writer(in_path, {2, 44100, ctf::WavEncoding::pcm16}, samples.size());
+        writer.write(0, 0, samples.size(), samples.data());
+        writer.write(1, 0, samples.size() - 11, samples.data() + 11);
+        writer.write(1, samples.size() - 11, 11, samples.data());
+        writer.finish();
+    }
+
+    const std::vector<ctf::Band> bands {{0, 300, 0, 0.2}, {5000, 9000, 0.5, 0}};
+    const ctf::WavReader reader(in_path);
+    ctf::ThreadPool pool(2);
+    {
+        ctf::WavWriter writer(whole_path, reader.wav_format(), reader.frames());
+        ctf::filter_wav<double>(reader, writer, bands, 50, 0, pool);
+        writer.finish();
+    }
+    {
+        ctf::WavWriter writer(out_path, reader.wav_format(), reader.frames());
+        ctf::filter_out_of_core<double>(reader, writer, bands, 50, 1 << 16, dir, &pool);
+        writer.finish();
+    }
+
+    const ctf::WavReader whole(whole_path), out(out_path);
+    std::vector<double> whole_samples (samples.size()), out_samples (samples.size());
+    for (std::size_t channel = 0; channel < 2; channel++) {
+        whole.read(channel, 0, samples.size(), whole_samples.data());
+        out.read(channel, 0, samples.size(), out_samples.data());
+        REQUIRE(out_samples == whole_samples);
+    }
+    for (const auto& path : {in_path, whole_path, out_path}) {
+        std::filesystem::remove(path);
+    }
+}
+
+TEST_CASE("Planner measures plans and keeps them as wisdom" "[ctf::Planner]") {
+    ctf::ThreadPool pool(2);
+    const std::size_t size = 1 << 12;
+
+    ctf::Planner estimate;
+    const auto defaults = estimate.choose<double>(size, &pool);
+    REQUIRE(defaults.algorithm == ctf::FftAlgorithm::radix4);
+    REQUIRE(defaults.threads == 2);
+    REQUIRE(estimate.measured() == 0);
+
+    ctf::Planner measure(ctf::PlannerMode::measure);
+    const auto choice = measure.choose<float>(size, &pool);
+    REQUIRE((choice.threads == 1 || choice.threads == 2));
+    REQUIRE(measure.measured() == 1);
+    REQUIRE(measure.choose<float>(size, &pool).algorithm == choice.algorithm);
+    REQUIRE(measure.measured() == 1);
+
+    // Only the winner is cached, built by the measurement
+    using RealPlans = ctf::details::LruCache<std::tuple<std::size_t, ctf::FftAlgorithm>, ctf::BasicRealFftPlan<float>>;
+    RealPlans& cached = ctf::details::plan_cache<ctf::BasicRealFftPlan<float>, std::size_t, ctf::FftAlgorithm>();
+    REQUIRE(cached.find(std::tuple(size, choice.algorithm)) != nullptr);
+    for (auto algorithm : {ctf::FftAlgorithm::radix2, ctf::FftAlgorithm::split_radix, ctf::FftAlgorithm::four_step}) {
+        if (algorithm != choice.algorithm) REQUIRE(cached.find(std::tuple(size, algorithm)) == nullptr);
+    }
+
+    // Threads asking at once measure every size once
+    std::vector<std::thread> askers;
+    for (int i = 0; i < 4; i++) {
+        askers.emplace_back([&, i] { measure.choose<float>(i % 2 ? 2 * size : 4 * size); });
+    }
+    for (auto& asker : askers) asker.join();
+    REQUIRE(measure.measured() == 3);
+
+    // Parallel loops get the estimate for unknown sizes without keeping it, known sizes keep their choice
+    std::vector<ctf::PlanChoice> inside(2);
+    std::vector<int> in_loop(2);
+    pool.parallel_for(2, [&](std::size_t first, std::size_t) {
+        in_loop[first] = ctf::ThreadPool::in_parallel_loop();
+        inside[first] = measure.choose<float>(first ? size : 8 * size, &pool);
+    }, 2);
+    REQUIRE(in_loop == std::vector<int> {1, 1});
+    REQUIRE(!ctf::ThreadPool::in_parallel_loop());
+    REQUIRE(inside[0].algorithm == ctf::FftAlgorithm::radix4);
+    REQUIRE(inside[0].threads == 2);
+    REQUIRE(inside[1].algorithm == choice.algorithm);
+    REQUIRE(inside[1].threads == choice.threads);
+    REQUIRE(measure.measured() == 3);
+
+    // Saved wisdom is used in estimate mode too, for the same precision, size & threads only
+    std::stringstream wisdom;
+    measure.save(wisdom);
+    ctf::Planner later;
+    later.load(wisdom);
+    const auto loaded = later.choose<float>(size, &pool);
+    REQUIRE(loaded.algorithm == choice.algorithm);
+    REQUIRE(loaded.threads == choice.threads);
+    REQUIRE(later.choose<float>(size, nullptr).threads == 1);
+    REQUIRE(later.measured() == 0);
+
+    // Plans of every algorithm the planner picks from filter alike
+    std::vector<double> samples(size), expected;
+    for (std::size_t i = 0; i < size; i++) samples[i] = std::sin(0.01 * i) + std::sin(1.3 * i);
+    for (auto algorithm : {ctf::FftAlgorithm::radix4, ctf::FftAlgorithm::radix2, ctf::FftAlgorithm::split_radix,
+                           ctf::FftAlgorithm::four_step}) {
+        const auto plan = ctf::get_real_plan<double>(size, algorithm);
+        REQUIRE(plan->fft_algorithm() == algorithm);
+        std::vector<std::complex<double>> spectrum(plan->spectrum_size());
+        std::vector<double> filtered(size);
+        plan->forward(samples.data(), spectrum.data(), &pool);
+        ctf::get_filter_response(size, 44100, {{5000, 8000, 0, 0}}, 50)->apply(spectrum.data());
+        plan->inverse(spectrum.data(), filtered.data(), &pool);
+        if (expected.empty()) expected = filtered;
+        for (std::size_t i = 0; i < size; i++) {
+            REQUIRE(std::abs(filtered[i] - expected[i]) < 1e-9);
+        }
+    }
+
+    std::stringstream bad("# ctf wisdom\ndouble 4096 2 radix3 1\n");
+    REQUIRE_THROWS_AS(later.load(bad), std::invalid_argument);
+    std::stringstream bad_threads("double 4096 2 radix4 3\n");
+    REQUIRE_THROWS_AS(later.load(bad_threads), std::invalid_argument);
+}
+
+TEST_CASE("Cached spectra filter like whole files" "[ctf::Spectra]") {
+    std::uniform_real_distribution<double> unif(-1,1);
+    std::default_random_engine re;
+    const auto dir = std::filesystem::temp_directory_path().string();
+    const auto cache_dir = dir + "/ctf_spectra";
+    std::filesystem::remove_all(cache_dir);
+    std::filesystem::create_directory(cache_dir);
+
+    const auto in_path = dir + "/ctf_spectra_in.wav", whole_path = dir + "/ctf_spectra_whole.wav";
+    const auto out_path = dir + "/ctf_spectra_out.wav";
+    std::vector<double> samples (20011);
+    for (auto& s : samples) {
+        s = unif(re) * 0.5;
+    }
+    {
+        ctf::WavWriter writer(in_path, {2, 44100, ctf::WavEncoding::pcm16}, samples.size());
+        writer.write(0, 0, samples.size(), samples.data());
+        writer.write(1, 0, samples.size() - 7, samples.data() + 7);
+        writer.write(1, samples.size() - 7, 7, samples.data());
+        writer.finish();
+    }
+
+    const ctf::WavReader reader(in_path);
+    ctf::ThreadPool pool(2);
+    const auto same_output = [&](const ctf::Spectra& spectra, const std::vector<ctf::Band>& bands) {
+        {
+            ctf::WavWriter writer(whole_path, reader.wav_format(), reader.frames());
+            ctf::filter_wav<double>(reader, writer, bands, 50, 0, pool);
+            writer.finish();
+        }
+        {
+            ctf::WavWriter writer(out_path, reader.wav_format(), reader.frames());
+            spectra.filter(writer, bands, 50, pool);
+            writer.finish();
+        }
+        const ctf::WavReader whole(whole_path), out(out_path);
+        std::vector<double> whole_samples (samples.size()), out_samples (samples.size());
+        for (std::size_t channel = 0; channel < 2; channel++) {
+            whole.read(channel, 0, samples.size(), whole_samples.data());
+            out.read(channel, 0, samples.size(), out_samples.data());
+            if (out_samples != whole_samples) return false;
+        }
+        return true;
+    };
+
+    // Filtering again with more bands reuses the spectra
+    std::vector<ctf::Band> bands {{0, 300, 0, 0.2}};
+    const ctf::Spectra in_memory(reader, "", &pool);
+    REQUIRE(!in_memory.cached());
+    REQUIRE(in_memory.size() == ctf::fft_size(samples.size()));
+    REQUIRE(same_output(in_memory, bands));
+    bands.push_back({5000, 9000, 0.5, 0});
+    REQUIRE(same_output(in_memory, bands));
+
+    const ctf::Spectra written(reader, cache_dir, &pool);
+    REQUIRE(!written.cached());
+    REQUIRE(std::filesystem::exists(written.path()));
+    const ctf::Spectra mapped(reader, cache_dir, &pool);
+    REQUIRE(mapped.cached());
+    REQUIRE(mapped.path() == written.path());
+    REQUIRE(same_output(mapped, bands));
+    for (std::size_t bin = 0; bin <= mapped.size() / 2; bin++) {
+        REQUIRE(mapped.channel(1)[bin] == in_memory.channel(1)[bin]);
+    }
+
+    // Other precisions are cached separately, damaged cache files are replaced
+    REQUIRE(ctf::BasicSpectra<float>(reader, cache_dir).path() != mapped.path());
+    std::filesystem::resize_file(mapped.path(), 100);
+    REQUIRE(!ctf::Spectra(reader, cache_dir).cached());
+    REQUIRE(ctf::Spectra(reader, cache_dir).cached());
+
+    {
+        ctf::WavWriter writer(out_path, reader.wav_format(), reader.frames() - 1);
+        REQUIRE_THROWS_AS(mapped.filter(writer, bands, 50, pool), std::invalid_argument);
+    }
+    std::filesystem::remove_all(cache_dir);
+    for (const auto& path : {in_path, whole_path, out_path}) {
+        std::filesystem::remove(path);
+    }
+}
+
+TEST_CASE("Pipelined files are filtered like blocks" "[ctf::filter_wav_pipelined][ctf::BlockFilter]") {
+    std::uniform_real_distribution<double> unif(-1,1);
+    std::default_random_engine re;
+    const auto dir = std::filesystem::temp_directory_path().string();
+    const auto in_path = dir + "/ctf_pipeline_in.wav", out_path = dir + "/ctf_pipeline_out.wav";
+    const std::vector<ctf::Band> bands {{0, 300, 0, 0.2}, {5000, 9000, 0.5, 0}};
+    constexpr std::size_t block_fft = 512;
+
+    for (std::size_t frames : {100, 256, 5003}) {
+        std::vector<double> samples (frames);
+        for (auto& s : samples) {
+            s = unif(re) * 0.5;
+        }
+        {
+            ctf::WavWriter writer(in_path, {2, 44100, ctf::WavEncoding::float64}, frames);
+            writer.write(0, 0, frames, samples.data());
+            std::reverse(samples.begin(), samples.end());
+            writer.write(1, 0, frames, samples.data());
+            writer.finish();
+        }
+        const ctf::WavReader reader(in_path);
+
+        // Every channel through a block filter of its own
+        std::vector<std::vector<double>> expected (2);
+        for (std::size_t channel = 0; channel < 2; channel++) {
+            ctf::BlockFilter filter(44100, bands, 50, block_fft);
+            reader.read(channel, 0, frames, samples.data());
+            filter.process(samples.data(), frames, expected[channel]);
+            filter.flush(expected[channel]);
+        }
+
+        for (std::size_t workers : {1, 3}) {
+            for (std::size_t depth : {2, 0}) {
+                {
+                    ctf::WavWriter writer(out_path, reader.wav_format(), frames);
+                    ctf::filter_wav_pipelined<double>(reader, writer, bands, 50, block_fft, workers, depth);
+                    writer.finish();
+                }
+                const ctf::WavReader out(out_path);
+                for (std::size_t channel = 0; channel < 2; channel++) {
+                    out.read(channel, 0, frames, samples.data());
+                    for (std::size_t i = 0; i < frames; i++) {
+                        REQUIRE(close_enough(samples[i], expected[channel][i], 1e-12));
+                    }
+                }
+            }
+        }
+    }
+
+    const ctf::WavReader reader(in_path);
+    ctf::WavWriter writer(out_path, reader.wav_format(), reader.frames() - 1);
+    REQUIRE_THROWS_AS(ctf::filter_wav_pipelined<double>(reader, writer, bands, 50, block_fft, 1),
+                      std::invalid_argument);
+    REQUIRE_THROWS_AS(ctf::filter_wav_pipelined<double>(reader, writer, bands, 50, 2, 1), std::invalid_argument);
+    std::filesystem::remove(in_path);
+    std::filesystem::remove(out_path);
+}
+
+TEST_CASE("Spectrograms find tones in every frame" "[ctf::write_spectrogram][ctf::SpectrogramReader]") {
+    const auto dir = std::filesystem::temp_directory_path().string();
+    const auto in_path = dir + "/ctf_stft_in.wav", out_path = dir + "/ctf_stft.spectrogram";
+    const auto decimated_path = dir + "/ctf_stft_decimated.spectrogram";
+
+    // Channel 0 has a tone in bin 64 of a 1024 point transform, channel 1 switches from bin 32 to bin 128
+    const std::size_t frames = 20000, fft = 1024;
+    std::vector<double> left (frames), right (frames);
+    for (std::size_t i = 0; i < frames; i++) {
+        left[i] = 0.5 * std::sin(2 * M_PI * 64 * i / fft);
+        right[i] = 0.25 * std::sin(2 * M_PI * (i < frames / 2 ? 32 : 128) * i / fft);
+    }
+    {
+        ctf::WavWriter writer(in_path, {2, 48000, ctf::WavEncoding::float32}, frames);
+        writer.write(0, 0, frames, left.data());
+        writer.write(1, 0, frames, right.data());
+        writer.finish();
+    }
+    const ctf::WavReader reader(in_path);
+
+    ctf::StftSettings settings;
+    settings.fft_size = fft;
+    settings.hop = 300;
+    ctf::ThreadPool pool(3);
+    const auto shape = ctf::write_spectrogram<double>(reader, out_path, settings, pool);
+    REQUIRE(shape.frames == 1 + (frames - fft + 299) / 300);
+    REQUIRE(shape.bins == fft / 2 + 1);
+
+    const ctf::SpectrogramReader spectrogram(out_path);
+    REQUIRE(spectrogram.shape().frames == shape.frames);
+    REQUIRE(spectrogram.shape().sample_rate == 48000);
+    REQUIRE(spectrogram.shape().window_size == fft);
+    const auto peak = [&](std::size_t channel, std::size_t frame) {
+        const float* magnitudes = spectrogram.frame(channel, frame);
+        return std::max_element(magnitudes, magnitudes + spectrogram.shape().bins) - magnitudes;
+    };
+    for (std::size_t f = 0; f + 1 < shape.frames; f++) {
+        REQUIRE(peak(0, f) == 64);
+        REQUIRE(std::abs(spectrogram.frame(0, f)[64] - 0.25) < 1e-3);
+    }
+    REQUIRE(peak(1, 0) == 32);
+    REQUIRE(peak(1, shape.frames - 2) == 128);
+
+    // Thread count & precision don't move the peaks, decimation keeps the largest magnitudes
+    settings.bin_decimation = 4;
+    settings.frame_decimation = 5;
+    ctf::ThreadPool single(1);
+    const auto decimated_shape = ctf::write_spectrogram<float>(reader, decimated_path, settings, single);
+    REQUIRE(decimated_shape.bins == (fft / 2 + 1 + 3) / 4);
+    REQUIRE(decimated_shape.frames == (shape.frames + 4) / 5);
+    const ctf::SpectrogramReader decimated(decimated_path);
+    for (std::size_t f = 0; f < decimated_shape.frames; f++) {
+        for (std::size_t bin = 0; bin < decimated_shape.bins; bin++) {
+            float expected = 0;
+            for (std::size_t g = 5 * f; g < std::min<std::size_t>(5 * f + 5, shape.frames); g++) {
+                for (std::size_t b = 4 * bin; b < std::min<std::size_t>(4 * bin + 4, shape.bins); b++) {
+                    expected = std::max(expected, spectrogram.frame(1, g)[b]);
+                }
+            }
+            REQUIRE(std::abs(decimated.frame(1, f)[bin] - expected) < 1e-4);
+        }
+    }
+
+    settings.window_size = 2 * fft;
+    REQUIRE_THROWS_AS(ctf::write_spectrogram<double>(reader, out_path, settings, pool), std::invalid_argument);
+    REQUIRE_THROWS_AS(ctf::SpectrogramReader(in_path), std::invalid_argument);
+    for (const auto& path : {in_path, out_path, decimated_path}) {
+        std::filesystem::remove(path);
+    }
+}
+
+TEST_CASE("Spectrogram frames start inside the input" "[ctf::write_spectrogram]") {
+    const auto dir = std::filesystem::temp_directory_path().string();
+    const auto in_path = dir + "/ctf_hop_in.wav", out_path = dir + "/ctf_hop.spectrogram";
+
+    const std::size_t frames = 1150;
+    std::vector<double> samples (frames);
+    for (std::size_t i = 0; i < frames; i++) {
+        samples[i] = 0.5 * std::sin(2 * M_PI * 8 * i / 128);
+    }
+    {
+        ctf::WavWriter writer(in_path, {1, 48000, ctf::WavEncoding::float32}, frames);
+        writer.write(0, 0, frames, samples.data());
+        writer.finish();
+    }
+    const ctf::WavReader reader(in_path);
+
+    // Hops longer than the window skip samples, frames starting past the end aren't counted
+    ctf::StftSettings settings;
+    settings.fft_size = 128;
+    settings.window_size = 100;
+    ctf::ThreadPool pool(2);
+    for (std::size_t hop : {100, 101, 149, 1000, 1149, 1150, 5000}) {
+        settings.hop = hop;
+        const auto shape = ctf::write_spectrogram<double>(reader, out_path, settings, pool);
+        REQUIRE(shape.frames == 1 + (frames - 1) / hop);
+        REQUIRE((shape.frames - 1) * hop < frames);
+        REQUIRE(ctf::SpectrogramReader(out_path).shape().frames == shape.frames);
+    }
+    for (const auto& path : {in_path, out_path}) {
+        std::filesystem::remove(path);
+    }
+}
+
+TEST_CASE("IIR designs meet the bands and filter files like FFTs" "[ctf::design_iir][ctf::filter_wav_iir]") {
+    const std::vector<ctf::Band> notch {{49, 51, 0, 0}};
+    const auto design = ctf::design_iir(44100, notch, 50);
+    REQUIRE(design);
+    REQUIRE(design->max_error <= 0.05);
+    const auto gain = [&](double freq) {
+        return ctf::details::cascade_power(design->sections, 2 * M_PI * freq / 44100);
+    };
+    for (double freq : {49.0, 50.0, 51.0}) {
+        REQUIRE(gain(freq) < 0.05);
+    }
+    REQUIRE(gain(1000) > 0.95);
+
+    // Brick walls & sloped bands have no design
+    REQUIRE_FALSE(ctf::design_iir(44100, {{0, 100, 0, 0}}, 0));
+    REQUIRE_FALSE(ctf::design_iir(44100, {{1000, 2000, 0.2, 0.8}}, 50));
+    REQUIRE(ctf::design_iir(44100, {{0, 100, 0, 0}}, 100));
+
+    // Stable sections, an impulse dies out
+    ctf::BiquadCascade cascade(design->sections);
+    std::vector<double> impulse (44100, 0);
+    impulse[0] = 1;
+    cascade.process(impulse.data(), impulse.size());
+    REQUIRE(std::abs(impulse.back()) < 1e-9);
+
+    const auto dir = std::filesystem::temp_directory_path().string();
+    const auto in_path = dir + "/ctf_iir_in.wav", iir_path = dir + "/ctf_iir_out.wav", fft_path = dir + "/ctf_fft_out.wav";
+    constexpr std::size_t frames = 44100;
+    std::vector<double> samples (frames), tone (frames);
+    for (std::size_t i = 0; i < frames; i++) {
+        tone[i] = 0.4 * std::sin(2 * M_PI * 1000 * i / 44100.0);
+        samples[i] = tone[i] + 0.4 * std::sin(2 * M_PI * 50 * i / 44100.0);
+    }
+    {
+        ctf::WavWriter writer(in_path, {2, 44100, ctf::WavEncoding::float64}, frames);
+        writer.write(0, 0, frames, samples.data());
+        writer.write(1, 0, frames, samples.data());
+        writer.finish();
+    }
+    const ctf::WavReader reader(in_path);
+    ctf::ThreadPool pool(2);
+    {
+        ctf::WavWriter writer(iir_path, reader.wav_format(), frames);
+        ctf::filter_wav_iir<double>(reader, writer, *design, dir, pool);
+        writer.finish();
+        ctf::WavWriter fft_writer(fft_path, reader.wav_format(), frames);
+        ctf::filter_wav<double>(reader, fft_writer, notch, 50, 0, pool);
+        fft_writer.finish();
+    }
+
+    // The hum is gone and the tone kept, away from the edges where the filters start up
+    const ctf::WavReader iir(iir_path), fft(fft_path);
+    std::vector<double> iir_samples (frames), fft_samples (frames);
+    for (std::size_t channel = 0; channel < 2; channel++) {
+        iir.read(channel, 0, frames, iir_samples.data());
+        fft.read(channel, 0, frames, fft_samples.data());
+        for (std::size_t i = frames / 4; i < 3 * frames / 4; i++) {
+            REQUIRE(std::abs(iir_samples[i] - tone[i]) < 0.01);
+            REQUIRE(std::abs(iir_samples[i] - fft_samples[i]) < 0.02);
+        }
+    }
+    for (const auto& path : {in_path, iir_path, fft_path}) {
+        std::filesystem::remove(path);
+    }
+}
+
+TEST_CASE("IIR engine filters in chunks of any length" "[ctf::filter_wav_iir][ctf::filter_wav_iir_causal][ctf::filter_stream_iir]") {
+    const auto design = ctf::design_iir(44100, {{49, 51, 0, 0}, {0, 20, 0, 0}}, 50);
+    REQUIRE(design);
+    const auto dir = std::filesystem::temp_directory_path().string();
+    const auto in_path = dir + "/ctf_iir_chunks_in.wav", out_path = dir + "/ctf_iir_chunks_out.wav";
+
+    // Longer than a chunk & not a multiple of it, so the zero phase passes go through a scratch file
+    const std::size_t frames = 2 * ctf::details::iir_chunk_frames + 12345;
+    std::vector<double> left (frames), right (frames);
+    for (std::size_t i = 0; i < frames; i++) {
+        left[i] = 0.3 * std::sin(2 * M_PI * 50 * i / 44100.0) + 0.3 * std::sin(2 * M_PI * 700 * i / 44100.0);
+        right[i] = 0.5 * std::sin(2 * M_PI * 3000 * i / 44100.0 + 0.1 * std::sin(0.001 * i));
+    }
+    {
+        ctf::WavWriter writer(in_path, {2, 44100, ctf::WavEncoding::float64}, frames);
+        writer.write(0, 0, frames, left.data());
+        writer.write(1, 0, frames, right.data());
+        writer.finish();
+    }
+    const ctf::WavReader reader(in_path);
+    ctf::ThreadPool pool(2);
+    const auto same_output = [&](const std::vector<ctf::Biquad>& sections, bool zero_phase) {
+        const ctf::WavReader out(out_path);
+        std::vector<double> filtered (frames);
+        for (std::size_t channel = 0; channel < 2; channel++) {
+            auto expected = channel ? right : left;
+            ctf::BiquadCascade cascade(sections);
+            if (zero_phase) {
+                cascade.process_zero_phase(expected.data(), frames);
+            } else {
+                cascade.process(expected.data(), frames);
+            }
+            out.read(channel, 0, frames, filtered.data());
+            REQUIRE(filtered == expected);
+        }
+    };
+
+    // The same samples as filtering whole channels in memory
+    {
+        ctf::WavWriter writer(out_path, reader.wav_format(), frames);
+        ctf::filter_wav_iir<double>(reader, writer, *design, dir, pool);
+        writer.finish();
+    }
+    same_output(design->sections, true);
+
+    // A causal pass has the magnitude of both passes, blocks continue the sections' state
+    const auto causal = ctf::causal_sections(*design);
+    REQUIRE(causal.size() == 2 * design->sections.size());
+    for (double freq : {50.0, 700.0, 3000.0}) {
+        const double w = 2 * M_PI * freq / 44100, pass = ctf::details::cascade_power(design->sections, w);
+        REQUIRE(std::abs(ctf::details::cascade_power(causal, w) - pass * pass) < 1e-9);
+    }
+    for (std::size_t chunk : {1000, 1 << 20}) {
+        ctf::WavWriter writer(out_path, reader.wav_format(), frames);
+        ctf::filter_wav_iir_causal<double>(reader, writer, *design, chunk, pool);
+        writer.finish();
+        same_output(causal, false);
+    }
+
+    // Streams run the causal sections without delay
+    std::FILE* raw_in = std::tmpfile();
+    std::FILE* raw_out = std::tmpfile();
+    std::fwrite(left.data(), sizeof(double), 5000, raw_in);
+    std::rewind(raw_in);
+    const auto report = ctf::filter_stream_iir<double>(raw_in, raw_out, {1, 44100, ctf::WavEncoding::float64}, *design, 64);
+    REQUIRE(report.frames == 5000);
+    REQUIRE(report.latency_frames() == 64);
+    std::vector<double> streamed (5001), expected (left.begin(), left.begin() + 5000);
+    std::rewind(raw_out);
+    REQUIRE(std::fread(streamed.data(), sizeof(double), streamed.size(), raw_out) == 5000);
+    streamed.resize(5000);
+    ctf::BiquadCascade(causal).process(expected.data(), expected.size());
+    REQUIRE(streamed == expected);
+    std::fclose(raw_in);
+    std::fclose(raw_out);
+
+    {
+        ctf::WavWriter writer(out_path, reader.wav_format(), frames);
+        REQUIRE_THROWS_AS(ctf::filter_wav_iir_causal<double>(reader, writer, *design, 0, pool), std::invalid_argument);
+    }
+    for (const auto& path : {in_path, out_path}) {
+        std::filesystem::remove(path);
+    }
+}
+
+TEST_CASE("Engines are chosen by cost" "[ctf::choose_engine]") {
+    const std::vector<ctf::Band> notch {{49, 51, 0, 0}}, brick {{0, 100, 0, 0}};
+    const auto single = ctf::choose_engine(44100, 1, 44100, notch, 50, 1);
+    REQUIRE(single.engine == ctf::Engine::iir);
+    REQUIRE(single.iir_cost < single.fft_cost);
+
+    // Transforms split across threads, a channel's recursion doesn't
+    REQUIRE(ctf::choose_engine(44100, 1, 44100, notch, 50, 64).engine == ctf::Engine::fft);
+    REQUIRE(ctf::choose_engine(44100, 1, 44100, notch, 50, 64, ctf::Engine::iir).engine == ctf::Engine::iir);
+    REQUIRE(ctf::choose_engine(44100, 1, 44100, notch, 50, 1, ctf::Engine::fft).engine == ctf::Engine::fft);
+
+    const auto fallback = ctf::choose_engine(44100, 1, 44100, brick, 0, 1);
+    REQUIRE(fallback.engine == ctf::Engine::fft);
+    REQUIRE_FALSE(fallback.design);
+    REQUIRE_THROWS_AS(ctf::choose_engine(44100, 1, 44100, brick, 0, 1, ctf::Engine::iir), std::invalid_argument);
+}
+
+TEST_CASE("Filter sessions filter clip after clip like blocks" "[ctf::FilterSession]") {
+    constexpr std::size_t frames = 5000, channels = 2;
+    const std::vector<ctf::Band> bands {{2500, 3500, 0, 0}};
+    std::vector<double> in (frames * channels);
+    for (std::size_t i = 0; i < frames; i++) {
+        in[i * channels] = sin(2 * M_PI * 440.0 * i / sample_rate) + sin(2 * M_PI * 3000.0 * i / sample_rate);
+        in[i * channels + 1] = sin(2 * M_PI * 3000.0 * i / sample_rate);
+    }
+
+    // Every channel through a block filter of its own
+    std::vector<std::vector<double>> expected (channels);
+    for (std::size_t c = 0; c < channels; c++) {
+        std::vector<double> channel (frames);
+        for (std::size_t i = 0; i < frames; i++) {
+            channel[i] = in[i * channels + c];
+        }
+        ctf::BlockFilter filter(sample_rate, bands, 200, 4096);
+        filter.process(channel.data(), frames, expected[c]);
+        filter.flush(expected[c]);
+    }
+
+    ctf::FilterSession session(sample_rate, channels, bands, 200, 64, 4096);
+    REQUIRE(session.latency() == 64 + 1024);
+    for (std::size_t chunk : {1, 37, 4096}) {
+        // The same clip twice, the second one starts from a clean state
+        std::vector<double> out;
+        for (int clip = 0; clip < 2; clip++) {
+            for (std::size_t first = 0; first < frames; first += chunk) {
+                session.push(in.data() + first * channels, std::min(chunk, frames - first));
+                std::vector<double> ready (session.available() * channels);
+                REQUIRE(session.pull(ready.data(), ready.size() / channels) == ready.size() / channels);
+                out.insert(out.end(), ready.begin(), ready.end());
+            }
+            session.finish();
+            std::vector<double> rest (session.available() * channels);
+            session.pull(rest.data(), rest.size() / channels);
+            out.insert(out.end(), rest.begin(), rest.end());
+        }
+        REQUIRE(out.size() == 2 * frames * channels);
+        for (std::size_t i = 0; i < out.size(); i++) {
+            REQUIRE(close_enough(out[i], expected[i % channels][(i / channels) % frames]));
+        }
+    }
+
+    // Resetting drops a clip half way through
+    session.push(in.data(), 3000);
+    session.reset();
+    REQUIRE(session.available() == 0);
+    session.finish();
+    REQUIRE(session.available() == 0);
+
+    REQUIRE_THROWS_AS(ctf::FilterSession(sample_rate, 0, bands, 200), std::invalid_argument);
+    REQUIRE_THROWS_AS(ctf::FilterSession(sample_rate, 1, {{3000, 2000, 0, 0}}, 200), std::invalid_argument);
+}
+
+TEST_CASE("C sessions filter clips and report errors" "[ctf_session]") {
+    REQUIRE(ctf_api_version() == CTF_API_VERSION);
+    constexpr std::size_t frames = 3000;
+    const ctf_band band {2500, 3500, 0, 0};
+    ctf_session_config config;
+    ctf_session_config_init(&config);
+    config.sample_rate = sample_rate;
+    config.bands = &band;
+    config.band_count = 1;
+    config.roll = 200;
+
+    std::vector<float> in (frames), out (frames);
+    for (std::size_t i = 0; i < frames; i++) {
+        in[i] = 0.5 * sin(2 * M_PI * 440.0 * i / sample_rate) + 0.5 * sin(2 * M_PI * 3000.0 * i / sample_rate);
+    }
+    ctf::BasicFilterSession<float> expected_session(sample_rate, 1, {{2500, 3500, 0, 0}}, 200);
+    std::vector<float> expected (frames);
+    expected_session.push(in.data(), frames);
+    expected_session.finish();
+    REQUIRE(expected_session.pull(expected.data(), frames) == frames);
+
+    ctf_session* session = nullptr;
+    REQUIRE(ctf_session_create(&config, &session) == CTF_OK);
+    REQUIRE(ctf_session_latency(session) == 256 + 1024);
+    for (int clip = 0; clip < 3; clip++) {
+        REQUIRE(ctf_filter_clip(session, in.data(), out.data(), frames) == CTF_OK);
+        REQUIRE(out == expected);
+    }
+
+    // In place, and pushed & pulled in parts
+    std::vector<float> samples = in;
+    REQUIRE(ctf_filter_clip(session, samples.data(), samples.data(), frames) == CTF_OK);
+    REQUIRE(samples == expected);
+    REQUIRE(ctf_session_push(session, in.data(), 1000) == CTF_OK);
+    REQUIRE(ctf_session_push(session, in.data() + 1000, frames - 1000) == CTF_OK);
+    REQUIRE(ctf_session_finish(session) == CTF_OK);
+    REQUIRE(ctf_session_available(session) == frames);
+    REQUIRE(ctf_session_pull(session, out.data(), 100) == 100);
+    REQUIRE(ctf_session_pull(session, out.data() + 100, frames) == frames - 100);
+    REQUIRE(out == expected);
+    ctf_session_destroy(session);
+
+    // Errors are returned with a message, never thrown
+    ctf_session* bad = nullptr;
+    config.channels = 0;
+    REQUIRE(ctf_session_create(&config, &bad) == CTF_INVALID_ARGUMENT);
+    REQUIRE(bad == nullptr);
+    REQUIRE(std::string(ctf_last_error()).size() > 0);
+    config.channels = 1;
+    config.size = 0;
+    REQUIRE(ctf_session_create(&config, &bad) == CTF_INVALID_ARGUMENT);
+    REQUIRE(ctf_session_push(nullptr, in.data(), frames) == CTF_INVALID_ARGUMENT);
+    REQUIRE(ctf_session_pull(nullptr, out.data(), frames) == 0);
+    ctf_session_destroy(nullptr);
+}